@@ -13,6 +13,8 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 
+#define NR_PREALLOC 7 // 文件预分配窗口的最大块数
+
 /**
  * 将指定地址(addr)处的y一块1024字节的内存清零
  *
@@ -53,40 +55,122 @@
                         res;})
 
 /**
- * 从 addr 开始寻找第一个 0值位
+ * 在 addr 开始的位图中从第 offset 位开始寻找第一个 0值位
  *
- * 输入：%0: ecx(返回值), %1: ecx(0), %2: esi(addr)
+ * addr: 位图所在的缓冲区地址
+ * offset: 开始寻找的位偏移
+ * size: 位图中的有效位数（不超过 8192），只在 [offset, size) 范围内寻找
  *
- * 在 addr 起始的内存地址开始的位图中寻找第一个是0的位，并将其距离addr的位偏移值返回
- * 扫描范围是1024字节（8192位）
- * 
+ * 返回：第一个 0值位的位偏移，找不到时返回 size
+ *
+ * 每次取出一个长字（32位）取反，全为 0 说明这 32 位都被占用，直接跳过；否则用 bsfl 找出最低的一个 1 位
+ */
+static inline int find_next_zero(unsigned long * addr, int offset, int size)
+{
+        unsigned long * p = addr + (offset >> 5);
+        unsigned long word;
+        int bit;
+
+        if (offset >= size)
+                return size;
+        word = ~*(p++) & (~0UL << (offset & 31)); // 忽略 offset 之前的位
+        offset &= ~31;
+        for (;;) {
+                if (word) {
+                        __asm__("bsfl %1,%0":"=r" (bit):"r" (word));
+                        offset += bit;
+                        return (offset < size) ? offset : size;
+                }
+                if ((offset += 32) >= size)
+                        return size;
+                word = ~*(p++);
+        }
+}
+
+/*
+ * 统计一块位图中前 nbits 位里 0值位的个数
+ */
+static int count_zero_bits(unsigned long * addr, int nbits)
+{
+        unsigned long word;
+        int i, n = 0;
+
+        for (i = 0 ; i < nbits ; i += 32) {
+                word = ~*(addr++);
+                if (nbits - i < 32)
+                        word &= (1UL << (nbits - i)) - 1;
+                while (word) {
+                        word &= word - 1; // 清掉最低的一个 1 位
+                        n++;
+                }
+        }
+        return n;
+}
+
+/**
+ * 统计超级块中每块“i节点位图”和“逻辑块位图”的空闲位数，并复位分配起点
+ *
+ * sb: 超级块指针（位图已经读入）
+ *
+ * 无返回值
+ *
+ * 只统计有效的位：i节点位图有 s_ninodes + 1 位，逻辑块位图有 s_nzones - s_firstdatazone + 1 位（第 0 位都保留不用）
  */
-// 1. cld: 清方向位
-// 2. 标号1: lodsl 取[esi] -> eax
-// 3. notl: eax 中每一位取反
-// 4. bsfl: 从0位开始扫描eax中是1的第一个位，并把偏移值 -> edx
-// 5. j2 2f: 如果 eax 全是0，则向前跳转到标号为2处
-// 6. ecx + edx -> ecx （计算结果）
-// 7. 向前跳转到标号3处（结束）
-// 8. 标号2: ecx + 32 -> ecx 因为每次 loadsl 都会载入32个字节的长字到 eax, 所以这里往 ecx + 32
-// 9. cmpl: ecx 和 8192 比较
-// 10. 如果 ecx 不等于 8192 ，则跳转到标号1处，继续加载下一个长字到 eax 做扫描
-// 11. 标号3： 结束，返回 ecx （如果未找到对应，则ecx此时应该是"8192"）
-#define find_first_zero(addr) ({                                        \
-                        int __res;                                      \
-                        __asm__ __volatile__ ("cld\n"                   \
-                                              "1:\tlodsl\n\t"           \
-                                              "notl %%eax\n\t"          \
-                                              "bsfl %%eax,%%edx\n\t"    \
-                                              "je 2f\n\t"               \
-                                              "addl %%edx,%%ecx\n\t"    \
-                                              "jmp 3f\n"                \
-                                              "2:\taddl $32,%%ecx\n\t"  \
-                                              "cmpl $8192,%%ecx\n\t"    \
-                                              "jl 1b\n"                 \
-                                              "3:"                      \
-                                              :"=c" (__res):"c" (0),"S" (addr)); \
-                        __res;})
+void count_free_bits(struct super_block * sb)
+{
+        int i, n;
+
+        for (i = 0 ; i < 8 ; i++) {
+                n = sb->s_ninodes + 1 - (i << 13);
+                if (n > 8192)
+                        n = 8192;
+                sb->s_imap_free[i] = (sb->s_imap[i] && n > 0) ?
+                        count_zero_bits((unsigned long *) sb->s_imap[i]->b_data, n) : 0;
+                n = sb->s_nzones - sb->s_firstdatazone + 1 - (i << 13);
+                if (n > 8192)
+                        n = 8192;
+                sb->s_zmap_free[i] = (sb->s_zmap[i] && n > 0) ?
+                        count_zero_bits((unsigned long *) sb->s_zmap[i]->b_data, n) : 0;
+        }
+        sb->s_ilast = sb->s_zlast = 0;
+}
+
+/*
+ * 在位图中分配一个空闲位
+ *
+ * map: 位图缓冲块指针数组（s_imap 或 s_zmap）
+ * nfree: 每块位图的空闲位数（s_imap_free 或 s_zmap_free）
+ * nbits: 位图中的有效位数
+ * goal: 从这一位开始往后找，找到最后一块位图后再从头开始
+ *
+ * 返回：分配到的位偏移，失败返回 0（第 0 位总是被占用）
+ */
+static int alloc_bit(struct buffer_head ** map, unsigned short * nfree, int nbits, int goal)
+{
+        struct buffer_head * bh;
+        int n, k, j, limit;
+
+        if (goal < 0 || goal >= nbits)
+                goal = 0;
+        k = goal >> 13;
+        // 最多检查 9 次：最后一次回到开始的那块位图，检查 goal 之前的部分
+        for (n = 0 ; n <= 8 ; n++, k = (k + 1) & 7) {
+                if (!(bh = map[k]) || !nfree[k]) // 位图不存在或者已经没有空闲位：跳过
+                        continue;
+                limit = nbits - (k << 13);
+                if (limit > 8192)
+                        limit = 8192;
+                j = find_next_zero((unsigned long *) bh->b_data, n ? 0 : (goal & 8191), limit);
+                if (j >= limit)
+                        continue;
+                if (set_bit(j,bh->b_data)) // 设置该位为1, 这里的返回值是原来这位的位值
+                        panic("alloc_bit: bit already set");
+                bh->b_dirt = 1; // 位图对应缓冲头的修改标志置为1
+                nfree[k]--;
+                return j + (k << 13);
+        }
+        return 0;
+}
 
 /**
  * 释放指定设备dev上数据区中的逻辑块block
@@ -133,55 +217,122 @@ void free_block(int dev, int block)
                 panic("free_block: bit already cleared");
         }
         sb->s_zmap[block/8192]->b_dirt = 1; // 置相应的逻辑块缓冲头结构的修改标志为1（需要同步给设备！！！）
+        sb->s_zmap_free[block/8192]++; // 这块位图的空闲位数加1
+}
+
+/*
+ * 在高速缓冲区中为刚分配的逻辑块 block 取得一个缓冲块并清零，标记为有效和已修改
+ */
+static void clear_new_block(int dev, int block)
+{
+        struct buffer_head * bh;
+
+        if (!(bh=getblk(dev,block))) // 高速缓冲区中申请一块对应的空闲缓冲块
+                panic("new_block: cannot get block");
+        if (bh->b_count != 1) // 新申请的高速缓冲块其引用计数必须为1
+                panic("new block: count is != 1"); //出错，停机
+        clear_block(bh->b_data); // 清空刚才申请的空闲缓冲块上（1024字节）的数据
+        bh->b_uptodate = 1; // 有效标志置为1
+        bh->b_dirt = 1; // 修改标志置为1 
+        brelse(bh); //释放刚才申请的空闲缓冲块，以便其他程序使用
 }
 
 /**
  * 向设备申请一块对应的逻辑块
  *
  * dev: 设备号
+ * goal: 希望新块紧跟在这个逻辑块之后（通常是文件的前一个逻辑块），0 表示没有要求
  *
  * 执行成功返回对应的逻辑块号（当前版本等于盘块号），失败为 0
- * 
+ *
+ * 从 goal 之后（没有 goal 时从上次分配的位置之后）开始往后找第一个空闲块，
+ * 这样同一个文件的数据块在设备上尽量连续，顺序读写时的请求可以合并
  */
-int new_block(int dev)
+int new_block(int dev, int goal)
 {
-        struct buffer_head * bh;
         struct super_block * sb;
-        int i,j;
+        int j, nbits;
 
         // 首先取设备的超级块信息
         if (!(sb = get_super(dev))) // 无法取到设备的超级块信息，异常退出
                 panic("trying to get new block from nonexistant device");
-        j = 8192;
+        nbits = sb->s_nzones - sb->s_firstdatazone + 1; // 逻辑块位图中的有效位数
+        // 把 goal 之后的那一块换算成位图中的位偏移
+        j = goal - sb->s_firstdatazone + 2;
+        if (!goal || j <= 0 || j >= nbits)
+                j = sb->s_zlast;
+        if (!(j = alloc_bit(sb->s_zmap,sb->s_zmap_free,nbits,j)))
+                return 0; // 没有找到空闲逻辑块，出错返回0 
+        sb->s_zlast = j; // 下次从这里往后找
+        j += sb->s_firstdatazone-1; // 计算实际的逻辑块号，刚才的j只是对应位图的偏移值
+        clear_new_block(dev,j);
+        return j; // 返回实际的逻辑块号
+}
 
-        //扫描文件系统的8块逻辑块位图（对应的缓冲区）
-        for (i=0 ; i<8 ; i++) {
-                if ((bh=sb->s_zmap[i])) { // bh 为逻辑块位图对应的缓冲区头结构指针
-                        if ((j=find_first_zero(bh->b_data))<8192) // 获得对应位图的第一个0位的偏移值
-                                break; // 如果找到则中断扫描
-                }
+/**
+ * 为文件申请一块新的逻辑块，优先使用该文件的预分配窗口
+ *
+ * inode: 文件的i节点指针
+ * goal: 文件的前一个逻辑块（见 new_block）
+ *
+ * 执行成功返回对应的逻辑块号，失败为 0
+ *
+ * 文件顺序增长时（goal 正好在预分配窗口之前），直接使用窗口中的下一块
+ * 否则放弃原来的窗口，调用 new_block 申请一块，并且把紧跟在它后面的最多 NR_PREALLOC 个空闲块在位图中预先占用，
+ * 作为新的预分配窗口：几个文件同时增长时，各自的数据块不会在设备上交错
+ */
+int new_file_block(struct m_inode * inode, int goal)
+{
+        struct super_block * sb;
+        struct buffer_head * bh;
+        int block, bit, nbits, n;
+
+        if (inode->i_prealloc_count && goal && goal + 1 == inode->i_prealloc_block) {
+                block = inode->i_prealloc_block++;
+                inode->i_prealloc_count--;
+                clear_new_block(inode->i_dev,block);
+                return block;
         }
+        discard_prealloc(inode);
+        if (!(block = new_block(inode->i_dev,goal)))
+                return 0;
+        sb = get_super(inode->i_dev);
+        nbits = sb->s_nzones - sb->s_firstdatazone + 1;
+        bit = block - sb->s_firstdatazone + 1; // 新块在逻辑块位图中的位偏移
+        for (n = 0 ; n < NR_PREALLOC ; n++) {
+                if (++bit >= nbits || !(bh = sb->s_zmap[bit>>13]))
+                        break;
+                if (set_bit(bit&8191,bh->b_data)) // 该块已经被占用：窗口到此为止
+                        break;
+                bh->b_dirt = 1;
+                sb->s_zmap_free[bit>>13]--;
+        }
+        sb->s_zlast = bit - 1; // 其他文件从窗口之后开始找
+        inode->i_prealloc_block = block + 1;
+        inode->i_prealloc_count = n;
+        return block;
+}
 
-        // i >= 8 : 全部扫描了所有8块逻辑块位图
-        // !bh: 位图所在的缓冲块指针无效
-        // j>= 8192: 没有找到一个0位，见 find_first_zero 宏注释
-        if (i>=8 || !bh || j>=8192)
-                return 0; // 没有找到空闲逻辑块，出错返回0 
-        if (set_bit(j,bh->b_data)) // 设置新逻辑块在位图中对应的位为1, 这里的返回值是原来这位的位值
-                panic("new_block: bit already set"); // 对应位的原值是1，那说明已经被使用了，出错停机
-        bh->b_dirt = 1; // 逻辑块位图对应缓冲头的修改标志置为1
-        j += i*8192 + sb->s_firstdatazone-1; // 计算实际的逻辑块号，刚才的j只是对应位图的偏移值
-        if (j >= sb->s_nzones) // 校验逻辑块号是否超出可使用的最大值
-                return 0; //出错返回 0 
-        if (!(bh=getblk(dev,j))) // 高速缓冲区中申请一块对应的空闲缓冲块
-                panic("new_block: cannot get block");
-        if (bh->b_count != 1) // 新申请的高速缓冲块其引用计数必须为1
-                panic("new block: count is != 1"); //出错，停机
-        clear_block(bh->b_data); // 清空刚才申请的空闲缓冲块上（1024字节）的数据
-        bh->b_uptodate = 1; // 有效标志置为1
-        bh->b_dirt = 1; // 修改标志置为1 
-        brelse(bh); //释放刚才申请的空闲缓冲块，以便其他程序使用
-        return j; // 返回实际的逻辑块号
+/**
+ * 释放文件预分配窗口中还没有使用的逻辑块
+ *
+ * inode: 文件的i节点指针
+ *
+ * 无返回值
+ *
+ * 在 iput 放回最后一个引用，truncate 截断文件，以及窗口不再连续时调用
+ */
+void discard_prealloc(struct m_inode * inode)
+{
+        int block, n;
+
+        if (!(n = inode->i_prealloc_count))
+                return;
+        block = inode->i_prealloc_block;
+        inode->i_prealloc_count = 0; // 先清空窗口：free_block 中可能睡眠
+        inode->i_prealloc_block = 0;
+        while (n--)
+                free_block(inode->i_dev,block++);
 }
 
 /**
@@ -228,6 +379,7 @@ void free_inode(struct m_inode * inode)
         if (clear_bit(inode->i_num&8191,bh->b_data)) 
                 printk("free_inode: bit already cleared.\n\r"); // 如果位图中该位本来就是0,无法清空一个本来就为空的i节点，因此内核报错，退出
         bh->b_dirt = 1; // “i节点位图”对应的缓冲块头结构中的“修改标志”置为“真”
+        sb->s_imap_free[inode->i_num>>13]++; // 这块位图的空闲位数加1
         memset(inode,0,sizeof(*inode)); // 用‘0’来清空 i节点所占的内存！！！
 }
 
@@ -244,8 +396,7 @@ struct m_inode * new_inode(int dev)
         // 注意：这里只分配了 m_inode 指针的内存，这个结构真实的内存，在下面 get_empty_inode() 中才会分配
         struct m_inode * inode; 
         struct super_block * sb;
-        struct buffer_head * bh;
-        int i,j;
+        int j;
 
         // 从“内存空闲i节点表”中获取一个“空闲i节点项”
         if (!(inode=get_empty_inode())) // 无法从“内存i节点表”中获取到“空闲i节点项”
@@ -254,33 +405,20 @@ struct m_inode * new_inode(int dev)
         if (!(sb = get_super(dev)))
                 panic("new_inode with unknown device");
 
-        j = 8192;
-        // 扫描超级块中8块对应的“i节点位图”
-        for (i=0 ; i<8 ; i++) {
-                if ((bh=sb->s_imap[i])) {
-                        // 寻找第一个是‘0’的位
-                        if ((j=find_first_zero(bh->b_data))<8192) {
-                                break; //找到退出循环
-                        }
-                }
-        }
-
-        // !bh: 位图无效， j>= 8192: i节点位无效，j+i*8192 > sb->s_ninodes：实际的i节点位超出设备最大的i节点位
-        if (!bh || j >= 8192 || j+i*8192 > sb->s_ninodes) {
+        // 从上次分配的i节点之后开始，在“i节点位图”中寻找并占用一个空闲位（有效位数 s_ninodes + 1）
+        if (!(j = alloc_bit(sb->s_imap,sb->s_imap_free,sb->s_ninodes + 1,sb->s_ilast))) {
                 iput(inode); // 放回先前i节点表中申请的i节点
                 return NULL; // 返回 NULL 
         }
-        // 设置i节点位图中对应的位为１
-        if (set_bit(j,bh->b_data)) // 该位上面的原值如果是１，内核报错，退出
-                panic("new_inode: bit already set");
-        bh->b_dirt = 1; // ”i节点位图“对应的”缓冲块头结构“的”修改标志“置为真
+        sb->s_ilast = j; // 下次从这里往后找
         inode->i_count=1; // i节点被使用次数 = 1
         inode->i_nlinks=1; // i节点的文件目录项链接数 = １
         inode->i_dev=dev; // i节点的设备号 = dev 
         inode->i_uid=current->euid; // i节点的有效用户ID = 当前进程的有效用户ID 
         inode->i_gid=current->egid; // i节点的有效组ID = 当前进程的有效组ID
         inode->i_dirt=1; // i节点的已修改标志置为”真“
-        inode->i_num = j + i*8192; // i节点的节点号　= j + i*8192 
+        inode->i_num = j; // i节点的节点号　= 位图中的位偏移
+        insert_inode_hash(inode); // 放入i节点 hash 表，iget 可以找到它
         inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME; // i节点的文件修改时间 = i节点自身修改时间 = i节点自身创建时间 = 当前 UNIX 时间（秒数）
         return inode;
 }
@@ -55,9 +55,8 @@ int block_write(int dev, long * pos, char * buf, int count)
                 count -= chars; // 总写入字节数扣除本次循环将要写的chars个字节
                 
                 // 从用户缓冲区复制chars个字节到高速缓冲块
-                while (chars-->0)
-                        // 从用户缓冲中复制一个字节到p指向的高速缓冲区中
-                        *(p++) = get_fs_byte(buf++); // p指向下一个字节， buf指向下一个字节
+                memcpy_fromfs(p,buf,chars);
+                buf += chars;
                 bh->b_dirt = 1; // 置位高速缓冲块的修改标志
                 brelse(bh); // 释放已写入的缓冲区（缓冲区引用计数减1）
         }
@@ -105,9 +104,8 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
                 read += chars; // 总读入字节数加上本次循环将读的chars个字节 
                 count -= chars; // 总读入字节数扣除本次循环将要读的chars个字节
                 // 从高速缓冲区复制chars个字节到用户缓冲地址
-                while (chars-->0)
-                        // 从p指向的高速缓冲区复制一个字节到buf指向的用户空间缓冲中
-                        put_fs_byte(*(p++),buf++); // p指向下一个字节，buf指向下一个字节
+                memcpy_tofs(buf,p,chars);
+                buf += chars;
                 brelse(bh); // 释放已读取的高速缓冲块
         }
         return read; // 成功：返回总写入的字节数
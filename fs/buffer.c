@@ -31,6 +31,7 @@
 #include <linux/kernel.h> // 内核头文件
 #include <asm/system.h> // 段操作符等定义
 #include <asm/io.h> // io 操作头文件，定义了端口读写宏
+#include <errno.h> // 错误号头文件
 
 /*
  * 变量 end 由链接程序 ld 生成，用于指明内核代码（内核模块）的末端（也可以从内核编译后生成的 System.map 文件中查出）
@@ -40,28 +41,73 @@ extern void put_super(int);
 extern void invalidate_inodes(int);
 
 /*
- * 缓冲头结构指针：指向高速缓冲区的开始（内核代码的末端）
+ * 缓冲头结构指针：指向高速缓冲区中第一个缓冲头（紧跟在 hash 表的后面），在 buffer_init 中设置
  */
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
 
-/* 高速缓冲头对应的 hash 表
- * 哈希函数：(设备号 ^ 逻辑块号) Mod NR_HASH, 实际上就是这个数组的下标
+/* 高速缓冲头对应的 hash 表，放在高速缓冲区的开始处（内核代码的末端），大小在 buffer_init 中根据缓冲区大小确定
+ * 哈希函数：(设备号 ^ 逻辑块号) & (NR_HASH - 1), 实际上就是这个数组的下标
  * 这个数组的每一项：一个双向“缓冲头结构指针”的链表
  */
-struct buffer_head * hash_table[NR_HASH];
+struct buffer_head ** hash_table;
 
 /*
- * “空闲缓冲块”双向链表的表头指针
- * 注意：实际上并不是完全空闲，只有其中的 b_lock = 0 & b_count = 0 才可以被认为是完全空闲
+ * hash 表项数，NR_HASH 是定义在 linux/fs.h 中的宏，其值即是变量 nr_hash，初始化以后就不再改变
  */
-static struct buffer_head * free_list;
+int NR_HASH = 0;
+
+/*
+ * 空闲缓冲块（引用计数 b_count = 0）分别挂在两个双向循环链表中：
+ * free_list: 干净的缓冲块，按照释放的先后顺序排列（LRU），表头是最久没有被使用的，getblk 直接从表头取
+ * dirty_list: 脏的缓冲块，需要先写盘才能重新使用
+ *
+ * 正在被使用的缓冲块（b_count > 0）不在任何空闲链表中，引用计数减到 0 的时候才根据“修改标志”放入对应链表的尾部
+ * 注意：脏链表中的缓冲块可能已经被 sync_dev() 等写盘而变干净了，这些缓冲块在干净链表为空时才会被移到干净链表
+ */
+#define BUF_NONE 0 // 不在空闲链表中
+#define BUF_CLEAN 1 // 在干净的 LRU 链表中
+#define BUF_DIRTY 2 // 在脏链表中
+
+static struct buffer_head * free_list = NULL;
+static struct buffer_head * dirty_list = NULL;
+static int nr_dirty = 0; // 脏链表中缓冲块的个数
+
+/*
+ * 高速缓冲写回任务（由 init 进程创建，见 init/main.c），它在 sys_bdflush() 中循环：
+ * 每隔 BDF_INTERVAL 个滴答，把在脏链表中超过 BDF_AGE 个滴答的缓冲块分批写盘（每批最多 BDF_BATCH 块）
+ * 脏缓冲块比例超过 BDF_HIGH% 时立刻被唤醒，一直写到比例降到 BDF_LOW% 为止
+ * 只有脏缓冲块比例超过 BDF_LIMIT% 时，getblk 才会等待写回任务写完一批（节流）
+ */
+#define BDF_INTERVAL (5*HZ) // 定期唤醒的间隔
+#define BDF_AGE (5*HZ) // 脏缓冲块需要写回的“年龄”
+#define BDF_BATCH 32 // 每批写回的缓冲块数
+#define BDF_LOW 10 // 低水位（百分比）
+#define BDF_HIGH 30 // 高水位（百分比）
+#define BDF_LIMIT 60 // 节流界限（百分比）
+
+static struct task_struct * bdflush_task = NULL; // 写回任务
+static struct task_struct * bdflush_wait = NULL; // 写回任务在这里睡眠，等待被唤醒
+static struct task_struct * bdflush_done = NULL; // 被节流的进程在这里睡眠，等待写回任务写完一批
+static struct timer_list bdflush_timer; // 写回任务的定期唤醒定时器
+
+/*
+ * 高速缓冲的统计信息
+ */
+static struct {
+        unsigned long lookups; // find_buffer 查找次数
+        unsigned long chain; // 查找时比较过的缓冲块总数，平均 hash 链长度 = chain / lookups
+        unsigned long max_chain; // 最长的一次 hash 链查找长度
+        unsigned long allocs; // getblk 分配空闲缓冲块的次数
+        unsigned long scan; // 分配时检查过的空闲缓冲块总数
+        unsigned long max_scan; // 最长的一次分配检查长度
+} buffer_stats;
 
 /*
  * 等待空闲缓冲块而休眠的任务队列头指针
  * 注意：buffer_wait 是为了申请一个空闲缓冲块而正好遇到缺乏可用缓冲块时候，当前任务就会被添加这个队列中
  *      b_wait 是专门为了供等待某个特定的缓冲块的队列头指针！！！
  */
-static struct task_struct * buffer_wait = NULL;
+static struct wait_queue * buffer_wait = NULL; // 独占等待：每释放一个缓冲块只唤醒一个等待者
 
 /*
  * 系统缓冲区中缓冲块的个数
@@ -210,17 +256,97 @@ void check_disk_change(int dev)
  * 这里使用的是 dev 和 block 异或操作，然后再取余，保证计算的值都在 hash 表数组项之内
  * 
  */
-// 根据“设备号dev”和“逻辑块号block”计算 hash 值
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+// 根据“设备号dev”和“逻辑块号block”计算 hash 值，NR_HASH 是 2 的幂，所以取余可以用与运算代替
+#define _hashfn(dev,block) (((unsigned)(dev^block))&(NR_HASH-1))
 // 根据“设备号dev”和“逻辑块号block” 获得对应的 hash 表的数组项
 #define hash(dev,block) hash_table[_hashfn(dev,block)] 
 
 /*
- * 从 “hash 队列”和 “空闲缓冲队列”移走“缓冲块”
+ * 把缓冲块插入空闲链表 list 的尾部
+ */
+static inline void insert_into_list(struct buffer_head ** list, struct buffer_head * bh)
+{
+        if (!*list) {
+                bh->b_next_free = bh->b_prev_free = bh;
+                *list = bh;
+                return;
+        }
+        bh->b_next_free = *list;
+        bh->b_prev_free = (*list)->b_prev_free;
+        (*list)->b_prev_free->b_next_free = bh;
+        (*list)->b_prev_free = bh;
+}
+
+/*
+ * 把缓冲块从空闲链表 list 中移除
+ */
+static inline void remove_from_list(struct buffer_head ** list, struct buffer_head * bh)
+{
+        if (!(bh->b_prev_free) || !(bh->b_next_free))
+                panic("Free block list corrupted");
+        if (bh->b_next_free == bh)
+                *list = NULL;
+        else {
+                bh->b_prev_free->b_next_free = bh->b_next_free;
+                bh->b_next_free->b_prev_free = bh->b_prev_free;
+                // 如果空闲链表头指向本缓冲块，则让他指向下一个缓冲块
+                if (*list == bh)
+                        *list = bh->b_next_free;
+        }
+        bh->b_next_free = bh->b_prev_free = NULL;
+}
+
+/*
+ * 引用计数变为 0 的缓冲块：根据“修改标志”放入干净的 LRU 链表或者脏链表的尾部
+ */
+static inline void file_buffer(struct buffer_head * bh)
+{
+        if (bh->b_dirt) {
+                insert_into_list(&dirty_list, bh);
+                bh->b_list = BUF_DIRTY;
+                // 记录第一次放入脏链表的时刻，缓冲块被反复使用和释放并不会让它变“年轻”
+                if (!bh->b_flushtime)
+                        bh->b_flushtime = jiffies ? jiffies : 1;
+                // 脏缓冲块太多：唤醒写回任务
+                if (++nr_dirty > NR_BUFFERS * BDF_HIGH / 100)
+                        wake_up(&bdflush_wait);
+        } else {
+                insert_into_list(&free_list, bh);
+                bh->b_list = BUF_CLEAN;
+                bh->b_flushtime = 0;
+        }
+}
+
+/*
+ * 缓冲块要被使用：从所在的空闲链表中移除
+ */
+static inline void unfile_buffer(struct buffer_head * bh)
+{
+        if (bh->b_list == BUF_DIRTY) {
+                remove_from_list(&dirty_list, bh);
+                nr_dirty--;
+        } else if (bh->b_list == BUF_CLEAN)
+                remove_from_list(&free_list, bh);
+        bh->b_list = BUF_NONE;
+}
+
+/*
+ * 释放对缓冲块的一次引用，不等待缓冲块解锁
+ */
+static inline void put_buffer(struct buffer_head * bh)
+{
+        if (!(bh->b_count--))
+                panic("Trying to free free buffer");
+        if (!bh->b_count)
+                file_buffer(bh);
+}
+
+/*
+ * 从 “hash 队列”移走“缓冲块”
  *
  * bh: 特定的缓冲块（缓冲头结构指针）
  *
- * hash 队列：双向链表结构，空闲缓冲队列：双向循环链表结构
+ * hash 队列：双向链表结构
  */
 static inline void remove_from_queues(struct buffer_head * bh)
 {
@@ -233,31 +359,16 @@ static inline void remove_from_queues(struct buffer_head * bh)
         // hash(bh->b_dev,bh->b_blocknr) 用来计算这个hash队列头指针，用来和bh比较，来确定 bh 是否是头一个元素
         if (hash(bh->b_dev,bh->b_blocknr) == bh) 
                 hash(bh->b_dev,bh->b_blocknr) = bh->b_next; // 如果 bh 是该 hash 队列的头一个块，则让 hash 表的对应项指向本队列的下一个缓冲区  
-/* remove from free list */
-        
-        // 从空闲队列中移除 bh 缓冲块
-        if (!(bh->b_prev_free) || !(bh->b_next_free))
-                panic("Free block list corrupted");
-        bh->b_prev_free->b_next_free = bh->b_next_free; 
-        bh->b_next_free->b_prev_free = bh->b_prev_free;
-        // 如果空闲链表头指向本缓冲块，则让他指向下一个缓冲块
-        if (free_list == bh)
-                free_list = bh->b_next_free;
 }
 
 /*
- * 将缓冲块插入“空闲链表”尾部，同时放入 hash 队列中
+ * 将缓冲块放入 hash 队列中
+ * 注意：正在被使用的缓冲块不在空闲链表中，等到 brelse 释放时才会放入空闲链表
  *
  * bh: 特定的缓冲块
  */
 static inline void insert_into_queues(struct buffer_head * bh)
 {
-/* put at end of free list */
-        // 放入空闲链表尾部
-        bh->b_next_free = free_list;
-        bh->b_prev_free = free_list->b_prev_free;
-        free_list->b_prev_free->b_next_free = bh;
-        free_list->b_prev_free = bh;
 /* put the buffer in new hash-queue if it has a device */
         // 如果该缓冲块对应一个设备则将其插入到hash队列中
         bh->b_prev = NULL;
@@ -284,13 +395,20 @@ static inline void insert_into_queues(struct buffer_head * bh)
 static struct buffer_head * find_buffer(int dev, int block)
 {		
         struct buffer_head * tmp;
+        unsigned long n = 0;
 
         // 根据设备号和逻辑块号计算hash值，遍历对应hash值的“散列项”（双向队列）
-        for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next)
+        for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next) {
+                n++;
                 // 寻找匹配对应设备号和逻辑块号的缓冲块
                 if (tmp->b_dev==dev && tmp->b_blocknr==block)
-                        return tmp;
-        return NULL;
+                        break;
+        }
+        buffer_stats.lookups++;
+        buffer_stats.chain += n;
+        if (n > buffer_stats.max_chain)
+                buffer_stats.max_chain = n;
+        return tmp;
 }
 
 /*
@@ -320,12 +438,13 @@ struct buffer_head * get_hash_table(int dev, int block)
         for (;;) {
                 if (!(bh=find_buffer(dev,block)))
                         return NULL; // 找不到，则直接返回 NULL 
-                bh->b_count++; // 对该缓冲块的引用计数 + 1 
+                if (!bh->b_count++) // 对该缓冲块的引用计数 + 1 
+                        unfile_buffer(bh); // 原来没有被使用：从空闲链表中移除
                 wait_on_buffer(bh); // 等待该缓冲块解锁
                 if (bh->b_dev == dev && bh->b_blocknr == block) // 再次判断缓冲块是否还是寻找的
                         return bh;
                 // 如果在睡眠状态，该缓冲块所属的设备号，逻辑块已经发生改变，则撤消对它的引用计数，重新寻找
-                bh->b_count--;
+                put_buffer(bh);
         }
 }
 
@@ -345,8 +464,49 @@ struct buffer_head * get_hash_table(int dev, int block)
  * 
  */
 
-// 下面宏用于同时判断缓冲块的“修改标志”和“锁定标志”，并且通过左移位运算使得“修改标志”的权重要比“锁定”标志大
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
+/*
+ * 为 getblk 选择一个可以重新使用的空闲缓冲块
+ *
+ * 优先选择干净 LRU 链表中最久没有使用的、没有上锁的缓冲块，一般情况下表头就是，所以是 O(1) 的
+ * 干净链表为空时，先把脏链表中已经写盘变干净的缓冲块移过去；仍然为空才返回脏链表中最老的缓冲块
+ *
+ * 返回：缓冲块头指针，如果所有缓冲块都在使用中则返回 NULL
+ */
+static struct buffer_head * get_free_buffer(void)
+{
+        struct buffer_head * bh, * tmp, * last;
+        unsigned long n = 0;
+
+        if (!free_list && dirty_list) {
+                tmp = dirty_list;
+                last = dirty_list->b_prev_free;
+                do {
+                        bh = tmp;
+                        tmp = tmp->b_next_free;
+                        if (!bh->b_dirt) {
+                                unfile_buffer(bh);
+                                file_buffer(bh);
+                        }
+                } while (bh != last);
+        }
+        if ((bh = free_list)) {
+                // 跳过正在进行 I/O （比如预读）的缓冲块，如果全部上锁，则只能用表头的
+                tmp = bh;
+                do {
+                        n++;
+                        if (!tmp->b_lock) {
+                                bh = tmp;
+                                break;
+                        }
+                } while ((tmp = tmp->b_next_free) != free_list);
+        } else if ((bh = dirty_list))
+                n++;
+        buffer_stats.allocs++;
+        buffer_stats.scan += n;
+        if (n > buffer_stats.max_scan)
+                buffer_stats.max_scan = n;
+        return bh;
+}
 
 /**
  * 取高速缓冲中的指定缓冲块
@@ -359,34 +519,33 @@ struct buffer_head * get_hash_table(int dev, int block)
  */
 struct buffer_head * getblk(int dev,int block)
 {
-        struct buffer_head * tmp, * bh;
+        struct buffer_head * bh;
+        int slept = 0;
 
 repeat:
         // 搜索 hash 表，如果指定块已经在缓冲中，则返回对应的缓冲头指针，退出
         if ((bh = get_hash_table(dev,block)))
                 return bh;
 
-        // 扫描空闲双向循环列表，寻找空闲缓冲块区
-        tmp = free_list; // 首先，让 tmp 执行空闲列表的表头
-        do {
-                // 当一个缓冲区引用计数为0时候，并不一定意味者该缓冲块是干净的(b_dirty = 0) 或者 没有锁定的(b_lock = 0)
-                // 例如：当一个进程改写过一块内存时，就释放了，于是该 b_count = 0，但 b_dirty != 0
-                // 或者 当一个进程执行 breada()预读几个块时，只要 ll_rw_block()命令发出后，它就会递减 b_count，但此时实际硬盘访问可能操作还在进行，因此此时 b_lock = 1，但 b_count = 0  
-                if (tmp->b_count) // 如果该缓冲区正被使用（引用计数不等于 0），则继续扫描下一项
-                        continue;
-                // 如果 bh 指针为空 或者 tmp 所指向的缓冲块的权重标志小于 bh 头标志的权重
-                if (!bh || BADNESS(tmp)<BADNESS(bh)) { // 修改的权重大于锁定的权重，例如：tmp只有锁定标志，而bh有修改标志
-                        bh = tmp; // bh 指向 tmp 指向的缓冲头
-                        if (!BADNESS(tmp)) // tmp 即没有修改标志，也没有锁定标志，则退出循环
-                                break;
-                }
-                // 否则继续循环，看看能否找到一个 BADNESS 最小（最合适）的缓冲块
-/* and repeat until we find something good */
-        } while ((tmp = tmp->b_next_free) != free_list);
+        // 脏缓冲块太多：唤醒写回任务，并等待它写完一批（写回任务自己不能等待）
+        // 内核态不会被抢占，所以写回任务一定是在我们 sleep_on 以后才运行，不会丢失唤醒
+        while (bdflush_task && current != bdflush_task &&
+               nr_dirty > NR_BUFFERS * BDF_LIMIT / 100) {
+                wake_up(&bdflush_wait);
+                sleep_on(&bdflush_done);
+        }
+
+        // 当一个缓冲区引用计数为0时候，并不一定意味者该缓冲块是干净的(b_dirty = 0) 或者 没有锁定的(b_lock = 0)
+        // 例如：当一个进程改写过一块内存时，就释放了，于是该 b_count = 0，但 b_dirty != 0
+        // 或者 当一个进程执行 breada()预读几个块时，只要 ll_rw_block()命令发出后，它就会递减 b_count，但此时实际硬盘访问可能操作还在进行，因此此时 b_lock = 1，但 b_count = 0  
+        // get_free_buffer 优先选择干净并且没有上锁的缓冲块
+        bh = get_free_buffer();
 
-        // 遍历全部空闲列表，仍然无法找到对应的缓冲块（所有的缓冲块的引用计数都 > 0）
+        // 所有的缓冲块的引用计数都 > 0
         if (!bh) {
-                sleep_on(&buffer_wait); // 当前进程进入不可中断的睡眠等待有空闲块可以用，注意：是针对整个空闲队列(buffer_wait)的等待
+                if (slept++) // 上次被唤醒时的空闲块已经被别人拿走了
+                        wait_stats.spurious++;
+                sleep_on_queue_exclusive(&buffer_wait); // 当前进程进入不可中断的睡眠等待有空闲块可以用，注意：是针对整个空闲队列(buffer_wait)的等待
                 // 当有空闲块可以用时，进程会被明确唤醒
                 goto repeat; // 唤醒后，从头开始遍历整个空闲列表
         }
@@ -396,9 +555,11 @@ repeat:
         if (bh->b_count) // 如果在唤醒后，该缓冲块又被其他进程占用
                 goto repeat; // 只能从开始搜索合适的缓冲块 :-( 
         
-        // 如果该缓冲块已被修改
+        // 如果该缓冲块已被修改（已经没有干净的空闲缓冲块了）
+        // 只把这一块写盘，而不是同步整个设备，写回其余脏缓冲块是写回任务的工作
         while (bh->b_dirt) {
-                sync_dev(bh->b_dev); // 将数据写盘
+                wake_up(&bdflush_wait);
+                ll_rw_block(WRITE,bh); // 将数据写盘
                 wait_on_buffer(bh); // 再次等待该缓冲区解锁
                 if (bh->b_count) // 如果在唤醒后，该缓冲块又被其他进程占用
                         goto repeat; // 只能从开始搜索合适的缓冲块 :-(
@@ -416,11 +577,12 @@ repeat:
         bh->b_count=1; // 引用计数  = 1 
         bh->b_dirt=0; // 修改标志 = 0
         bh->b_uptodate=0; // 有效（更新）标志 = 0
-        // 从 hash队列 和 空闲列表移出该缓冲头
+        // 从空闲链表 和 hash队列移出该缓冲头
+        unfile_buffer(bh);
         remove_from_queues(bh); 
         bh->b_dev=dev; // 设置该缓冲块的设备号
         bh->b_blocknr=block; // 设置该缓冲块的逻辑块号
-        // 根据刚刚设置的设备号和逻辑块号，重新插入空闲链表的头部， hash表对应散列项队列的头部
+        // 根据刚刚设置的设备号和逻辑块号，重新插入 hash表对应散列项队列的头部
         insert_into_queues(bh);
         return bh; // 返回该缓冲头指针
 }
@@ -437,11 +599,12 @@ void brelse(struct buffer_head * buf)
         if (!buf) // 缓冲块为空指针，直接返回
                 return;
         wait_on_buffer(buf); // 等待该缓冲块解锁
-        // 该缓冲块的引用计数 - 1 
-        if (!(buf->b_count--)) // 如果引用计数不为0，则直接异常退出
-                panic("Trying to free free buffer");
-        // 明确唤醒”等待空闲块“(buffer_wait)的进程队列中的所有进程!!!
-        wake_up(&buffer_wait);
+        // 该缓冲块的引用计数 - 1，如果引用计数已经为0，则直接异常退出
+        // 引用计数减到 0 的缓冲块放入干净 LRU 链表或者脏链表的尾部
+        put_buffer(buf);
+        // 缓冲块空闲了：唤醒一个”等待空闲块“(buffer_wait)的进程
+        if (!buf->b_count)
+                wake_up_queue(&buffer_wait);
 }
 
 /*
@@ -564,7 +727,7 @@ struct buffer_head * breada(int dev,int first, ...)
                 if (tmp) {
                         if (!tmp->b_uptodate) // 申请到的空闲缓冲块内容无效
                                 ll_rw_block(READA,tmp); // 发起读请求
-                        tmp->b_count--; // 暂时释放掉该预读块，因为现在没人使用
+                        put_buffer(tmp); // 暂时释放掉该预读块，因为现在没人使用
                 }
         }
         va_end(args); // 结束遍历可变参数表
@@ -576,17 +739,148 @@ struct buffer_head * breada(int dev,int first, ...)
         return NULL;
 }
 
+/**
+ * 异步预读一组数据块，不等待读完成
+ *
+ * dev: 设备号
+ * b: 设备逻辑块号数组（会被按块号升序重排），0 表示该项无效
+ * n: 数组项数
+ *
+ * 无返回值
+ *
+ * 先按物理块号排序，让物理上连续的块紧挨着提交给块设备层，便于合并成一次多扇区的读写
+ * 预读请求在请求项不足时会被丢弃，之后真正读取时由 bread 重新发起
+ * 
+ */
+void breadahead(int dev,int * b,int n)
+{
+        struct buffer_head * bh;
+        int i, j, tmp;
+
+        // 插入排序：预读窗口很小，而且文件的块通常本来就基本有序
+        for (i = 1 ; i < n ; i++) {
+                tmp = b[i];
+                for (j = i ; j > 0 && b[j-1] > tmp ; j--)
+                        b[j] = b[j-1];
+                b[j] = tmp;
+        }
+        for (i = 0 ; i < n ; i++) {
+                if (!b[i] || (i && b[i] == b[i-1]))
+                        continue;
+                // 已经在高速缓冲区中（可能正在读入）的块直接跳过，不能在这里等待它解锁
+                if (find_buffer(dev,b[i]))
+                        continue;
+                if (!(bh = getblk(dev,b[i])))
+                        continue;
+                if (!bh->b_uptodate)
+                        ll_rw_block(READA,bh);
+                put_buffer(bh); // 不等待读完成，直接释放引用
+        }
+}
+
+/*
+ * 写回一批脏缓冲块
+ *
+ * 脏缓冲块比例超过低水位时写回所有的脏缓冲块，否则只写回“年龄”超过 BDF_AGE 的
+ * 每写完一批唤醒被 getblk 节流的进程
+ *
+ * 返回：写盘的缓冲块个数
+ */
+static int flush_dirty_buffers(void)
+{
+        struct buffer_head * bh, * next;
+        int todo, batch = 0, written = 0;
+
+        // 最多检查一遍脏链表，写盘失败的缓冲块会重新放到链表尾部
+        todo = nr_dirty;
+        bh = dirty_list;
+        while (todo-- > 0 && bh) {
+                next = bh->b_next_free;
+                if (nr_dirty <= NR_BUFFERS * BDF_LOW / 100 &&
+                    jiffies - bh->b_flushtime < BDF_AGE) {
+                        bh = next;
+                        continue;
+                }
+                // 先占用该缓冲块，防止在 ll_rw_block 等待空闲请求项的时候被别人重新使用
+                bh->b_count++;
+                unfile_buffer(bh);
+                if (bh->b_dirt) {
+                        ll_rw_block(WRITE,bh);
+                        written++;
+                }
+                // 放回空闲链表，此时一般已经是干净的了
+                put_buffer(bh);
+                if (++batch >= BDF_BATCH) {
+                        batch = 0;
+                        wake_up(&bdflush_done);
+                }
+                // 睡眠期间链表可能已经改变，从表头重新开始
+                bh = (next->b_list == BUF_DIRTY) ? next : dirty_list;
+        }
+        wake_up(&bdflush_done);
+        return written;
+}
+
+// 写回任务的定期唤醒定时器到期
+static void bdflush_timeout(unsigned long data)
+{
+        wake_up(&bdflush_wait);
+}
+
+/**
+ * 系统调用：当前进程成为高速缓冲写回任务，在内核中循环，从不返回
+ *
+ * 只有超级用户可以调用，并且系统中只能有一个写回任务
+ *
+ * 失败返回：-EPERM 或者 -EBUSY
+ */
+int sys_bdflush(void)
+{
+        if (!suser())
+                return -EPERM;
+        if (bdflush_task)
+                return -EBUSY;
+        bdflush_task = current;
+        init_timer(&bdflush_timer);
+        bdflush_timer.fn = bdflush_timeout;
+        for (;;) {
+                // 脏缓冲块超过高水位时，一批接一批地写，直到降到低水位
+                while (flush_dirty_buffers() &&
+                       nr_dirty > NR_BUFFERS * BDF_LOW / 100)
+                        /* nothing */ ;
+                // 关中断，保证定时器不会在 sleep_on 之前到期而丢失唤醒
+                cli();
+                mod_timer(&bdflush_timer, jiffies + BDF_INTERVAL);
+                sleep_on(&bdflush_wait);
+                sti();
+        }
+}
+
+/**
+ * 打印高速缓冲的统计信息
+ */
+void show_buffer_stats(void)
+{
+        printk("buffers: %d, hash size %d\n\r",NR_BUFFERS,NR_HASH);
+        printk("  hash: %d lookups, %d entries compared, longest chain %d\n\r",
+               buffer_stats.lookups,buffer_stats.chain,buffer_stats.max_chain);
+        printk("  getblk: %d allocations, %d buffers scanned, longest scan %d\n\r",
+               buffer_stats.allocs,buffer_stats.scan,buffer_stats.max_scan);
+        printk("  %d dirty free buffers\n\r",nr_dirty);
+}
+
 /**
  * 初始化高速缓冲区
  *
  * buffer_end: 具有16MB内存的系统，其值是4MB，对于8MB内存的系统，其值是2MB
  * 无返回值
  *
- * 从 buffer_start 和 buffer_end 处开始同时初始化“缓冲块头结构”和对应的“数据块”
+ * 先在缓冲区低端（内核代码的末端）放置 hash 表，hash 表项数根据缓冲区大小确定（大约每两个缓冲块一项，取 2 的幂）
+ * 然后从 hash 表之后和 buffer_end 处开始同时初始化“缓冲块头结构”和对应的“数据块”
  */
 void buffer_init(long buffer_end)
 {
-        struct buffer_head * h = start_buffer;
+        struct buffer_head * h;
         void * b;
         int i;
 
@@ -595,6 +889,13 @@ void buffer_init(long buffer_end)
                 b = (void *) (640*1024); // 因为从 640KB ~ 1MB 之间的内存要被显存和BIOS占用，所以实际高速缓冲区的高端位置只能是 640KB 
         else
                 b = (void *) buffer_end;
+        // 估计缓冲块的个数，并据此确定 hash 表的项数
+        i = ((long) b - (long) &end) / (BLOCK_SIZE + sizeof(struct buffer_head));
+        for (NR_HASH = 64 ; NR_HASH < (i >> 1) ; NR_HASH <<= 1)
+                /* nothing */ ;
+        hash_table = (struct buffer_head **) &end;
+        start_buffer = (struct buffer_head *) (hash_table + NR_HASH);
+        h = start_buffer;
         // 从缓冲区高端开始划分 1KB 大小的“缓冲块”，与此同时在缓冲区低端建立描述该数据块的“缓冲块头结构”
         // h 是指向缓冲头结构的指针，而 h + 1 是指向内存地址连续的下一个缓冲头的地址（指向缓冲头结构末端地址）
         // 为了保证有足够长度的内存来存储一个缓冲头结构，b指向的内存块地址 必须大于等于 当前缓冲头结构的末端地址 (h + 1)
@@ -608,19 +909,13 @@ void buffer_init(long buffer_end)
                 h->b_next = NULL; // 指向下一个相同 hash 值的缓冲头指针
                 h->b_prev = NULL; // 指向前一个相同 hash 值的缓冲头指针
                 h->b_data = (char *) b; // 指向对应数据块的（1024字节）
-                h->b_prev_free = h-1; // 指向空闲缓冲头链表中的前一项
-                h->b_next_free = h+1; // 指向空闲缓冲头链表中的下一项
+                file_buffer(h); // 放入干净的 LRU 链表尾部，形成了一个双向环形链表！！！
                 h++; // h 指向下一块缓冲头
                 NR_BUFFERS++; // 缓冲区缓冲块个数 + 1 
                 if (b == (void *) 0x100000) // 若 b 递减到 1MB，则跳过 384KB 
                         b = (void *) 0xA0000; // 让 b 执行 640KB (0xA0000)处
         }
         
-        // 形成了一个双向环形链表！！！
-        h--; // h 指向最后一个有效缓冲头
-        free_list = start_buffer; // “空闲缓冲头链表”的“链表头”设为“高速缓冲区”开始处
-        free_list->b_prev_free = h; // “空闲缓冲头链表”的“表头“中的“前一个指针”(b_prev_free)指向这个链表尾
-        h->b_next_free = free_list; // “空闲缓冲头链表”的“表尾”中的“后一个指针”(b_next_free))指向这个链表头
         // 初始化缓冲头哈希表
         for (i=0;i<NR_HASH;i++)
                 hash_table[i]=NULL; // 设置每个哈希数据项对应的双向链表数组为空
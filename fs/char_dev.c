@@ -13,13 +13,13 @@
 #include <asm/segment.h>
 #include <asm/io.h>
 
-extern int tty_read(unsigned minor,char * buf,int count); // 终端驱动提供的读函数
-extern int tty_write(unsigned minor,char * buf,int count); // 终端驱动提供的写函数
+extern int tty_read(unsigned minor,char * buf,int count,unsigned short flags); // 终端驱动提供的读函数
+extern int tty_write(unsigned minor,char * buf,int count,unsigned short flags); // 终端驱动提供的写函数
 
 // 函数指针原型定义
-// 参数：rw - 读/写， minor - 次设备号，buf - 用户空间缓存，count - 读写字节数，pos - 读写操作当前指针，对于终端设备无用
+// 参数：rw - 读/写， minor - 次设备号，buf - 用户空间缓存，count - 读写字节数，pos - 读写操作当前指针，对于终端设备无用，flags - 文件的打开标志（O_NONBLOCK）
 // 返回：int - 读写的字节数，失败则返回出错码
-typedef int (*crw_ptr)(int rw,unsigned minor,char * buf,int count,off_t * pos);
+typedef int (*crw_ptr)(int rw,unsigned minor,char * buf,int count,off_t * pos,unsigned short flags);
 
 /*
  * 串口终端操作函数
@@ -29,15 +29,16 @@ typedef int (*crw_ptr)(int rw,unsigned minor,char * buf,int count,off_t * pos);
  * buf: 用户空间缓存区
  * count: 读写字节数
  * pos: 读写操作当前指针，对于终端设备无用
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时终端读写不睡眠
  *
  * 成功返回读写的字节数，失败则返回出错码
  * 
  */
-static int rw_ttyx(int rw,unsigned minor,char * buf,int count,off_t * pos)
+static int rw_ttyx(int rw,unsigned minor,char * buf,int count,off_t * pos,unsigned short flags)
 {
         // 调用终端驱动操作函数
-        return ((rw==READ)?tty_read(minor,buf,count):
-                tty_write(minor,buf,count));
+        return ((rw==READ)?tty_read(minor,buf,count,flags):
+                tty_write(minor,buf,count,flags));
 }
 
 /*
@@ -48,15 +49,16 @@ static int rw_ttyx(int rw,unsigned minor,char * buf,int count,off_t * pos)
  * buf: 用户空间缓存区
  * count: 读写字节数
  * pos: 读写操作当前指针，对于终端设备无用
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时终端读写不睡眠
  *
  * 成功返回读写的字节数，失败则返回出错码
  * 
  */
-static int rw_tty(int rw,unsigned minor,char * buf,int count, off_t * pos)
+static int rw_tty(int rw,unsigned minor,char * buf,int count, off_t * pos,unsigned short flags)
 {
         if (current->tty<0) // 如果当前进程未使用控制终端，直接返回 -EPERM
                 return -EPERM;
-        return rw_ttyx(rw,current->tty,buf,count,pos);
+        return rw_ttyx(rw,current->tty,buf,count,pos,flags);
 }
 
 // 内存映射文件读写：未实现
@@ -113,11 +115,12 @@ static int rw_port(int rw,char * buf, int count, off_t * pos)
  * buf: 用户空间缓存区
  * count: 读写字节数
  * pos: 读写操作当前指针
+ * flags: 文件的打开标志，内存设备不用
  *
  * 成功返回读写的字节数，失败则返回出错码
  * 
  */
-static int rw_memory(int rw, unsigned minor, char * buf, int count, off_t * pos)
+static int rw_memory(int rw, unsigned minor, char * buf, int count, off_t * pos, unsigned short flags)
 {
         switch(minor) {
 		case 0:
@@ -158,11 +161,12 @@ static crw_ptr crw_table[]={
  * buf: 用户空间缓存区
  * count: 读写字节数
  * pos: 读写操作当前指针
+ * flags: 文件的打开标志 (file->f_flags)，传给设备的读写函数
  *
  * 成功返回读写的字节数，失败则返回出错码
  * 
  */
-int rw_char(int rw,int dev, char * buf, int count, off_t * pos)
+int rw_char(int rw,int dev, char * buf, int count, off_t * pos, unsigned short flags)
 {
         crw_ptr call_addr; // 字符设备读写指针
 
@@ -171,5 +175,5 @@ int rw_char(int rw,int dev, char * buf, int count, off_t * pos)
         // 获得对应设备的读写函数指针
         if (!(call_addr=crw_table[MAJOR(dev)])) // 查询到的读写设备指针为空
                 return -ENODEV; // 返回 -ENODEV
-        return call_addr(rw,MINOR(dev),buf,count,pos); // 调用相关设备的读写指针函数
+        return call_addr(rw,MINOR(dev),buf,count,pos,flags); // 调用相关设备的读写指针函数
 }
@@ -0,0 +1,261 @@
+/*
+ *  linux/fs/dcache.c
+ */
+
+/*
+ * 目录项缓存(dentry cache)：记住 (设备号, 目录i节点号, 文件名) -> i节点号 的查找结果
+ *
+ * 路径名的每一个分量原来都要调用 find_entry 逐块读入目录，并用 get_fs_byte 逐个字符地比较每个目录项，
+ * 目录很大或路径很深时，一次 open/exec/stat 要读很多块，比较上千次
+ * 有了目录项缓存，命中时只需要把这个分量从用户空间复制出来（最多 NAME_LEN 个字符）并查一次 hash 表
+ *
+ * 不存在的文件名也会被缓存（i节点号为 0 的“否定”项），这样反复查找不存在的文件（比如沿 PATH 搜索命令）也不用再扫描目录
+ *
+ * 目录的内容发生变化时必须让缓存失效：
+ * add_entry（创建，链接）, sys_unlink, sys_rmdir 删除对应的项，卸载文件系统（put_super）时删除整个设备的项
+ * "." 和 ".." 不缓存：".." 在伪根目录和挂载点上有特殊处理
+ *
+ * 扫描目录时可能睡眠（读目录块），期间别的进程可能修改了这个目录并且已经让缓存项失效：
+ * 每次失效都把 dcache_seq 加 1，查找者在扫描前记下 dcache_seq，扫描后它变了就不放入缓存，以免放入过时的结果
+ */
+
+#include <linux/sched.h> // 进程调度头文件
+#include <linux/kernel.h> // 内核常用函数头文件
+#include <asm/segment.h> // 段操作头文件：get_fs_byte
+
+#define NR_DENTRY 256 // 目录项缓存的项数
+#define NR_DHASH 64 // hash 表的大小，必须是 2 的幂
+
+struct dentry {
+        struct dentry * d_next, * d_prev; // hash 链表上的后一项，前一项
+        struct dentry * d_lru_next, * d_lru_prev; // LRU 链表（循环双向链表）上的后一项，前一项
+        unsigned short d_dev; // 目录所在的设备号
+        unsigned short d_dir; // 目录的i节点号
+        unsigned short d_ino; // 文件名对应的i节点号，0 表示该文件名不存在（否定项）
+        unsigned char d_len; // 文件名长度，0 表示本项空闲
+        unsigned char d_hash; // 所在的 hash 链表
+        char d_name[NAME_LEN]; // 文件名
+};
+
+static struct dentry dentry_table[NR_DENTRY];
+static struct dentry * dhash_table[NR_DHASH];
+static struct dentry * dentry_lru = NULL; // LRU 链表头：最久没有使用的项
+static int nr_dentry = 0; // 已经放入 LRU 链表的项数
+unsigned long dcache_seq = 0; // 失效的次数（代数），由 dcache_remove 和 dcache_invalidate 增加
+
+// 统计信息
+static struct {
+        unsigned long lookups; // 查找次数
+        unsigned long hits; // 命中次数（包括否定项）
+        unsigned long negative_hits; // 命中否定项的次数
+        unsigned long invalidates; // 失效的项数
+} dcache_stats;
+
+/*
+ * 把用户空间中的文件名复制到 buf 中并计算 hash 值
+ *
+ * 返回：hash 表中的下标，文件名不能缓存（太长，"."，".."）时返回 -1
+ */
+static int dname(int dev, int dir, const char * name, int len, char * buf)
+{
+        unsigned long hash = dev ^ dir;
+        int i;
+
+        if (len <= 0 || len > NAME_LEN)
+                return -1;
+        for (i = 0 ; i < len ; i++) {
+                buf[i] = get_fs_byte(name + i);
+                hash = (hash << 3) + (hash >> 28) + buf[i];
+        }
+        if (buf[0] == '.' && (len == 1 || (len == 2 && buf[1] == '.')))
+                return -1;
+        return (hash ^ (hash >> 10)) & (NR_DHASH - 1);
+}
+
+static struct dentry * d_find(int h, int dev, int dir, const char * buf, int len)
+{
+        struct dentry * d;
+        int i;
+
+        for (d = dhash_table[h] ; d ; d = d->d_next) {
+                if (d->d_dev != dev || d->d_dir != dir || d->d_len != len)
+                        continue;
+                for (i = 0 ; i < len && d->d_name[i] == buf[i] ; i++)
+                        /* nothing */ ;
+                if (i == len)
+                        return d;
+        }
+        return NULL;
+}
+
+/*
+ * 把 d 移到 LRU 链表的尾部（最近使用）
+ */
+static inline void d_touch(struct dentry * d)
+{
+        if (d == dentry_lru) {
+                dentry_lru = d->d_lru_next;
+                return;
+        }
+        d->d_lru_prev->d_lru_next = d->d_lru_next;
+        d->d_lru_next->d_lru_prev = d->d_lru_prev;
+        d->d_lru_next = dentry_lru;
+        d->d_lru_prev = dentry_lru->d_lru_prev;
+        dentry_lru->d_lru_prev->d_lru_next = d;
+        dentry_lru->d_lru_prev = d;
+}
+
+/*
+ * 让一项失效：从 hash 链表中移除，并放到 LRU 链表头，最先被重新使用
+ */
+static void d_drop(struct dentry * d)
+{
+        if (!d->d_len)
+                return;
+        if (d->d_next)
+                d->d_next->d_prev = d->d_prev;
+        if (d->d_prev)
+                d->d_prev->d_next = d->d_next;
+        else
+                dhash_table[d->d_hash] = d->d_next;
+        d->d_next = d->d_prev = NULL;
+        d->d_len = 0;
+        dcache_stats.invalidates++;
+        d_touch(d);
+        dentry_lru = d;
+}
+
+/*
+ * 取得一个空闲项：先用还没有用过的，否则重新使用最久没有使用的项
+ */
+static struct dentry * d_alloc(void)
+{
+        struct dentry * d;
+
+        if (nr_dentry < NR_DENTRY) {
+                d = dentry_table + nr_dentry++;
+                if (!dentry_lru) {
+                        d->d_lru_next = d->d_lru_prev = d;
+                        dentry_lru = d;
+                } else {
+                        d->d_lru_next = dentry_lru;
+                        d->d_lru_prev = dentry_lru->d_lru_prev;
+                        dentry_lru->d_lru_prev->d_lru_next = d;
+                        dentry_lru->d_lru_prev = d;
+                }
+                return d;
+        }
+        d = dentry_lru;
+        if (d->d_len) {
+                d_drop(d);
+                dcache_stats.invalidates--; // 替换不算失效
+        }
+        d_touch(d);
+        return d;
+}
+
+/**
+ * 在目录项缓存中查找目录 dir 中的文件名 name
+ *
+ * dir: 目录i节点
+ * name: 文件名（用户空间）
+ * len: 文件名长度
+ *
+ * 返回：命中时返回i节点号，命中否定项时返回 0，没有命中时返回 -1
+ */
+int dcache_lookup(struct m_inode * dir, const char * name, int len)
+{
+        struct dentry * d;
+        char buf[NAME_LEN];
+        int h;
+
+        if ((h = dname(dir->i_dev, dir->i_num, name, len, buf)) < 0)
+                return -1;
+        dcache_stats.lookups++;
+        if (!(d = d_find(h, dir->i_dev, dir->i_num, buf, len)))
+                return -1;
+        dcache_stats.hits++;
+        if (!d->d_ino)
+                dcache_stats.negative_hits++;
+        d_touch(d);
+        return d->d_ino;
+}
+
+/**
+ * 把目录 dir 中文件名 name 的查找结果放入目录项缓存
+ *
+ * dir: 目录i节点
+ * name: 文件名（用户空间）
+ * len: 文件名长度
+ * ino: 对应的i节点号，0 表示文件不存在
+ * seq: 开始扫描目录之前的 dcache_seq，期间有缓存项失效时查找结果可能已经过时，不放入缓存
+ */
+void dcache_add(struct m_inode * dir, const char * name, int len, int ino, unsigned long seq)
+{
+        struct dentry * d;
+        char buf[NAME_LEN];
+        int h, i;
+
+        if ((h = dname(dir->i_dev, dir->i_num, name, len, buf)) < 0)
+                return;
+        if (seq != dcache_seq) // dname 复制文件名时也可能睡眠，所以在这里检查
+                return;
+        if ((d = d_find(h, dir->i_dev, dir->i_num, buf, len))) {
+                d->d_ino = ino;
+                d_touch(d);
+                return;
+        }
+        d = d_alloc();
+        d->d_dev = dir->i_dev;
+        d->d_dir = dir->i_num;
+        d->d_ino = ino;
+        d->d_len = len;
+        d->d_hash = h;
+        for (i = 0 ; i < len ; i++)
+                d->d_name[i] = buf[i];
+        d->d_prev = NULL;
+        if ((d->d_next = dhash_table[h]))
+                d->d_next->d_prev = d;
+        dhash_table[h] = d;
+}
+
+/**
+ * 目录 dir 中的文件名 name 被创建或删除：让对应的缓存项失效
+ */
+void dcache_remove(struct m_inode * dir, const char * name, int len)
+{
+        struct dentry * d;
+        char buf[NAME_LEN];
+        int h;
+
+        dcache_seq++; // 即使没有缓存项也要增加：可能有查找者正在扫描这个目录
+        if ((h = dname(dir->i_dev, dir->i_num, name, len, buf)) < 0)
+                return;
+        if ((d = d_find(h, dir->i_dev, dir->i_num, buf, len)))
+                d_drop(d);
+}
+
+/**
+ * 让设备 dev 上目录 dir 中的所有缓存项失效，dir 为 0 时让整个设备的缓存项失效
+ *
+ * 删除目录时调用（它的i节点号以后可能分配给别的目录），卸载文件系统时调用
+ */
+void dcache_invalidate(int dev, int dir)
+{
+        struct dentry * d;
+
+        dcache_seq++;
+        for (d = dentry_table ; d < dentry_table + nr_dentry ; d++)
+                if (d->d_len && d->d_dev == dev && (!dir || d->d_dir == dir))
+                        d_drop(d);
+}
+
+/**
+ * 打印目录项缓存的统计信息
+ */
+void show_dcache_stats(void)
+{
+        printk("dcache: %d entries, %d lookups, %d hits (%d negative), %d invalidated\n\r",
+               nr_dentry, dcache_stats.lookups, dcache_stats.hits,
+               dcache_stats.negative_hits, dcache_stats.invalidates);
+}
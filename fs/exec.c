@@ -267,7 +267,7 @@ static unsigned long change_ldt(unsigned long text_size,unsigned long * page)
         for (i=MAX_ARG_PAGES-1 ; i>=0 ; i--) {
                 data_base -= PAGE_SIZE; // data_base指向下一页
                 if (page[i]) // 如果该页面存在，绝大部分情况实际上不会用满 MAX_ARG_PAGES 个内存页
-                        put_page(page[i],data_base); // 把物理地址 page[i] 映射到 线性空间地址 data_base 上  
+                        put_dirty_page(page[i],data_base); // 把物理地址 page[i] 映射到 线性空间地址 data_base 上（内容已经写好，设置“已修改”位）  
         }
         return data_limit; // 返回段限长 64MB 
 }
@@ -478,6 +478,7 @@ restart_interp:
         if (current->executable) // 如果”当前进程“的”可执行文件i节点“已经被设置
                 iput(current->executable); // 放回”当前进程“的”可执行文件i节点“
         current->executable = inode; // 设置”当前进程“的”可执行文件i节点“为‘inode’变量
+        exit_mmap(current); // 放弃原来的文件映射区，映射的页面在下面随页表释放
         
         // 置空当前进程的所有信号处理句柄
         // 注意：这里的做得比较粗糙
@@ -496,8 +497,18 @@ restart_interp:
         // 因此在处理器真正执行新执行文件代码时会触发”缺页异常中断“：
         // 1. 内存管理程序开始执行缺页处理，为新执行申请内存页面和设置相关页表项
         // 2. 把相关执行文件页面读入内存中
-        free_page_tables(get_base(current->ldt[1]),get_limit(0x0f)); // 释放当前进程的代码段所对应的内存表映射的物理内存页面和页表本身
-        free_page_tables(get_base(current->ldt[2]),get_limit(0x17)); // 释放当前进程的数据段所对应的内存表映射的物理内存页面和页表本身
+        if (current->vfork_mm) {
+                // vfork 创建的进程借用的是父进程的线性地址空间：不能释放，换回自己的 64MB 线性地址空间（那里还没有页表），
+                // 并唤醒父进程。gs 不会在系统调用返回时重新加载，这里重新加载，使它用上新的段基址
+                current->start_code = current->task_nr * 0x4000000;
+                set_base(current->ldt[1],current->start_code);
+                set_base(current->ldt[2],current->start_code);
+                __asm__("pushl $0x17\n\tpop %%gs"::);
+                vfork_release();
+        } else {
+                free_page_tables(get_base(current->ldt[1]),get_limit(0x0f)); // 释放当前进程的代码段所对应的内存表映射的物理内存页面和页表本身
+                free_page_tables(get_base(current->ldt[2]),get_limit(0x17)); // 释放当前进程的数据段所对应的内存表映射的物理内存页面和页表本身
+        }
         
         if (last_task_used_math == current) // 如果原来进程是最后一个使用数字协处理器的进程
                 last_task_used_math = NULL; // 重置最后一个使用数字协处理器的进程指针
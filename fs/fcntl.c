@@ -113,6 +113,14 @@ int sys_fcntl(unsigned int fd, unsigned int cmd, unsigned long arg)
                 filp->f_flags &= ~(O_APPEND | O_NONBLOCK); 
                 filp->f_flags |= arg & (O_APPEND | O_NONBLOCK);
                 return 0;
+		case F_GETPIPE_SZ: // 取管道缓冲区的大小
+                if (!filp->f_inode->i_pipe)
+                        return -EINVAL;
+                return PIPE_BUF_SIZE(*filp->f_inode);
+		case F_SETPIPE_SZ: // 把管道缓冲区调整为不小于 arg 字节，返回新的大小
+                if (!filp->f_inode->i_pipe)
+                        return -EINVAL;
+                return pipe_set_size(filp->f_inode,arg);
 		case F_GETLK:	case F_SETLK:	case F_SETLKW: // 文件锁功能未实现
                 return -1; // 直接返回 -1
 		default: // 未知命令
@@ -6,14 +6,88 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/segment.h>
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+#define RA_MIN 4 // 检测到顺序读时的初始预读窗口（块数）
+#define RA_MAX 32 // 预读窗口的最大值（块数），也是一次提交给 breadahead 的最多块数
+
+/*
+ * 根据本次读操作的起始块调整文件的预读窗口
+ *
+ * filp: 文件结构指针
+ * block: 本次读操作开始的文件内逻辑块号
+ *
+ * 紧接着上一次读操作结束的位置开始读：认为是顺序读，打开预读窗口
+ * 否则认为发生了随机访问，预读窗口减半，小于 RA_MIN 时关闭预读
+ * 
+ */
+static inline void ra_check(struct file * filp, unsigned long block)
+{
+        if (block == filp->f_ra_next) {
+                if (!filp->f_ra_win)
+                        filp->f_ra_win = RA_MIN;
+                return;
+        }
+        filp->f_ra_win >>= 1;
+        if (filp->f_ra_win < RA_MIN)
+                filp->f_ra_win = 0;
+        filp->f_ra_end = block; // 以前发起的预读已经没有意义，从新的位置重新开始
+}
+
+/*
+ * 为文件读操作发起簇读和预读
+ *
+ * inode: i节点
+ * filp: 文件结构指针
+ * block: 当前要读的文件内逻辑块号
+ * last: 本次读操作需要的最后一个文件内逻辑块号
+ *
+ * 本次读操作还需要的块和其后预读窗口内的块一次性异步提交，然后再逐块等待，而不是读一块等一块
+ * 已经提交的块还剩不到一半时才重新提交，每次重新提交时顺序读的预读窗口翻倍，直到 RA_MAX
+ * 
+ */
+static void file_readahead(struct m_inode * inode, struct file * filp,
+                           unsigned long block, unsigned long last)
+{
+        unsigned long end, limit;
+        int b[RA_MAX], n = 0;
+
+        // 需要提交的上界：本次读操作的剩余部分加上预读窗口，但不超过文件末尾，并且不能占用太多缓冲块
+        end = last + 1 + filp->f_ra_win;
+        limit = (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (end > limit)
+                end = limit;
+        limit = block + MIN(2 * RA_MAX, NR_BUFFERS / 4);
+        if (end > limit)
+                end = limit;
+        if (filp->f_ra_end < block)
+                filp->f_ra_end = block;
+        // 已经提交的块还够用
+        if (filp->f_ra_end >= end || filp->f_ra_end - block > (end - block) / 2)
+                return;
+        if (filp->f_ra_win && end > last + 1)
+                filp->f_ra_win = MIN(filp->f_ra_win * 2, RA_MAX);
+        // 文件内的逻辑块号转换成设备上的块号，攒满一批就提交
+        for ( ; filp->f_ra_end < end ; filp->f_ra_end++) {
+                if ((b[n] = bmap(inode,filp->f_ra_end)))
+                        n++;
+                if (n == RA_MAX) {
+                        breadahead(inode->i_dev,b,n);
+                        n = 0;
+                }
+        }
+        if (n)
+                breadahead(inode->i_dev,b,n);
+}
+
 /**
  * 普通文件读函数
  *
@@ -30,13 +104,32 @@
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
         int left,chars,nr;
+        unsigned long last, page;
         struct buffer_head * bh;
 
         // 判断参数的有效性
         if ((left=count)<=0) // 如果要读的字节数 <= 0, 直接返回0
                 return 0;
+        last = (filp->f_pos + count - 1) / BLOCK_SIZE; // 本次读操作需要的最后一块
+        ra_check(filp, filp->f_pos / BLOCK_SIZE); // 顺序访问检测，调整预读窗口
         // 如果要读的字节数 > 0, 则执行下面循环
         while (left) {
+                // 把本次还需要的块和预读窗口内的块一起提交给块设备
+                file_readahead(inode, filp, filp->f_pos / BLOCK_SIZE, last);
+                // 普通文件通过页缓存读取：每次最多复制到页面的末尾
+                if (S_ISREG(inode->i_mode)) {
+                        if (!(page = get_file_page(inode,(filp->f_pos / PAGE_SIZE) * (PAGE_SIZE / BLOCK_SIZE))))
+                                break;
+                        nr = filp->f_pos % PAGE_SIZE;
+                        chars = MIN( PAGE_SIZE-nr , left );
+                        filp->f_pos += chars;
+                        left -= chars;
+                        memcpy_tofs(buf,(char *) page + nr,chars);
+                        buf += chars;
+                        free_page(page); // 放回页面的引用
+                        continue;
+                }
+                // 目录通过高速缓冲区读取（add_entry 等直接修改目录的缓冲块，不经过 file_write）
                 // 计算包含文件当前指针位置的数据块在设备上对应的逻辑块号
                 if ((nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE))) { // 计算出的逻辑块号不为 0
                         // 从设备读取数据块到高速缓冲区
@@ -52,9 +145,9 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
                 left -= chars; // 要读的总字节数减少 chars个字节
                 if (bh) { // bh 不为空
                         char * p = nr + bh->b_data; // p指向高速缓冲块数据区起始处后的nr个字节（开始读取数据的位置）
-                        // 从“高速缓冲区” “一个一个字节地“ 拷贝到“用户缓冲区”，总共复制 chars个字节
-                        while (chars-->0) 
-                                put_fs_byte(*(p++),buf++); // p指针，buf指针，每次往后偏移一个字节
+                        // 从“高速缓冲区”拷贝到“用户缓冲区”，总共复制 chars个字节
+                        memcpy_tofs(buf,p,chars);
+                        buf += chars;
                         brelse(bh); // 释放高速缓冲块
                 } else { // 要读的数据块不存在：直接往用户缓冲区填入chars个0值字节
                         // 这里的处理导致会有”文件空洞“的现象（实际文件占用的数据块 < 文件大小）
@@ -63,6 +156,7 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
                 }
         }
         //执行到这里已经读取完毕或者出错退出循环
+        filp->f_ra_next = filp->f_pos / BLOCK_SIZE; // 顺序读时下一次读操作应该从这一块开始
         inode->i_atime = CURRENT_TIME; // 修改该i节点的访问时间为当前时间（UNIX格式）
         return (count-left)?(count-left):-ERROR; // 返回读取的字节数：如果读取的字节数为0，则返回 -ERROR
 }
@@ -116,9 +210,11 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
                         inode->i_dirt = 1; // 置位i节点的修改标志
                 }
                 i += c; // 累加已经写入的总字节数
-                // 从”用户缓冲区“一个个字节地拷贝到”高速缓冲区“中，总共拷贝 c 个字节
-                while (c-->0)
-                        *(p++) = get_fs_byte(buf++); // p, buf 各自每次向后移动一个字节
+                // 从”用户缓冲区“拷贝到”高速缓冲区“中，总共拷贝 c 个字节
+                memcpy_fromfs(p,buf,c);
+                buf += c;
+                if (S_ISREG(inode->i_mode)) // 页缓存中包含这一块的页面已经过时（pos 已经指向写入的数据之后）
+                        invalidate_file_pages(inode,(pos-1)/BLOCK_SIZE);
                 brelse(bh); // 释放高速缓冲块
         }
         // 执行到这里已经写入完毕 或者 出错退出循环
@@ -129,3 +225,34 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
         }
         return (i?i:-1); // 返回总共写入的字节数：如果总写入的字节数 == 0 ，则返回 -1 表示出错
 }
+
+/**
+ * 普通文件和目录的输入/输出控制
+ *
+ * inode: 文件的i节点指针
+ * cmd: 控制命令
+ * arg: 参数（用户空间地址）
+ *
+ * 成功返回 0，失败返回出错码
+ *
+ * FIGETEXTENTS: 把文件在设备上占用的区段个数写到 arg 处的长字中，盘块号连续的一段逻辑块算一个区段（空洞不计），
+ * 可以用来衡量文件的碎片程度：完全连续的文件只有一个区段
+ */
+int file_ioctl(struct m_inode * inode, int cmd, int arg)
+{
+        int block, nr, last = 0, extents = 0;
+
+        switch (cmd) {
+        case FIGETEXTENTS:
+                verify_area((void *) arg,4);
+                for (block = 0 ; block < (inode->i_size + BLOCK_SIZE - 1) >> BLOCK_SIZE_BITS ; block++) {
+                        if ((nr = bmap(inode,block)) && nr != last + 1)
+                                extents++;
+                        last = nr;
+                }
+                put_fs_long(extents,(unsigned long *) arg);
+                return 0;
+        default:
+                return -EINVAL;
+        }
+}
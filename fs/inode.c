@@ -12,12 +12,122 @@
 #include <linux/mm.h>
 #include <asm/system.h>
 
-//内存中全局“i节点表”(NR_INODE = 32) 
-struct m_inode inode_table[NR_INODE]={{0,},};
+//内存中全局“i节点表”，放在主内存的开始处，项数 NR_INODE 在 inode_init 中根据内存大小确定
+struct m_inode * inode_table;
+
+/*
+ * i节点表项数，NR_INODE 是定义在 linux/fs.h 中的宏，其值即是变量 nr_inode，初始化以后就不再改变
+ */
+int NR_INODE = 0;
+
+/*
+ * i节点的 hash 表：哈希函数 (设备号 ^ i节点号) & (nr_ihash - 1)
+ * 每一项是一个双向“i节点”链表，只有设备号不为 0 的i节点才放在 hash 表中
+ */
+static struct m_inode ** inode_hash_table;
+static int nr_ihash = 0;
+
+#define _ihashfn(dev,nr) (((unsigned)((dev)^(nr)))&(nr_ihash-1))
+#define ihash(dev,nr) inode_hash_table[_ihashfn(dev,nr)]
+
+/*
+ * 空闲（引用计数为 0）i节点的双向循环链表，按照释放的先后顺序排列（LRU）
+ * 表头是最久没有被使用的，get_empty_inode 从表头开始取，所以最近使用过的i节点会留在内存中，iget 可以直接找到
+ * 设备号为 0 的i节点（没有缓存任何内容）放在表头，最先被重新使用
+ */
+static struct m_inode * free_inodes = NULL;
+static int nr_free_inodes = 0;
+
+// 统计信息
+static struct {
+        unsigned long hits; // iget 在 hash 表中找到i节点的次数
+        unsigned long misses; // iget 需要从设备读入i节点的次数
+        unsigned long evictions; // 为了得到空闲i节点而丢弃缓存的i节点的次数
+} inode_stats;
 
 static void read_inode(struct m_inode * inode);
 static void write_inode(struct m_inode * inode);
 
+/*
+ * 把i节点放入空闲链表：缓存着设备上i节点的放在表尾，其他的放在表头
+ */
+static inline void file_inode(struct m_inode * inode)
+{
+        if (!free_inodes) {
+                inode->i_free_next = inode->i_free_prev = inode;
+                free_inodes = inode;
+        } else {
+                inode->i_free_next = free_inodes;
+                inode->i_free_prev = free_inodes->i_free_prev;
+                free_inodes->i_free_prev->i_free_next = inode;
+                free_inodes->i_free_prev = inode;
+                if (!inode->i_dev)
+                        free_inodes = inode;
+        }
+        nr_free_inodes++;
+}
+
+/*
+ * 把i节点从空闲链表中取下
+ */
+static inline void unfile_inode(struct m_inode * inode)
+{
+        if (inode->i_free_next == inode) {
+                free_inodes = NULL;
+        } else {
+                inode->i_free_prev->i_free_next = inode->i_free_next;
+                inode->i_free_next->i_free_prev = inode->i_free_prev;
+                if (free_inodes == inode)
+                        free_inodes = inode->i_free_next;
+        }
+        inode->i_free_next = inode->i_free_prev = NULL;
+        nr_free_inodes--;
+}
+
+/**
+ * 把i节点按照它的设备号和i节点号放入 hash 表
+ *
+ * inode: i节点指针（i_dev 和 i_num 已经设置好）
+ *
+ * 无返回值
+ */
+void insert_inode_hash(struct m_inode * inode)
+{
+        struct m_inode ** head = &ihash(inode->i_dev,inode->i_num);
+
+        inode->i_prev = NULL;
+        if ((inode->i_next = *head))
+                inode->i_next->i_prev = inode;
+        *head = inode;
+}
+
+/*
+ * 把i节点从 hash 表中移除（在清除它的设备号之前调用）
+ */
+static void remove_inode_hash(struct m_inode * inode)
+{
+        if (inode->i_next)
+                inode->i_next->i_prev = inode->i_prev;
+        if (inode->i_prev)
+                inode->i_prev->i_next = inode->i_next;
+        else if (ihash(inode->i_dev,inode->i_num) == inode)
+                ihash(inode->i_dev,inode->i_num) = inode->i_next;
+        inode->i_next = inode->i_prev = NULL;
+}
+
+/*
+ * 在 hash 表中查找设备 dev 上的 nr 号i节点
+ */
+static struct m_inode * find_inode(int dev, int nr)
+{
+        struct m_inode * inode;
+
+        for (inode = ihash(dev,nr) ; inode ; inode = inode->i_next)
+                if (inode->i_dev == dev && inode->i_num == nr)
+                        return inode;
+        return NULL;
+}
+
 /*
  * 等待指定的i节点可用
  *
@@ -86,6 +196,7 @@ void invalidate_inodes(int dev)
         int i;
         struct m_inode * inode;
 
+        invalidate_dev_pages(dev); // 页缓存中这个设备的页面全部失效
         inode = inode_table;
         // 遍历整个内存节点表
         for(i=0 ; i<NR_INODE ; i++,inode++) {
@@ -93,7 +204,12 @@ void invalidate_inodes(int dev)
                 if (inode->i_dev == dev) { // 校验i节点的设备号是不是特定设备
                         if (inode->i_count) // 如果i节点还被其他进程引用,则显示出错警告
                                 printk("inode in use on removed disk\n\r");
+                        remove_inode_hash(inode); // 从 hash 表中移除
                         inode->i_dev = inode->i_dirt = 0; // i节点的设备号,修改标志皆设为 0 
+                        if (!inode->i_count) { // 空闲的i节点移到空闲链表头，最先被重新使用
+                                unfile_inode(inode);
+                                file_inode(inode);
+                        }
                 }
         }
 }
@@ -135,8 +251,10 @@ void sync_inodes(void)
 static int _bmap(struct m_inode * inode,int block,int create)
 {
         struct buffer_head * bh;
-        int i;
+        unsigned short * table;
+        int i,goal;
 
+        // 新申请的盘块尽量紧跟在文件前一个逻辑块之后（new_file_block 的 goal 参数），这样顺序读写时相邻的请求可以合并
         if (block<0) // 校验数据块号的有效性
                 panic("_bmap: block<0"); // 小于0, 停机
         if (block >= 7+512+512*512) // 超出文件系统表示范围，停机
@@ -145,7 +263,8 @@ static int _bmap(struct m_inode * inode,int block,int create)
         if (block<7) {
                 // 需要创建设备上的盘块 && i节点中对应逻辑块（区段）字段为0
                 if (create && !inode->i_zone[block]) {
-                        if ((inode->i_zone[block]=new_block(inode->i_dev))) {
+                        if ((inode->i_zone[block]=new_file_block(inode,
+                                                            block ? inode->i_zone[block-1] : 0))) {
                                 inode->i_ctime=CURRENT_TIME; // 设置“i节点修改时间”
                                 inode->i_dirt=1; // 设置i节点的修改标志为“真”
                         }
@@ -157,7 +276,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
         if (block<512) { 
                 if (create && !inode->i_zone[7]) {
                         // 如果创建标志置位，则申请一块新的磁盘块来存放一次间接块
-                        if ((inode->i_zone[7]=new_block(inode->i_dev))) {
+                        if ((inode->i_zone[7]=new_file_block(inode,inode->i_zone[6]))) {
                                 inode->i_dirt=1;
                                 inode->i_ctime=CURRENT_TIME;
                         }
@@ -166,11 +285,13 @@ static int _bmap(struct m_inode * inode,int block,int create)
                         return 0; // 返回0：表示失败
                 if (!(bh = bread(inode->i_dev,inode->i_zone[7]))) //尝试从磁盘读入”一次间接块“对应的”逻辑块“到”高速缓冲区“
                         return 0; // 返回0：表示一次间接块的读取失败
-                i = ((unsigned short *) (bh->b_data))[block]; // 文件数据块在一次间接块（高速缓存映射）中对应的数据
+                table = (unsigned short *) bh->b_data;
+                i = table[block]; // 文件数据块在一次间接块（高速缓存映射）中对应的数据
                 if (create && !i) // 创建标志置位，并且原来位置上数据为空
                         // 创建一块新的逻辑块
-                        if ((i=new_block(inode->i_dev))) {
-                                ((unsigned short *) (bh->b_data))[block]=i;
+                        if ((i=new_file_block(inode,
+                                         (block && table[block-1]) ? table[block-1] : inode->i_zone[7]))) {
+                                table[block]=i;
                                 bh->b_dirt=1; // 一次间接块的修改标志置位
                         }
                 brelse(bh); // 释放一次间接块对应的缓冲区
@@ -180,7 +301,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
         block -= 512;
         if (create && !inode->i_zone[8])
                 // 设置i节点中的字段值 inode->i_zone[8]：二次间接块中的一级块
-                if ((inode->i_zone[8]=new_block(inode->i_dev))) {
+                if ((inode->i_zone[8]=new_file_block(inode,inode->i_zone[7]))) {
                         inode->i_dirt=1; //设置i节点的值为已经修改
                         inode->i_ctime=CURRENT_TIME;
                 }
@@ -189,11 +310,13 @@ static int _bmap(struct m_inode * inode,int block,int create)
         // 读取二次间接块对应的一级块到高速缓存区
         if (!(bh=bread(inode->i_dev,inode->i_zone[8])))
                 return 0;
-        i = ((unsigned short *)bh->b_data)[block>>9]; // 二次间接块的”二级块“在”一级块“上对应位置：block/512
+        table = (unsigned short *) bh->b_data;
+        i = table[block>>9]; // 二次间接块的”二级块“在”一级块“上对应位置：block/512
         if (create && !i)
                 // 申请二次间接块对应的二级块
-                if ((i=new_block(inode->i_dev))) {
-                        ((unsigned short *) (bh->b_data))[block>>9]=i;
+                if ((i=new_file_block(inode,
+                                 ((block>>9) && table[(block>>9)-1]) ? table[(block>>9)-1] : inode->i_zone[8]))) {
+                        table[block>>9]=i;
                         bh->b_dirt=1; // 设置二次间接块的一级块已经被修改
                 }
         brelse(bh); // 释放二次间接块的一级块对应的高速缓存区
@@ -202,11 +325,14 @@ static int _bmap(struct m_inode * inode,int block,int create)
         // 读取二次间接块对应的二级块到高速缓存区
         if (!(bh=bread(inode->i_dev,i)))
                 return 0;
-        i = ((unsigned short *)bh->b_data)[block&511]; // 计算数据块在二次间接块的二级块中对应的位置：(block&511) 
+        table = (unsigned short *) bh->b_data;
+        goal = i; // 二级块本身的盘块号
+        i = table[block&511]; // 计算数据块在二次间接块的二级块中对应的位置：(block&511) 
         if (create && !i)
                 // 在设备上创建一块新的盘块号给数据块
-                if ((i=new_block(inode->i_dev))) {
-                        ((unsigned short *) (bh->b_data))[block&511]=i;
+                if ((i=new_file_block(inode,
+                                 ((block&511) && table[(block&511)-1]) ? table[(block&511)-1] : goal))) {
+                        table[block&511]=i;
                         bh->b_dirt=1; // 二次间接块的二级块对应的i节点设置修改标志
                 }
         brelse(bh); // 高速缓存区中释放二次间接块中的二级块
@@ -264,19 +390,23 @@ void iput(struct m_inode * inode)
         // 处理“管道文件”节点
         if (inode->i_pipe) {
                 wake_up(&inode->i_wait); // 唤醒等待该节点的进程
+                wake_up_queue_all(&inode->i_rwait); // 管道的一端关闭了：唤醒所有读写进程，让它们检查另一端
+                wake_up_queue_all(&inode->i_wwait);
                 if (--inode->i_count) // 如果还有引用，则直接返回
                         return;
                 // 释放i节点对应的内存页面
-                free_page(inode->i_size); // 对于管道节点， i_size 保存了对应的内存地址 
+                free_pages(inode->i_size,PIPE_ORDER(*inode)); // 对于管道节点， i_size 保存了缓冲区的内存地址
                 inode->i_count=0; // 引用计数为0
                 inode->i_dirt=0; // 复位修改标志 
                 inode->i_pipe=0; // 复位管道标志
+                file_inode(inode); // 放入空闲链表
                 return;
         }
 
         // 如果i节点对应的设备号为0：如管道操作的i节点
         if (!inode->i_dev) {
-                inode->i_count--; // 引用计数减1，退出
+                if (!--inode->i_count) // 引用计数减1，退出
+                        file_inode(inode); // 已经没有引用：放入空闲链表
                 return;
         }
         // 处理块设备文件对应的i节点（注意：不是普通文件，目录，类似于 /dev/fd 这种）
@@ -291,10 +421,17 @@ repeat:
                 inode->i_count--; // 引用次数递减1
                 return; // 因为还有其他进程在引用该节点，所以不能释放，直接退出
         }
+        // 放回最后一个引用：释放预分配窗口中没有用到的逻辑块
+        if (inode->i_prealloc_count) {
+                discard_prealloc(inode);
+                goto repeat; // 释放过程中可能睡眠，重新判断
+        }
         // 该节点的引用次数为1（前面已经判断过引用次数是否为0！）
         if (!inode->i_nlinks) { // 如果该节点的链接次数等于0，说明对应的文件已经被删除
                 truncate(inode); // 释放该节点所对应的所有逻辑块
+                remove_inode_hash(inode); // 从 hash 表中移除（free_inode 会清空整个i节点）
                 free_inode(inode); // 释放该节点
+                file_inode(inode); // 放入空闲链表
                 return;
         }
         // 该节点的“修改标志”为“真”
@@ -305,6 +442,7 @@ repeat:
                 goto repeat; // 睡眠过程中，其他的进程可能还会修改该节点，所以重复进行上述判断
         }
         inode->i_count--; // i节点的引用计数减1
+        file_inode(inode); // 放入空闲链表尾部：内容仍然有效，再次 iget 时可以直接使用
         return;
 }
 
@@ -317,29 +455,26 @@ repeat:
  */
 struct m_inode * get_empty_inode(void)
 {
-        struct m_inode * inode;
-        static struct m_inode * last_inode = inode_table;
+        struct m_inode * inode, * tmp;
         int i;
 
         do {
-                inode = NULL;
-                // 从最后一项开始，遍历i节点表
-                for (i = NR_INODE; i ; i--) {
-                        if (++last_inode >= inode_table + NR_INODE) // 如果 last_node 已经指向“i节点表”最后一项之后
-                                last_inode = inode_table; // last_node 重新指向“i节点表”
-                        if (!last_inode->i_count) { // 如果 last_node 的引用计数为0：说明已经找到一个空闲的i节点
-                                inode = last_inode; // inode 指向该项
-                                if (!inode->i_dirt && !inode->i_lock) // inode 的修改标志和锁定标志皆没有置位
-                                        break; // 已经找到需要的空节点，退出循环
-                        }
-                }
-                // 无法找到一个空的i节点，则打印所有的i节点，并停机
-                if (!inode) {
+                // 空闲链表为空：无法找到一个空的i节点，则打印所有的i节点，并停机
+                if (!(inode = free_inodes)) {
                         for (i=0 ; i<NR_INODE ; i++)
                                 printk("%04x: %6d\t",inode_table[i].i_dev,
                                        inode_table[i].i_num);
                         panic("No free inodes in mem");
                 }
+                // 从空闲链表头（最久没有使用的）开始，找一个修改标志和锁定标志皆没有置位的i节点
+                // 找不到的话就使用表头的i节点，先把它写回
+                tmp = inode;
+                do {
+                        if (!tmp->i_dirt && !tmp->i_lock) {
+                                inode = tmp;
+                                break;
+                        }
+                } while ((tmp = tmp->i_free_next) != free_inodes);
                 wait_on_inode(inode); // 等待该节点解锁（如果又被上锁的话）
                 while (inode->i_dirt) { 
                         write_inode(inode); // 如果修改标志置位，则把节点回写到高速缓冲区中
@@ -347,6 +482,11 @@ struct m_inode * get_empty_inode(void)
                 }
         } while (inode->i_count); // 再次校验该节点是否空闲， 如果又被其他进程占用，则再次开始循环寻找一个空闲的节点
         // 总算找到一个真正空闲的i节点：引用次数为0, 没有修改，没有上锁
+        unfile_inode(inode); // 从空闲链表中取下
+        if (inode->i_dev) { // 丢弃它缓存的设备i节点
+                remove_inode_hash(inode);
+                inode_stats.evictions++;
+        }
         memset(inode,0,sizeof(*inode)); // 重新设置i节点中的数据
         inode->i_count = 1; // i节点引用计数为1
         return inode; 
@@ -369,13 +509,15 @@ struct m_inode * get_pipe_inode(void)
                 return NULL; // 申请失败，则返回NULL
         // 尝试为这个i节点分配一页内存页，分配到的内存页物理地址放入到i节点的i_size域下
         if (!(inode->i_size=get_free_page())) {
-                // 分配失败，则设置i节点的引用计数为0，返回NULL
+                // 分配失败，则设置i节点的引用计数为0，放回空闲链表，返回NULL
                 inode->i_count = 0;
+                file_inode(inode);
                 return NULL; 
         }
         // i节点的引用计数设为2：读进程和写进程
         inode->i_count = 2;	/* sum of readers/writers */ 
         PIPE_HEAD(*inode) = PIPE_TAIL(*inode) = 0; // 管道头指针(i_zone[0])和管道尾指针(i_zone[1])复位
+        PIPE_ORDER(*inode) = PIPE_BUSY(*inode) = 0; // 开始时缓冲区只有一页，写入大块数据时再增大
         inode->i_pipe = 1; // 设置管道标志
         return inode;
 }
@@ -391,27 +533,21 @@ struct m_inode * get_pipe_inode(void)
  */
 struct m_inode * iget(int dev,int nr)
 {
-        struct m_inode * inode, * empty;
+        struct m_inode * inode, * empty = NULL;
         
         if (!dev) // 设备号为0：内核报错，退出
                 panic("iget with dev==0");
-        empty = get_empty_inode(); // 获得一个空闲的i节点指针
-        inode = inode_table; // inode 指向内核i节点表
-        // 遍历“内核i节点表”
-        while (inode < NR_INODE+inode_table) {
-                // “内核i节点表”中的i节点与“要获得的i节点”不匹配
-                if (inode->i_dev != dev || inode->i_num != nr) {
-                        inode++;
-                        continue; // 遍历下一个
-                }
+repeat:
+        // 在 hash 表中查找
+        if ((inode = find_inode(dev,nr))) {
                 wait_on_inode(inode); // 等待i节点解锁
-                // 再次校验是否匹配
-                if (inode->i_dev != dev || inode->i_num != nr) {
-                        inode = inode_table; // 重新指向内核i节点表开头
-                        continue; // 从新开始遍历
-                }
+                // 再次校验是否匹配（睡眠期间该i节点可能已经被重新使用）
+                if (inode->i_dev != dev || inode->i_num != nr)
+                        goto repeat; // 重新查找
                 // 到这里表示找到相应的i节点
-                inode->i_count++; // i节点的引用计数加1
+                inode_stats.hits++;
+                if (!inode->i_count++) // i节点的引用计数加1
+                        unfile_inode(inode); // 原来是空闲的：从空闲链表中取下
                 // 检查i节点是否是另一个文件系统的挂载点
                 if (inode->i_mount) {
                         // 当前的i节点是另一个文件系统的挂载点
@@ -432,8 +568,7 @@ struct m_inode * iget(int dev,int nr)
                         iput(inode); // 将该i节点写盘放回
                         dev = super_block[i].s_dev; // 设备号为超级块中对应的设备号
                         nr = ROOT_INO; // i节点号为文件系统的根节点号(1)
-                        inode = inode_table; // inode 重新指向内存节点表，再次循环查找对应的i节点
-                        continue;
+                        goto repeat; // 再次查找对应的i节点
                 }
                 // 执行到这里：表示已经在内存i节点表中找到对应的i节点
                 if (empty) 
@@ -441,11 +576,17 @@ struct m_inode * iget(int dev,int nr)
                 return inode; // 返回已经寻找到的i节点
         }
         // 执行到这里：在内存i节点表中无法找到对应的i节点
-        if (!empty) // 无法申请一个空闲i节点作为临时i节点
-                return (NULL);
+        // 命中时不需要空闲i节点：只在没有找到时才申请，申请时可能因为回写i节点而睡眠，所以申请以后要重新查找
+        if (!empty) {
+                if (!(empty = get_empty_inode())) // 无法申请一个空闲i节点作为临时i节点
+                        return (NULL);
+                goto repeat;
+        }
+        inode_stats.misses++;
         inode=empty; // inode 指向申请到的临时i节点
         inode->i_dev = dev; // 设备号 = dev 
         inode->i_num = nr; // i节点号 = nr 
+        insert_inode_hash(inode); // 放入 hash 表
         read_inode(inode); // 从设备中读取该i节点信息到高速缓存区中
         return inode;
 }
@@ -518,3 +659,46 @@ static void write_inode(struct m_inode * inode)
         brelse(bh); // 释放高速缓冲区对应的缓冲块
         unlock_inode(inode); // i节点解锁
 }
+
+/**
+ * 打印i节点表的统计信息
+ */
+void show_inode_stats(void)
+{
+        printk("inodes: %d, hash size %d, %d free\n\r",NR_INODE,nr_ihash,nr_free_inodes);
+        printk("  iget: %d hits, %d misses, %d evicted\n\r",
+               inode_stats.hits,inode_stats.misses,inode_stats.evictions);
+}
+
+/**
+ * 初始化内存i节点表
+ *
+ * start_mem: 主内存开始地址
+ * end_mem: 实际物理内存的最大地址
+ *
+ * 返回：新的主内存开始地址
+ *
+ * i节点表和它的 hash 表放在主内存的开始处，大约每 32KB 内存一个i节点（最少 32 个，最多 2048 个）
+ * hash 表项数是不小于i节点数一半的 2 的幂
+ */
+long inode_init(long start_mem, long end_mem)
+{
+        int i;
+
+        NR_INODE = end_mem >> 15;
+        if (NR_INODE < 32)
+                NR_INODE = 32;
+        if (NR_INODE > 2048)
+                NR_INODE = 2048;
+        for (nr_ihash = 16 ; nr_ihash < (NR_INODE >> 1) ; nr_ihash <<= 1)
+                /* nothing */ ;
+        inode_table = (struct m_inode *) start_mem;
+        inode_hash_table = (struct m_inode **) (inode_table + NR_INODE);
+        memset(inode_table,0,NR_INODE * sizeof(struct m_inode));
+        for (i = 0 ; i < nr_ihash ; i++)
+                inode_hash_table[i] = NULL;
+        // 所有i节点都是空闲的
+        for (i = 0 ; i < NR_INODE ; i++)
+                file_inode(inode_table + i);
+        return ((long) (inode_hash_table + nr_ihash) + 4095) & ~4095;
+}
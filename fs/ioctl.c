@@ -16,6 +16,8 @@
 #include <linux/sched.h>
 
 extern int tty_ioctl(int dev, int cmd, int arg); // chr_drv/tty_ioctl.c
+extern int blk_ioctl(int dev, int cmd, int arg); // blk_drv/ll_rw_blk.c
+extern int file_ioctl(struct m_inode * inode, int cmd, int arg); // file_dev.c
 
 // 定义输入输出控制(ioctl)的函数指针
 // 函数的参数：int dev, int cmd, int arg, 函数的返回值 int 
@@ -23,7 +25,7 @@ typedef int (*ioctl_ptr)(int dev,int cmd,int arg);
 
 #define NRDEVS ((sizeof (ioctl_table))/(sizeof (ioctl_ptr))) // 设备数目的宏
 
-// ioctl函数指针表
+// 字符设备的ioctl函数指针表（块设备和字符设备共用主设备号 1~3，块设备统一由 blk_ioctl 处理）
 static ioctl_ptr ioctl_table[]={
         NULL,		// 没有设备
         NULL,		// 内存
@@ -54,9 +56,13 @@ int sys_ioctl(unsigned int fd, unsigned int cmd, unsigned long arg)
         if (fd >= NR_OPEN || !(filp = current->filp[fd]))
                 return -EBADF; // 返回错误码 EBADF
         mode=filp->f_inode->i_mode; // 获取对应文件的类型和属性
+        if (S_ISREG(mode) || S_ISDIR(mode)) // 普通文件和目录
+                return file_ioctl(filp->f_inode,cmd,arg);
         if (!S_ISCHR(mode) && !S_ISBLK(mode)) // 文件不是块设备也不是字符设备
                 return -EINVAL; // 返回错误码 EINVAL 
         dev = filp->f_inode->i_zone[0]; // 获取文件对应的物理设备号
+        if (S_ISBLK(mode)) // 块设备：请求队列的统计和深度
+                return blk_ioctl(dev,cmd,arg);
         if (MAJOR(dev) >= NRDEVS) // 主设备号大于支持的设备种类
                 return -ENODEV; // 返回错误码 ENODEV
         if (!ioctl_table[MAJOR(dev)]) // ioctl函数指针表中对应项为空
@@ -151,6 +151,7 @@ static int match(int len,const char * name,struct dir_entry * de)
  * name: 文件名
  * namelen: 文件名长度
  * *res_dir: 目录项结构的指针（作为结果返回）
+ * *ioerr: 有目录数据块读取失败时置 1（这时没有找到并不表示目录中没有这个文件名）
  *
  * 查找成功：返回高速缓冲区的指针，并在 *res_dir处返回“目录项结构指针”，失败：返回NULL
  *
@@ -158,8 +159,8 @@ static int match(int len,const char * name,struct dir_entry * de)
  * 注意：这个函数并不会读取目录项对应的i节点，如果需要的化必须手动读取!!!
  * 
  */
-static struct buffer_head * find_entry(struct m_inode ** dir,
-                                       const char * name, int namelen, struct dir_entry ** res_dir)
+static struct buffer_head * __find_entry(struct m_inode ** dir,
+                                         const char * name, int namelen, struct dir_entry ** res_dir, int * ioerr)
 {
         int entries;
         int block,i;
@@ -167,6 +168,7 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
         struct dir_entry * de;
         struct super_block * sb;
 
+        *ioerr = 0;
         // 文件名是否要截短
 #ifdef NO_TRUNCATE
         if (namelen > NAME_LEN) // 不需要截短，而且文件名长度 > NAME_LEN，直接返回 NULL 
@@ -206,8 +208,10 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
         if (!(block = (*dir)->i_zone[0])) // 第一个逻辑块号为0，该目录不包含任何数据,直接返回 NULL
                 return NULL; 
         // 读取”目录i节点“对应的“数据区”中“第一个逻辑块”信息到高速缓冲区
-        if (!(bh = bread((*dir)->i_dev,block))) // 读取逻辑块失败，直接返回 NULL 
+        if (!(bh = bread((*dir)->i_dev,block))) { // 读取逻辑块失败，直接返回 NULL 
+                *ioerr = 1;
                 return NULL;
+        }
 
         // 在目录数据区查找对应文件名的目录项结构
         i = 0;
@@ -222,6 +226,8 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
                         // bmap: 根据数据块号来计算对应的逻辑块号
                         if (!(block = bmap(*dir,i/DIR_ENTRIES_PER_BLOCK)) || // 计算当前目录项的逻辑块号失败
                             !(bh = bread((*dir)->i_dev,block))) {  // 读取当前目录项的逻辑块对应的数据块到高速缓冲区失败
+                                if (block) // 逻辑块存在但是读不出来
+                                        *ioerr = 1;
                                 i += DIR_ENTRIES_PER_BLOCK; // 跳过一个数据块的目录项个数
                                 continue; // 重新开始循环
                         }
@@ -239,6 +245,14 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
         return NULL;
 }
 
+static inline struct buffer_head * find_entry(struct m_inode ** dir,
+                                              const char * name, int namelen, struct dir_entry ** res_dir)
+{
+        int ioerr;
+
+        return __find_entry(dir,name,namelen,res_dir,&ioerr);
+}
+
 /*
  *	add_entry()
  *
@@ -320,6 +334,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
                         for (i=0; i < NAME_LEN ; i++)
                                 de->name[i]=(i<namelen)?get_fs_byte(name+i):0; // 设置目录项的name域（文件名）
                         bh->b_dirt = 1; // ”缓冲块的修改标志“置位
+                        dcache_remove(dir,name,namelen); // 该文件名原来可能被缓存为“不存在”
                         *res_dir = de; // 用于返回的”目录项二级指针“ (*res_dir) 指向该目录项指针(de) 
                         return bh; // 返回缓冲块结构指针
                 }
@@ -331,6 +346,37 @@ static struct buffer_head * add_entry(struct m_inode * dir,
         return NULL;
 }
 
+/*
+ * 查找指定目录中指定文件名对应的i节点号：先查目录项缓存，没有命中再调用 find_entry 扫描目录，并把结果放入缓存
+ *
+ * *dir: 指定目录i节点的指针（'..'越过挂载点时会被替换，和 find_entry 一样）
+ * name: 文件名
+ * namelen: 文件名长度
+ *
+ * 返回：i节点号，0 表示找不到
+ * 
+ */
+static int lookup_entry(struct m_inode ** dir, const char * name, int namelen)
+{
+        struct buffer_head * bh;
+        struct dir_entry * de;
+        int inr, ioerr;
+        unsigned long seq;
+
+        if ((inr = dcache_lookup(*dir,name,namelen)) >= 0)
+                return inr;
+        seq = dcache_seq; // 扫描目录时可能睡眠：期间目录被修改过，结果就不放入缓存
+        if (!(bh = __find_entry(dir,name,namelen,&de,&ioerr))) {
+                if (!ioerr) // 目录读取完整，确实没有这个文件名：才缓存“不存在”，读盘出错时下次还要重新读目录
+                        dcache_add(*dir,name,namelen,0,seq);
+                return 0;
+        }
+        inr = de->inode;
+        brelse(bh);
+        dcache_add(*dir,name,namelen,inr,seq);
+        return inr;
+}
+
 /*
  *	get_dir()
  *
@@ -351,9 +397,7 @@ static struct m_inode * get_dir(const char * pathname)
         char c;
         const char * thisname;
         struct m_inode * inode;
-        struct buffer_head * bh;
         int namelen,inr,idev;
-        struct dir_entry * de;
 
         // 判断参数有效性
         if (!current->root || !current->root->i_count) // 当前进程的根目录i节点为空 或 当前进程的根目录i节点的引用计数为0
@@ -391,14 +435,12 @@ static struct m_inode * get_dir(const char * pathname)
                         return inode; // 返回“文件所身处的目录”对应的“i节点结构“指针
 
                 // 在inode节点中寻找thisname路径名，长度为namelen的目录项
-                // 寻找到的目录项结构指针保存在'&de'中
-                if (!(bh = find_entry(&inode,thisname,namelen,&de))) { // 无法找到路径名所对应的目录项
+                // 返回目录项中的i节点号
+                if (!(inr = lookup_entry(&inode,thisname,namelen))) { // 无法找到路径名所对应的目录项
                         iput(inode); // 放回当前i节点
                         return NULL; // 返回 NULL
                 }
-                inr = de->inode; // 取出目录项的i节点号
                 idev = inode->i_dev; // 取出当前i节点的设备号
-                brelse(bh); // 释放包含目录项的高速缓冲块
                 iput(inode); // 释放当前i节点
                 // 从找到的目录项对应的i节点号中取出i节点
                 // 注意：当前这种处理方式没有考虑支持”不同设备号“的情况，实际情况中”软链接“是可以跨越不同文件系统的！！！
@@ -468,8 +510,6 @@ struct m_inode * namei(const char * pathname)
         const char * basename;
         int inr,dev,namelen;
         struct m_inode * dir;
-        struct buffer_head * bh;
-        struct dir_entry * de;
 
         // 查找指定路径名的最末端部分的i节点指针
         if (!(dir = dir_namei(pathname,&namelen,&basename))) // 无法搜索到对应的i节点指针
@@ -477,16 +517,12 @@ struct m_inode * namei(const char * pathname)
         // 最末端部分的长度为0，则表示最末端部分就是一个目录，直接返回找到的i节点指针
         if (!namelen)			/* special case: '/usr/' etc */
                 return dir;
-        // 在”最末端目录“中寻找”指定文件名“的i节点指针
-        bh = find_entry(&dir,basename,namelen,&de); 
-        if (!bh) { // 无法找到对应的i节点指针
+        // 在”最末端目录“中寻找”指定文件名“的i节点号
+        if (!(inr = lookup_entry(&dir,basename,namelen))) { // 无法找到对应的i节点
                 iput(dir); // 释放最末端目录对应的i节点
                 return NULL; // 返回 NULL
         }
-        
-        inr = de->inode; // 获得”指定文件名“对应的”目录项“中的i节点号 
         dev = dir->i_dev; // 获得末端目录对应的设备号
-        brelse(bh); // 释放包含指定文件名对应目录项的高速缓冲块
         iput(dir); // 释放最末端目录对应的i节点
         dir=iget(dev,inr); // 从设备读取指定文件的i节点
         if (dir) { // 读取成功
@@ -546,8 +582,7 @@ int open_namei(const char * pathname, int flag, int mode,
                 return -EISDIR; // 返回 EISDIR 
         }
         // 在dir目录的所有目录项中寻找文件名为basename, 文件长度为namelen的目录项
-        bh = find_entry(&dir,basename,namelen,&de);
-        if (!bh) { // 无法找到对应的目录项
+        if (!(inr = lookup_entry(&dir,basename,namelen))) { // 无法找到对应的目录项
                 if (!(flag & O_CREAT)) { // O_CREAT 标志未置位
                         iput(dir); // 操作非法，释放对应的i节点
                         return -ENOENT; // 返回错误号 ENOENT
@@ -579,9 +614,7 @@ int open_namei(const char * pathname, int flag, int mode,
                 return 0; // 返回0,作为成功标志
         }
         // 执行到这里，说明找到路径名对应的目录项
-        inr = de->inode; // 读取目录项中的i节点号
         dev = dir->i_dev; // 读取目录项中的设备号
-        brelse(bh); // 释放包含目录i节点的缓冲块
         iput(dir); // 释放目录项的i节点
         if (flag & O_EXCL) // 文件打开标志 O_EXCL 被置位，然后文件已经存在，返回 EEXIST 表示出错
                 return -EEXIST;
@@ -709,7 +742,7 @@ int sys_mkdir(const char * pathname, int mode)
         inode->i_dirt = 1; // 置位目录i节点的修改标志
         inode->i_mtime = inode->i_atime = CURRENT_TIME; // 目录i节点“创建时间”和“被访问时间”设置为“当前时间”
         // 在设备上为目录数据申请一块新的逻辑块，申请的逻辑快号被赋值给inode->i_zone[0]
-        if (!(inode->i_zone[0]=new_block(inode->i_dev))) { // 申请新的逻辑块失败
+        if (!(inode->i_zone[0]=new_block(inode->i_dev,0))) { // 申请新的逻辑块失败
                 iput(dir); // 释放末端目录对应的i节点 
                 inode->i_nlinks--; // 递减目录i节点的硬链接计数
                 iput(inode); // 释放申请的目录i节点
@@ -898,6 +931,8 @@ int sys_rmdir(const char * name)
         de->inode = 0; // 要删除的目录项i节点号置0
         bh->b_dirt = 1; // 置位包含该目录项数据区对应的高速缓冲块的修改标志
         brelse(bh); // 释放高速缓冲块
+        dcache_remove(dir,basename,namelen); // 目录项缓存中的这一项失效
+        dcache_invalidate(inode->i_dev,inode->i_num); // 被删除目录的i节点号以后可能分配给别的目录
         inode->i_nlinks=0; // 删除目录项对应i节点的引用计数置0
         inode->i_dirt=1; // 置位删除目录项的对应i节点的修改标志
         dir->i_nlinks--; // 包含该删除目录的目录对应i节点的引用计数 - 1 
@@ -975,6 +1010,7 @@ int sys_unlink(const char * name)
         de->inode = 0; // 要删除的目录项i节点号置0
         bh->b_dirt = 1; // 置位包含该目录项数据区对应的高速缓冲块的修改标志
         brelse(bh); // 释放高速缓冲块
+        dcache_remove(dir,basename,namelen); // 目录项缓存中的这一项失效
         inode->i_nlinks--; // 递减删除文件i节点的硬链接计数
         inode->i_dirt = 1; // 置位删除文件i节点的修改标志
         inode->i_ctime = CURRENT_TIME; // 删除文件i节点的创建时间设置为当前时间
@@ -293,6 +293,8 @@ int sys_open(const char * filename,int flag,int mode)
         f->f_count = 1; // 设置文件引用计数
         f->f_inode = inode; // 设置文件对应的i节点
         f->f_pos = 0; // 设置文件的读写偏移指针
+        f->f_ra_next = f->f_ra_end = 0; // 预读状态清零
+        f->f_ra_win = 0;
         return (fd); // 返回对应文件描述符
 }
 
@@ -5,10 +5,110 @@
  */
 
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h> // 文件控制头文件：O_ACCMODE
+#include <string.h> // 字符串头文件：memcpy
+#include <sys/stat.h>
 
 #include <linux/sched.h>
 #include <linux/mm.h>	/* for get_free_page */
 #include <asm/segment.h>
+#include <asm/system.h> // 系统头文件：cli, sti
+
+#define PIPE_AUTO_ORDER 2 // 写入大块数据时，缓冲区自动增大到 16KB 为止，更大的缓冲区要用 fcntl(F_SETPIPE_SZ) 设置
+
+extern int rw_char(int rw,int dev, char * buf, int count, off_t * pos, unsigned short flags);
+extern int block_read(int dev, off_t * pos, char * buf, int count);
+extern int block_write(int dev, off_t * pos, char * buf, int count);
+extern int file_read(struct m_inode * inode, struct file * filp,
+                     char * buf, int count);
+extern int file_write(struct m_inode * inode, struct file * filp,
+                      char * buf, int count);
+
+/*
+ * 管道的锁（i节点的 i_lock）：splice 在管道缓冲区和普通文件或块设备之间直接搬运数据时可能因为读写设备而睡眠，
+ * 头尾指针要等搬运完才能移动，搬运期间锁住管道，读写进程在取头尾指针之前先等待解锁
+ * 字符设备（比如终端）的读写可能无限期地等待，splice 经过中转页面读写它们，不锁住管道
+ *
+ * 返回：0 表示管道没有被锁住，非阻塞读写时管道被锁住返回 -EAGAIN
+ */
+static inline int wait_on_pipe(struct m_inode * inode, unsigned short flags)
+{
+        if ((flags & O_NONBLOCK) && inode->i_lock)
+                return -EAGAIN;
+        cli();
+        while (inode->i_lock)
+                sleep_on(&inode->i_wait);
+        sti();
+        return 0;
+}
+
+static inline void lock_pipe(struct m_inode * inode)
+{
+        cli();
+        while (inode->i_lock)
+                sleep_on(&inode->i_wait);
+        inode->i_lock = 1;
+        sti();
+}
+
+static inline void unlock_pipe(struct m_inode * inode)
+{
+        inode->i_lock = 0;
+        wake_up(&inode->i_wait);
+}
+
+/*
+ * 把管道的缓冲区换成 2^order 页：缓冲区中的数据复制到新缓冲区的开头
+ *
+ * 返回：成功返回 0，缓冲区正在被复制或者放不下现有的数据时返回 -EBUSY，内存不够返回 -ENOMEM
+ *
+ * 不会睡眠：__get_free_pages 不换出页面，所以换缓冲区期间没有进程能访问管道
+ */
+static int pipe_resize(struct m_inode * inode, int order)
+{
+        unsigned long page, size, chars;
+
+        if (order == PIPE_ORDER(*inode))
+                return 0;
+        size = PIPE_SIZE(*inode);
+        if (PIPE_BUSY(*inode) || size >= (PAGE_SIZE << order))
+                return -EBUSY;
+        if (!(page = __get_free_pages(order)))
+                return -ENOMEM;
+        chars = PIPE_BUF_SIZE(*inode) - PIPE_TAIL(*inode); // 数据可能绕过了缓冲区末端：分两段复制
+        if (chars > size)
+                chars = size;
+        memcpy((char *) page,(char *) inode->i_size + PIPE_TAIL(*inode),chars);
+        memcpy((char *) page + chars,(char *) inode->i_size,size - chars);
+        free_pages(inode->i_size,PIPE_ORDER(*inode));
+        inode->i_size = page;
+        PIPE_ORDER(*inode) = order;
+        PIPE_TAIL(*inode) = 0;
+        PIPE_HEAD(*inode) = size;
+        wake_up_queue(&inode->i_wwait); // 缓冲区变大了：唤醒等待空间的写进程
+        return 0;
+}
+
+/**
+ * 设置管道缓冲区的大小：fcntl(F_SETPIPE_SZ)
+ *
+ * inode: 管道对应的i节点
+ * size: 需要的字节数，向上取整为 2 的幂个页面，最大 2^PIPE_MAX_ORDER 页
+ *
+ * 返回：成功返回新的缓冲区大小，失败返回错误号
+ */
+int pipe_set_size(struct m_inode * inode, unsigned long size)
+{
+        int order = 0, error;
+
+        while ((PAGE_SIZE << order) < size)
+                if (++order > PIPE_MAX_ORDER)
+                        return -EINVAL;
+        if ((error = pipe_resize(inode,order)))
+                return error;
+        return PIPE_BUF_SIZE(*inode);
+}
 
 /**
  * 管道读操作函数
@@ -16,27 +116,34 @@
  * inode: 管道对应的i节点
  * buf: 用户空间数据缓冲区指针
  * count: 要读取的字节数
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时管道空了不睡眠
  *
- * 返回：读取的总字节数，0表示失败
+ * 返回：读取的总字节数，0表示失败；非阻塞读时管道为空（还有写进程）返回 -EAGAIN
  * 
  */
-int read_pipe(struct m_inode * inode, char * buf, int count)
+int read_pipe(struct m_inode * inode, char * buf, int count, unsigned short flags)
 {
-        int chars, size, read = 0;
+        int chars, size, read = 0, slept = 0, error;
 
         // 如果要读取的字节数 > 0, 执行下列循环
         while (count>0) {
-                // 计算管道可用数据的大小
-                while (!(size=PIPE_SIZE(*inode))) { // 管道中可用数据的大小 == 0 ： 管道为空
-                        wake_up(&inode->i_wait); // 唤醒“写管道”的进程(inode->i_wait)
+                // 计算管道可用数据的大小（splice 正在搬运时等它搬完）
+                while ((error = wait_on_pipe(inode,flags)) || !(size=PIPE_SIZE(*inode))) { // 管道中可用数据的大小 == 0 ： 管道为空
+                        if (error) // 非阻塞读并且管道被锁住
+                                return read?read:error;
+                        wake_up_queue(&inode->i_wwait); // 唤醒一个“写管道”的进程(inode->i_wwait)
                         // 如果已经没有写管道的进程：i节点的引用计数 != 2 
                         if (inode->i_count != 2) /* are there any writers? */
                                 return read; // 返回读取到的字节数
+                        if (flags & O_NONBLOCK) // 非阻塞读：返回已经读到的字节数
+                                return read?read:-EAGAIN;
+                        if (slept++) // 被唤醒时的数据已经被别的读进程读走了
+                                wait_stats.spurious++;
                         // 这里没有考虑到信号，后面版本对此进行了修改！！！
-                        sleep_on(&inode->i_wait); // 让当前进程在管道的i节点的等待队列休眠（不可中断），等待管道被写入字节
+                        sleep_on_queue_exclusive(&inode->i_rwait); // 让当前进程在管道的读等待队列休眠（不可中断），等待管道被写入字节
                 }
                 // 运行到这里，说明管道中有字节可读
-                chars = PAGE_SIZE-PIPE_TAIL(*inode); // 计算“管道尾指针”到“缓冲区末端”的字节数
+                chars = PIPE_BUF_SIZE(*inode)-PIPE_TAIL(*inode); // 计算“管道尾指针”到“缓冲区末端”的字节数
                 if (chars > count) // 如果 chars > 要读的字节数
                         chars = count; // chars = 要读的字节数
                 if (chars > size) // 如果 chars > 管道当前可读的字节数 
@@ -46,13 +153,18 @@ int read_pipe(struct m_inode * inode, char * buf, int count)
                 size = PIPE_TAIL(*inode); // 令size指向当前管道尾指针处（也就是将要开始读取的地方）
                 // 调整i节点的管道尾指针（读取管道用）：i_zone[1] 加上 chars个字节，然后取余
                 PIPE_TAIL(*inode) += chars; 
-                PIPE_TAIL(*inode) &= (PAGE_SIZE-1);
-                // 从管道的 inode->i_size[size]处开始 一个字节一个字节地 复制到“用户缓冲区”，总共拷贝chars个字节
-                while (chars-->0)
-                        put_fs_byte(((char *)inode->i_size)[size++],buf++); // size, buf 自增
+                PIPE_TAIL(*inode) &= (PIPE_BUF_SIZE(*inode)-1);
+                // 从管道的 inode->i_size[size]处开始复制到“用户缓冲区”，总共拷贝chars个字节
+                // 复制时可能因为缺页而睡眠：期间不能更换缓冲区
+                PIPE_BUSY(*inode)++;
+                memcpy_tofs(buf,(char *)inode->i_size+size,chars);
+                PIPE_BUSY(*inode)--;
+                buf += chars;
         }
-        // 当此次读操作完成后，唤醒写管道的进程
-        wake_up(&inode->i_wait);
+        // 当此次读操作完成后，唤醒一个写管道的进程，管道中还有数据时再唤醒一个读进程
+        wake_up_queue(&inode->i_wwait);
+        if (PIPE_SIZE(*inode))
+                wake_up_queue(&inode->i_rwait);
         return read; // 返回当前已经读取的总字节数
 }
 
@@ -62,28 +174,40 @@ int read_pipe(struct m_inode * inode, char * buf, int count)
  * inode: 管道对应的i节点
  * buf: 用户空间数据缓冲区指针
  * count: 要写入的字节数
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时管道满了不睡眠
  *
- * 返回：写入的总字节数，-1 表示失败
+ * 返回：写入的总字节数，-1 表示失败；非阻塞写时管道已满返回 -EAGAIN
  * 
  */
-int write_pipe(struct m_inode * inode, char * buf, int count)
+int write_pipe(struct m_inode * inode, char * buf, int count, unsigned short flags)
 {
-        int chars, size, written = 0;
+        int chars, size, written = 0, slept = 0, error;
 
 // 如果要写入的字节数 > 0, 执行下列循环
         while (count>0) {
-                // 计算管道空闲空间
-                while (!(size=(PAGE_SIZE-1)-PIPE_SIZE(*inode))) { // 空闲空间 == 0 : 管道已满
-                        wake_up(&inode->i_wait); // 唤醒读取管道的进程
+                // 计算管道空闲空间（splice 正在搬运时等它搬完）
+                while ((error = wait_on_pipe(inode,flags)) || !(size=(PIPE_BUF_SIZE(*inode)-1)-PIPE_SIZE(*inode))) { // 空闲空间 == 0 : 管道已满
+                        if (error) // 非阻塞写并且管道被锁住
+                                return written?written:error;
+                        // 一次写入的数据比缓冲区还大：增大缓冲区（失败就照旧等待读进程）
+                        if (written + count >= PIPE_BUF_SIZE(*inode) &&
+                            PIPE_ORDER(*inode) < PIPE_AUTO_ORDER &&
+                            !pipe_resize(inode,PIPE_ORDER(*inode)+1))
+                                continue;
+                        wake_up_queue(&inode->i_rwait); // 唤醒一个读取管道的进程
                         // 如果管道i节点的引用计数 != 2 : 没有读取进程
                         if (inode->i_count != 2) { /* no readers */
                                 current->signal |= (1<<(SIGPIPE-1)); // 向当前进程发送 SIGPIPE 信号
                                 return written?written:-1; // 返回已经写入的字节数，如果没有写入任何字节，返回 -1 表示失败
                         }
-                        sleep_on(&inode->i_wait); // 当前进程进入休眠（不可中断），等待“读取管道的进程”从管道读取数据
+                        if (flags & O_NONBLOCK) // 非阻塞写：返回已经写入的字节数
+                                return written?written:-EAGAIN;
+                        if (slept++) // 被唤醒时的空间已经被别的写进程占用了
+                                wait_stats.spurious++;
+                        sleep_on_queue_exclusive(&inode->i_wwait); // 当前进程进入休眠（不可中断），等待“读取管道的进程”从管道读取数据
                 }
                 // 运行到这里，说明管道中有字节可写
-                chars = PAGE_SIZE-PIPE_HEAD(*inode); // 计算管道头指针到管道末端的字节数
+                chars = PIPE_BUF_SIZE(*inode)-PIPE_HEAD(*inode); // 计算管道头指针到管道末端的字节数
                 if (chars > count) // 如果 chars > 要写的字节数
                         chars = count; //  chars = 要写的字节数
                 if (chars > size) // 如果 chars > 管道当前可写的字节数
@@ -93,13 +217,17 @@ int write_pipe(struct m_inode * inode, char * buf, int count)
                 size = PIPE_HEAD(*inode); // 令size指向当前管道头指针处（也就是将要开始写入的地方）
                 // 调整i节点的管道头指针（写入管道用）：i_zone[0] 加上 chars个字节，然后取余
                 PIPE_HEAD(*inode) += chars;
-                PIPE_HEAD(*inode) &= (PAGE_SIZE-1);
-                // 从“用户缓冲区”一个字节一个字节地复制到管道的 inode->i_size[size]处，总共复制 chars 个字节
-                while (chars-->0)
-                        ((char *)inode->i_size)[size++]=get_fs_byte(buf++); // size, buf 自增
+                PIPE_HEAD(*inode) &= (PIPE_BUF_SIZE(*inode)-1);
+                // 从“用户缓冲区”复制到管道的 inode->i_size[size]处，总共复制 chars 个字节
+                PIPE_BUSY(*inode)++;
+                memcpy_fromfs((char *)inode->i_size+size,buf,chars);
+                PIPE_BUSY(*inode)--;
+                buf += chars;
         }
-        // 当此次写操作完成后，唤醒读管道的进程
-        wake_up(&inode->i_wait);
+        // 当此次写操作完成后，唤醒一个读管道的进程，管道中还有空间时再唤醒一个写进程
+        wake_up_queue(&inode->i_rwait);
+        if ((PIPE_BUF_SIZE(*inode)-1)-PIPE_SIZE(*inode))
+                wake_up_queue(&inode->i_wwait);
         return written; // 返回当前已经写入的总字节数
 }
 
@@ -168,3 +296,238 @@ int sys_pipe(unsigned long * fildes)
         
         return 0;
 }
+
+/**
+ * 检查管道是否可读，可写（由 select 调用）
+ *
+ * inode: 管道对应的i节点
+ * file: 管道的一端，读端只能可读，写端只能可写
+ * flag: SEL_IN, SEL_OUT 或 SEL_EX
+ * wait: 没有就绪时把当前进程挂到管道的读或写等待队列上，NULL 表示只检查
+ *
+ * 返回：就绪返回 1，否则返回 0
+ *
+ * 另一端已经关闭时也算就绪：read 会返回 0，write 会得到 SIGPIPE
+ */
+int pipe_select(struct m_inode * inode, struct file * file, int flag, select_table * wait)
+{
+        switch (flag) {
+                case SEL_IN:
+                        if (!(file->f_mode & 1))
+                                return 0;
+                        if (PIPE_SIZE(*inode) || inode->i_count != 2)
+                                return 1;
+                        select_wait(&inode->i_rwait,wait);
+                        return 0;
+                case SEL_OUT:
+                        if (!(file->f_mode & 2))
+                                return 0;
+                        if (!PIPE_FULL(*inode) || inode->i_count != 2)
+                                return 1;
+                        select_wait(&inode->i_wwait,wait);
+                        return 0;
+        }
+        return 0;
+}
+
+/*
+ * 以内核缓冲区 buf 读写文件 file（普通文件，块设备或字符设备），由 sys_splice 调用
+ *
+ * 返回：读写的字节数，失败返回错误号
+ *
+ * 各种读写函数都通过 fs 段访问“用户缓冲区”：让 fs 指向内核数据段，数据就直接在管道缓冲区和高速缓冲区之间复制
+ */
+static int splice_rw(int rw, struct file * file, char * buf, int count)
+{
+        struct m_inode * inode = file->f_inode;
+        unsigned long old_fs = get_fs();
+        int ret = -EINVAL;
+
+        set_fs(get_ds());
+        if (S_ISCHR(inode->i_mode))
+                ret = rw_char(rw,inode->i_zone[0],buf,count,&file->f_pos,file->f_flags);
+        else if (S_ISBLK(inode->i_mode))
+                ret = (rw == READ) ? block_read(inode->i_zone[0],&file->f_pos,buf,count) :
+                        block_write(inode->i_zone[0],&file->f_pos,buf,count);
+        else if (S_ISREG(inode->i_mode)) {
+                if (rw == WRITE)
+                        ret = file_write(inode,file,buf,count);
+                else if (count > inode->i_size - file->f_pos)
+                        count = inode->i_size - file->f_pos;
+                if (rw == READ)
+                        ret = (count > 0) ? file_read(inode,file,buf,count) : 0;
+        }
+        set_fs(old_fs);
+        return ret;
+}
+
+/*
+ * 从管道 inode 中取出最多 len 字节写到文件 file 中
+ *
+ * 管道为空时等待写进程，已经搬运了数据，或者写端已经关闭时返回
+ * 每一段数据在锁住管道的情况下写到文件中，写完才移动尾指针：其他读进程不会再读到这段数据，写进程也不会覆盖它
+ * 字符设备的写可能无限期地等待：先把数据取到中转页面，解锁以后再写（没有写完的部分丢失，和 read 以后再 write 一样）
+ */
+static int splice_from_pipe(struct m_inode * inode, struct file * file, int len)
+{
+        int chars, size, ret, moved = 0, slept = 0;
+        unsigned long bounce = 0;
+
+        if (S_ISCHR(file->f_inode->i_mode) && !(bounce = get_free_page()))
+                return -ENOMEM;
+        while (len > 0) {
+                lock_pipe(inode);
+                if (!(size = PIPE_SIZE(*inode))) {
+                        unlock_pipe(inode);
+                        if (moved || inode->i_count != 2)
+                                goto out;
+                        if (slept++)
+                                wait_stats.spurious++;
+                        sleep_on_queue_exclusive(&inode->i_rwait);
+                        continue;
+                }
+                chars = PIPE_BUF_SIZE(*inode) - PIPE_TAIL(*inode);
+                if (chars > size)
+                        chars = size;
+                if (chars > len)
+                        chars = len;
+                if (bounce) {
+                        if (chars > PAGE_SIZE)
+                                chars = PAGE_SIZE;
+                        memcpy((char *) bounce,(char *) inode->i_size + PIPE_TAIL(*inode),chars);
+                        PIPE_TAIL(*inode) = (PIPE_TAIL(*inode) + chars) & (PIPE_BUF_SIZE(*inode) - 1);
+                        unlock_pipe(inode);
+                        ret = splice_rw(WRITE,file,(char *) bounce,chars);
+                } else {
+                        PIPE_BUSY(*inode)++;
+                        ret = splice_rw(WRITE,file,(char *) inode->i_size + PIPE_TAIL(*inode),chars);
+                        PIPE_BUSY(*inode)--;
+                        if (ret > 0)
+                                PIPE_TAIL(*inode) = (PIPE_TAIL(*inode) + ret) & (PIPE_BUF_SIZE(*inode) - 1);
+                        unlock_pipe(inode);
+                }
+                if (ret <= 0) {
+                        if (!moved)
+                                moved = ret;
+                        break;
+                }
+                wake_up_queue(&inode->i_wwait);
+                moved += ret;
+                len -= ret;
+        }
+out:
+        if (bounce) {
+                free_page(bounce);
+                wake_up_queue(&inode->i_wwait); // 出错时已经取出的数据也腾出了空间
+        }
+        if (PIPE_SIZE(*inode))
+                wake_up_queue(&inode->i_rwait);
+        return moved;
+}
+
+/*
+ * 从字符设备 file 中读出最多 len 字节放进管道 inode 中
+ *
+ * 字符设备的读可能无限期地等待（比如终端等待输入）：先读到中转页面中，不锁住管道，再像 write 一样写进管道
+ * 和 read 一样只读一次，不等到读满 len 字节
+ */
+static int splice_chr_to_pipe(struct m_inode * inode, struct file * file, int len)
+{
+        unsigned long bounce, old_fs;
+        int ret, moved = 0;
+
+        if (!(bounce = get_free_page()))
+                return -ENOMEM;
+        if (len > PAGE_SIZE)
+                len = PAGE_SIZE;
+        if ((ret = splice_rw(READ,file,(char *) bounce,len)) > 0) {
+                old_fs = get_fs();
+                set_fs(get_ds()); // write_pipe 从 fs 段复制：中转页面在内核数据段中
+                moved = write_pipe(inode,(char *) bounce,ret,0);
+                set_fs(old_fs);
+                if (moved < 0) // 没有读进程（write_pipe 已经发送了 SIGPIPE）
+                        moved = -EPIPE;
+        }
+        free_page(bounce);
+        return (ret > 0) ? moved : ret;
+}
+
+/*
+ * 从文件 file 中读出最多 len 字节放进管道 inode 中
+ *
+ * 管道满时等待读进程，文件读完时返回
+ * 每一段数据在锁住管道的情况下从文件读入，读完才移动头指针：读进程不会看到还没有读入的数据，写进程也不会写到同一段空间
+ */
+static int splice_to_pipe(struct m_inode * inode, struct file * file, int len)
+{
+        int chars, size, ret = 0, moved = 0, slept = 0;
+
+        if (S_ISCHR(file->f_inode->i_mode))
+                return splice_chr_to_pipe(inode,file,len);
+        while (len > 0) {
+                lock_pipe(inode);
+                if (!(size = (PIPE_BUF_SIZE(*inode) - 1) - PIPE_SIZE(*inode))) {
+                        unlock_pipe(inode);
+                        if (inode->i_count != 2) { /* no readers */
+                                current->signal |= (1<<(SIGPIPE-1));
+                                return moved ? moved : -EPIPE;
+                        }
+                        if (slept++)
+                                wait_stats.spurious++;
+                        sleep_on_queue_exclusive(&inode->i_wwait);
+                        continue;
+                }
+                chars = PIPE_BUF_SIZE(*inode) - PIPE_HEAD(*inode);
+                if (chars > size)
+                        chars = size;
+                if (chars > len)
+                        chars = len;
+                PIPE_BUSY(*inode)++;
+                ret = splice_rw(READ,file,(char *) inode->i_size + PIPE_HEAD(*inode),chars);
+                PIPE_BUSY(*inode)--;
+                if (ret > 0)
+                        PIPE_HEAD(*inode) = (PIPE_HEAD(*inode) + ret) & (PIPE_BUF_SIZE(*inode) - 1);
+                unlock_pipe(inode);
+                if (ret <= 0) // 文件结束或者出错
+                        break;
+                wake_up_queue(&inode->i_rwait);
+                moved += ret;
+                len -= ret;
+        }
+        if ((PIPE_BUF_SIZE(*inode) - 1) - PIPE_SIZE(*inode))
+                wake_up_queue(&inode->i_wwait);
+        return moved ? moved : ret;
+}
+
+/**
+ * 在管道和文件之间直接搬运数据（系统调用），数据不经过用户空间
+ *
+ * fd_in: 读的文件描述符
+ * fd_out: 写的文件描述符
+ * len: 最多搬运的字节数
+ *
+ * 返回：搬运的字节数，0 表示管道的写端已经关闭或者文件已经读完，失败返回错误号
+ *
+ * fd_in 和 fd_out 中必须正好有一个是管道，另一个是普通文件，块设备或者字符设备，从文件当前的读写位置开始读写
+ * 例如 cat 可以不断地 splice(0,1,len) 把管道中的数据写到文件中，每个字节只复制一次
+ */
+int sys_splice(unsigned int fd_in, unsigned int fd_out, int len)
+{
+        struct file * in, * out;
+
+        if (fd_in >= NR_OPEN || !(in = current->filp[fd_in]) ||
+            fd_out >= NR_OPEN || !(out = current->filp[fd_out]))
+                return -EBADF;
+        if (len <= 0)
+                return len ? -EINVAL : 0;
+        if (in->f_inode->i_pipe == out->f_inode->i_pipe) // 两端都是管道，或者都不是
+                return -EINVAL;
+        if (in->f_inode->i_pipe) {
+                if (!(in->f_mode & 1) || (out->f_flags & O_ACCMODE) == O_RDONLY)
+                        return -EBADF;
+                return splice_from_pipe(in->f_inode,out,len);
+        }
+        if (!(out->f_mode & 2) || (in->f_flags & O_ACCMODE) == O_WRONLY)
+                return -EBADF;
+        return splice_to_pipe(out->f_inode,in,len);
+}
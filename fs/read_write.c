@@ -12,9 +12,9 @@
 #include <linux/sched.h>
 #include <asm/segment.h>
 
-extern int rw_char(int rw,int dev, char * buf, int count, off_t * pos);
-extern int read_pipe(struct m_inode * inode, char * buf, int count);
-extern int write_pipe(struct m_inode * inode, char * buf, int count);
+extern int rw_char(int rw,int dev, char * buf, int count, off_t * pos, unsigned short flags);
+extern int read_pipe(struct m_inode * inode, char * buf, int count, unsigned short flags);
+extern int write_pipe(struct m_inode * inode, char * buf, int count, unsigned short flags);
 extern int block_read(int dev, off_t * pos, char * buf, int count);
 extern int block_write(int dev, off_t * pos, char * buf, int count);
 extern int file_read(struct m_inode * inode, struct file * filp,
@@ -100,9 +100,9 @@ int sys_read(unsigned int fd,char * buf,int count)
 
         // 根据i节点的属性，调用不同的读取实现函数
         if (inode->i_pipe) // i节点是管道
-                return (file->f_mode & 1)?read_pipe(inode,buf,count):-EIO; // 如果管道i节点是“读模式”，则调用read_pipe，否则返回错误码：EIO 
+                return (file->f_mode & 1)?read_pipe(inode,buf,count,file->f_flags):-EIO; // 如果管道i节点是“读模式”，则调用read_pipe，否则返回错误码：EIO 
         if (S_ISCHR(inode->i_mode)) // 字符文件
-                return rw_char(READ,inode->i_zone[0],buf,count,&file->f_pos); // 调用字符设备读接口，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
+                return rw_char(READ,inode->i_zone[0],buf,count,&file->f_pos,file->f_flags); // 调用字符设备读接口，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
         if (S_ISBLK(inode->i_mode)) // 块设备
                 return block_read(inode->i_zone[0],&file->f_pos,buf,count);// 调用块设备读函数，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
         if (S_ISDIR(inode->i_mode) || S_ISREG(inode->i_mode)) { // 目录文件 或者 普通文件
@@ -143,9 +143,9 @@ int sys_write(unsigned int fd,char * buf,int count)
 
         // 根据i节点的属性，调用不同的写入实现函数
         if (inode->i_pipe) // 管道文件
-                return (file->f_mode & 2) ? write_pipe(inode,buf,count):-EIO; // 如果管道i节点是“写模式”，则调用write_pipe，否则返回错误码：EIO 
+                return (file->f_mode & 2) ? write_pipe(inode,buf,count,file->f_flags):-EIO; // 如果管道i节点是“写模式”，则调用write_pipe，否则返回错误码：EIO 
         if (S_ISCHR(inode->i_mode)) // 字符设备
-                return rw_char(WRITE,inode->i_zone[0],buf,count,&file->f_pos); // 调用字符设备写接口，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
+                return rw_char(WRITE,inode->i_zone[0],buf,count,&file->f_pos,file->f_flags); // 调用字符设备写接口，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
         if (S_ISBLK(inode->i_mode)) // 块设备
                 return block_write(inode->i_zone[0],&file->f_pos,buf,count); // 调用块设备写函数，其中 inode->i_zone[0] 作为 dev（设备号）参数传递
         if (S_ISREG(inode->i_mode)) // 普通文件
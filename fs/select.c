@@ -0,0 +1,213 @@
+/*
+ *  linux/fs/select.c
+ */
+
+/*
+ * select 系统调用：一个进程同时等待多个文件描述符变为可读或可写，不用每个描述符开一个进程，也不用轮询
+ *
+ * 每个文件描述符的就绪检查按文件类型分派（和 sys_read, sys_write 一样看i节点的类型）：
+ * 管道由 pipe_select (fs/pipe.c)，终端由 tty_select (kernel/chr_drv/tty_io.c) 检查，
+ * 普通文件，块设备和其他字符设备的读写不会无限期地阻塞，总是就绪
+ *
+ * 检查函数在没有就绪时用 select_wait 把当前进程挂到对应的等待队列上（管道的 i_rwait/i_wwait，终端队列的 proc_list）
+ * 第一轮检查都没有就绪时睡眠，任何一个队列上的唤醒，超时或者信号都会让进程重新检查一遍
+ */
+
+#include <errno.h> // 错误号头文件
+#include <signal.h>
+#include <sys/stat.h> // 文件状态头文件：S_ISCHR
+#include <sys/time.h> // 时间头文件：struct timeval, fd_set
+
+#include <linux/sched.h> // 调度程序头文件
+#include <linux/kernel.h> // 内核常用函数头文件：verify_area
+#include <linux/mm.h> // 内存管理头文件：get_free_page
+#include <asm/segment.h> // 段操作头文件：get_fs_long, put_fs_long
+
+#define MAX_SELECT_WAIT (PAGE_SIZE / sizeof (struct select_table_entry)) // 一页能放下的登记项数
+
+#define _S(nr) (1<<((nr)-1))
+#define _BLOCKABLE (~(_S(SIGKILL) | _S(SIGSTOP)))
+
+extern int pipe_select(struct m_inode * inode, struct file * file, int flag, select_table * wait);
+extern int tty_select(unsigned channel, int flag, select_table * wait);
+
+/**
+ * 把当前进程登记到等待队列 q 上（共享等待），select 返回时由 free_wait 取下
+ *
+ * p 为 NULL 时什么也不做：已经有描述符就绪，或者已经是重新检查，不需要再登记
+ */
+void select_wait(struct wait_queue ** q, select_table * p)
+{
+        struct select_table_entry * entry;
+
+        if (!p || !q || p->nr >= MAX_SELECT_WAIT)
+                return;
+        entry = p->entry + p->nr;
+        entry->wait_address = q;
+        entry->wait.task = current;
+        entry->wait.exclusive = 0;
+        add_wait_queue(q,&entry->wait);
+        p->nr++;
+}
+
+/*
+ * 从所有登记过的等待队列上取下当前进程
+ */
+static void free_wait(select_table * p)
+{
+        struct select_table_entry * entry = p->entry + p->nr;
+
+        while (p->nr > 0) {
+                p->nr--;
+                entry--;
+                remove_wait_queue(entry->wait_address,&entry->wait);
+        }
+}
+
+/*
+ * 检查文件 file 是否就绪
+ *
+ * 返回：就绪返回 1，否则返回 0
+ */
+static int check(int flag, struct file * file, select_table * wait)
+{
+        struct m_inode * inode = file->f_inode;
+        int dev;
+
+        if (inode->i_pipe)
+                return pipe_select(inode,file,flag,wait);
+        if (S_ISCHR(inode->i_mode)) {
+                dev = inode->i_zone[0];
+                if (MAJOR(dev) == 4) // /dev/ttyx
+                        return tty_select(MINOR(dev),flag,wait);
+                if (MAJOR(dev) == 5 && current->tty >= 0) // /dev/tty：当前进程的控制终端
+                        return tty_select(current->tty,flag,wait);
+        }
+        return flag != SEL_EX;
+}
+
+/*
+ * 超时定时器到期：唤醒还在 select 中睡眠的任务
+ */
+static void select_timeout(unsigned long data)
+{
+        struct task_struct * p = (struct task_struct *) data;
+
+        if (p->state == TASK_INTERRUPTIBLE)
+                wake_up_process(p);
+}
+
+/**
+ * 等待多个文件描述符就绪（系统调用）
+ *
+ * buffer: 用户空间中 5 个长字参数的数组：n, readfds, writefds, exceptfds, timeout
+ * （系统调用最多只能通过寄存器传递 3 个参数）
+ *
+ * 返回：就绪的描述符个数，超时返回 0，失败返回错误号，被信号打断并且没有描述符就绪时返回 -EINTR
+ *
+ * 返回时三个集合中只留下就绪的描述符，timeout 改为剩余的时间；timeout 为 NULL 时无限期等待，为 0 时只检查不等待
+ */
+int sys_select(unsigned long * buffer)
+{
+        int n, i, count, timed = 0;
+        fd_set * inp, * outp, * exp;
+        struct timeval * tvp;
+        fd_set in = 0, out = 0, ex = 0, res_in, res_out, res_ex;
+        unsigned long timeout = 0, left = 0;
+        struct timer_list timer;
+        select_table wait_table, * wait;
+        struct file * file;
+
+        n = get_fs_long(buffer);
+        inp = (fd_set *) get_fs_long(buffer+1);
+        outp = (fd_set *) get_fs_long(buffer+2);
+        exp = (fd_set *) get_fs_long(buffer+3);
+        tvp = (struct timeval *) get_fs_long(buffer+4);
+        if (n < 0)
+                return -EINVAL;
+        if (n > NR_OPEN)
+                n = NR_OPEN;
+        // 先检查用户空间的写权限：睡眠以后再写，不能在写的时候才发现是写时复制的页面
+        if (inp) {
+                verify_area(inp,sizeof (fd_set));
+                in = get_fs_long(inp) & ((1UL << n) - 1);
+        }
+        if (outp) {
+                verify_area(outp,sizeof (fd_set));
+                out = get_fs_long(outp) & ((1UL << n) - 1);
+        }
+        if (exp) {
+                verify_area(exp,sizeof (fd_set));
+                ex = get_fs_long(exp) & ((1UL << n) - 1);
+        }
+        for (i = 0 ; i < n ; i++)
+                if (((in | out | ex) >> i) & 1)
+                        if (!(file = current->filp[i]) || !file->f_inode)
+                                return -EBADF;
+        if (tvp) {
+                verify_area(tvp,sizeof (struct timeval));
+                timeout = get_fs_long((unsigned long *) &tvp->tv_sec) * HZ +
+                        (get_fs_long((unsigned long *) &tvp->tv_usec) + 1000000/HZ - 1) / (1000000/HZ);
+                timed = 1;
+        }
+        if (!(wait_table.entry = (struct select_table_entry *) get_free_page()))
+                return -ENOMEM;
+        wait_table.nr = 0;
+        init_timer(&timer);
+        if (timed && timeout) {
+                timer.fn = select_timeout;
+                timer.data = (unsigned long) current;
+                mod_timer(&timer,jiffies + timeout);
+        }
+        wait = &wait_table;
+repeat:
+        // 先设置状态再检查：检查以后到 schedule 之间的唤醒只是把状态改回 TASK_RUNNING，不会丢失
+        current->state = TASK_INTERRUPTIBLE;
+        res_in = res_out = res_ex = 0;
+        count = 0;
+        for (i = 0 ; i < n ; i++) {
+                file = current->filp[i];
+                if (((in >> i) & 1) && check(SEL_IN,file,wait)) {
+                        res_in |= 1UL << i;
+                        count++;
+                        wait = NULL;
+                }
+                if (((out >> i) & 1) && check(SEL_OUT,file,wait)) {
+                        res_out |= 1UL << i;
+                        count++;
+                        wait = NULL;
+                }
+                if (((ex >> i) & 1) && check(SEL_EX,file,wait)) {
+                        res_ex |= 1UL << i;
+                        count++;
+                        wait = NULL;
+                }
+        }
+        wait = NULL; // 已经登记过了，重新检查时不再登记
+        if (!count && !(current->signal & ~(_BLOCKABLE & current->blocked)) &&
+            !(timed && (!timeout || !timer.pprev))) {
+                schedule();
+                goto repeat;
+        }
+        current->state = TASK_RUNNING;
+        free_wait(&wait_table);
+        free_page((unsigned long) wait_table.entry);
+        if (timed && timeout) {
+                if (timer.pprev && (long) (timer.expires - jiffies) > 0)
+                        left = timer.expires - jiffies;
+                del_timer(&timer);
+        }
+        if (tvp) {
+                put_fs_long(left / HZ,(unsigned long *) &tvp->tv_sec);
+                put_fs_long((left % HZ) * (1000000/HZ),(unsigned long *) &tvp->tv_usec);
+        }
+        if (!count && (current->signal & ~(_BLOCKABLE & current->blocked)))
+                return -EINTR;
+        if (inp)
+                put_fs_long(res_in,inp);
+        if (outp)
+                put_fs_long(res_out,outp);
+        if (exp)
+                put_fs_long(res_ex,exp);
+        return count;
+}
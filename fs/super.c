@@ -135,6 +135,8 @@ void put_super(int dev)
         /* struct m_inode * inode;*/
         int i;
         
+        dcache_invalidate(dev,0); // 卸载或者更换了软盘：这个设备的目录项缓存全部失效
+        invalidate_dev_pages(dev); // 页缓存中这个设备的页面也全部失效：以后设备可能被重写，i节点号会被重新使用
         if (dev == ROOT_DEV) { // 根节点设备的超级块无法释放，打印出错信息，退出函数
                 printk("root diskette changed: prepare for armageddon\n\r");
                 return;
@@ -250,6 +252,7 @@ static struct super_block * read_super(int dev)
         // 按照约定：“i节点位图”和“逻辑块位图”中的最低位总是设为1（对应的i节点和逻辑块是无法被使用的，根目录的i节点/引导块）
         s->s_imap[0]->b_data[0] |= 1;
         s->s_zmap[0]->b_data[0] |= 1;
+        count_free_bits(s); // 统计每块位图中的空闲位数，复位分配起点
         free_super(s); // 解锁超级块
         return s; // 返回超级块指针
 }
@@ -88,6 +88,8 @@ void truncate(struct m_inode * inode)
         // 只有常规文件或目录文件，才可以被截断为0
         if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
                 return; // 非常规文件和目录文件，直接返回
+        discard_prealloc(inode); // 先释放预分配窗口
+        invalidate_file_pages(inode,-1); // 页缓存中这个文件的页面全部失效
 
         // 遍历这个 i节点中的直接块号数组：i_zone[0] ~ i_zone[6]
         for (i=0;i<7;i++) {
@@ -59,6 +59,59 @@ static inline void put_fs_long(unsigned long val,unsigned long * addr)
 __asm__ ("movl %0,%%fs:%1"::"r" (val),"m" (*addr));
 }
 
+/**
+ * 从内核空间 from 处复制 n 个字节到 fs段 的 to 处（用户空间）
+ *
+ * to: fs段中的目的地址
+ * from: 内核数据段中的源地址
+ * n: 字节数
+ *
+ * 无返回值
+ *
+ * 先用 rep movsl 按长字（4字节）复制，再用 rep movsb 复制剩下的不到 4 个字节
+ * movs 指令的目的操作数固定使用 es段，所以临时把 fs 的值装入 es，结束后恢复
+ */
+static inline void memcpy_tofs(void * to, const void * from, unsigned long n)
+{
+	int d0, d1, d2;
+
+	__asm__ __volatile__ ("push %%es\n\t"
+			      "push %%fs\n\t"
+			      "pop %%es\n\t"
+			      "cld\n\t"
+			      "rep ; movsl\n\t"
+			      "movl %3,%%ecx\n\t"
+			      "rep ; movsb\n\t"
+			      "pop %%es"
+			      :"=&c" (d0),"=&D" (d1),"=&S" (d2)
+			      :"r" (n & 3),"0" (n >> 2),"1" (to),"2" (from)
+			      :"memory");
+}
+
+/**
+ * 从 fs段 的 from 处（用户空间）复制 n 个字节到内核空间 to 处
+ *
+ * to: 内核数据段中的目的地址
+ * from: fs段中的源地址
+ * n: 字节数
+ *
+ * 无返回值
+ *
+ * movs 指令的源操作数可以使用段超越前缀，这里用 fs 前缀代替默认的 ds段
+ */
+static inline void memcpy_fromfs(void * to, const void * from, unsigned long n)
+{
+	int d0, d1, d2;
+
+	__asm__ __volatile__ ("cld\n\t"
+			      "rep ; fs ; movsl\n\t"
+			      "movl %3,%%ecx\n\t"
+			      "rep ; fs ; movsb"
+			      :"=&c" (d0),"=&D" (d1),"=&S" (d2)
+			      :"r" (n & 3),"0" (n >> 2),"1" (to),"2" (from)
+			      :"memory");
+}
+
 /*
  * Someone who knows GNU asm better than I should double check the followig.
  * It seems to work, but I don't know if I'm doing something subtly wrong.
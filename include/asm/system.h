@@ -34,6 +34,10 @@
 #define cli() __asm__ ("cli"::) // 关中断
 #define nop() __asm__ ("nop"::) // 空操作
 
+// 保存和恢复标志寄存器 eflags：用于在可能已经关中断的上下文（比如中断处理程序）中临时关中断，结束后恢复原来的中断状态
+#define save_flags(x) __asm__ ("pushfl ; popl %0":"=r" (x)::"memory")
+#define restore_flags(x) __asm__ ("pushl %0 ; popfl"::"r" (x):"memory")
+
 #define iret() __asm__ ("iret"::) // 中断返回
 
 /**
@@ -36,6 +36,8 @@
 #define F_GETLK		5	/* not implemented */ // 返回锁定文件的flock结构
 #define F_SETLK		6 // 设置[F_RDLCK或F_WRLCK]或清除(F_UNLCK)锁定
 #define F_SETLKW	7 // 等待设置或清除锁定
+#define F_SETPIPE_SZ	1031 // 设置管道缓冲区的大小（和 Linux 的取值相同）
+#define F_GETPIPE_SZ	1032 // 取管道缓冲区的大小
 
 /* for F_[GET|SET]FL */
 /*
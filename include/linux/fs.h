@@ -43,11 +43,38 @@
 #define READA 2		/* read-ahead - don't pause */
 #define WRITEA 3	/* "write-ahead" - silly, but somewhat useful */
 
+// 块设备的 ioctl 命令
+#define BLKGETSTATS 0x1201 // 读取设备请求队列的统计信息（struct blk_stats）
+#define BLKSETDEPTH 0x1202 // 设置设备的请求队列深度
+
+// 普通文件的 ioctl 命令
+#define FIGETEXTENTS 0x1301 // 读取文件在设备上占用的区段（连续的逻辑块）个数
+
+/**
+ * 块设备请求队列的统计信息，时间的单位都是滴答
+ */
+struct blk_stats {
+        unsigned long depth; // 当前的队列深度
+        unsigned long nr_pool; // 请求项池的大小（队列深度的上限）
+        unsigned long in_flight; // 正在使用的请求项数
+        unsigned long max_in_flight; // 使用中请求项数的最大值
+        unsigned long requests[2]; // 完成的读、写请求项数
+        unsigned long merges; // 合并到已有请求项中的缓冲块数
+        unsigned long waits; // 进程因为没有空闲请求项而睡眠的次数
+        unsigned long queue_ticks; // 请求项在队列中等待的总时间
+        unsigned long service_ticks; // 请求项被驱动程序处理的总时间
+};
+
 /**
  * 高速缓存区初始化函数
  */
 void buffer_init(long buffer_end);
 
+/**
+ * 内存i节点表初始化函数
+ */
+long inode_init(long start_mem, long end_mem);
+
 // 设备号用一个字表示，高字节是主设备号，低字节是次设备号（0x32: 表示的是第二块硬盘）
 #define MAJOR(a) (((unsigned)(a))>>8) // 取高字节，主设备号
 #define MINOR(a) ((a)&0xff) // 取低字节，次设备号
@@ -60,10 +87,10 @@ void buffer_init(long buffer_end);
 #define SUPER_MAGIC 0x137F // “超级块”魔数
 
 #define NR_OPEN 20 // 进程最多打开的文件数
-#define NR_INODE 32 // 系统最多使用的i节点数
+#define NR_INODE nr_inode // 内存i节点表的项数（在 inode_init 中根据内存大小确定，至少 32 项）
 #define NR_FILE 64 // 系统最多同时打开的文件个数（文件数组项数）
 #define NR_SUPER 8 // 系统所含最多的超级块个数（超级块数组项数），这意味着系统最多支持挂载8个分区
-#define NR_HASH 307 // 缓冲区 Hash 表数组项数值
+#define NR_HASH nr_hash // 缓冲区 Hash 表数组项数值（2 的幂，在 buffer_init 中根据缓冲区大小确定）
 #define NR_BUFFERS nr_buffers // 系统所含缓冲块个数（初始化后不再改变）
 #define BLOCK_SIZE 1024 // 逻辑块长度（字节值 1024B = 1KB）  
 #define BLOCK_SIZE_BITS 10 // 数据块长度所占的比特位数 (2 ^ 10 = 1024) 
@@ -76,9 +103,13 @@ void buffer_init(long buffer_end);
         
 #define PIPE_HEAD(inode) ((inode).i_zone[0]) // 管道头指针，保存在管道i节点的i_zone[0]域
 #define PIPE_TAIL(inode) ((inode).i_zone[1]) // 管道尾指针，保存在管道i节点的i_zone[1]域
-#define PIPE_SIZE(inode) ((PIPE_HEAD(inode)-PIPE_TAIL(inode))&(PAGE_SIZE-1)) // 计算管道大小
+#define PIPE_ORDER(inode) ((inode).i_zone[2]) // 管道缓冲区是 2^order 个连续页面，保存在管道i节点的i_zone[2]域
+#define PIPE_BUSY(inode) ((inode).i_zone[3]) // 正在复制缓冲区数据（可能睡眠）的进程数，不为 0 时不能更换缓冲区
+#define PIPE_BUF_SIZE(inode) (PAGE_SIZE << PIPE_ORDER(inode)) // 管道缓冲区的大小
+#define PIPE_SIZE(inode) ((PIPE_HEAD(inode)-PIPE_TAIL(inode))&(PIPE_BUF_SIZE(inode)-1)) // 计算管道大小
 #define PIPE_EMPTY(inode) (PIPE_HEAD(inode)==PIPE_TAIL(inode)) // 判断管道是否为空空
-#define PIPE_FULL(inode) (PIPE_SIZE(inode)==(PAGE_SIZE-1)) // 判断管道是否已满
+#define PIPE_FULL(inode) (PIPE_SIZE(inode)==(PIPE_BUF_SIZE(inode)-1)) // 判断管道是否已满
+#define PIPE_MAX_ORDER 4 // 管道缓冲区最大 64KB：头尾指针保存在 unsigned short 中
 // 管道头指针递增
 #define INC_PIPE(head)                                  \
         __asm__("incl %0\n\tandl $4095,%0"::"m" (head))
@@ -104,12 +135,17 @@ struct buffer_head {
         unsigned char b_count;		/* users using this block */
         // 是否被锁定：0- 未锁定，1- 已锁定
         unsigned char b_lock;		/* 0 - ok, 1 -locked */
+        // 所在的空闲链表：0- 不在空闲链表中（正在被使用），1- 干净的 LRU 链表，2- 脏链表
+        unsigned char b_list;
+        // 放入脏链表的时刻（滴答数），写回任务据此判断脏缓冲块的“年龄”，0 表示缓冲块是干净的
+        unsigned long b_flushtime;
         struct task_struct * b_wait; // 指向等待该缓存区解锁的任务（进程）
         // 下面四个指针用于缓冲区管理
         struct buffer_head * b_prev; // hash队列上前一块
         struct buffer_head * b_next; // hash队列上下一块
-        struct buffer_head * b_prev_free; // 空闲表上前一个
-        struct buffer_head * b_next_free; // 空闲表上下一块
+        struct buffer_head * b_prev_free; // 空闲表（干净的 LRU 链表或脏链表）上前一个
+        struct buffer_head * b_next_free; // 空闲表（干净的 LRU 链表或脏链表）上下一块
+        struct buffer_head * b_reqnext; // 同一个块设备请求项中的下一块（合并后的请求项带有一串缓冲块）
 };
 
 /**
@@ -136,6 +172,7 @@ struct m_inode {
         unsigned short i_zone[9];
 /* these are in memory also */
         struct task_struct * i_wait; // 等待该i节点的进程
+        struct wait_queue * i_rwait, * i_wwait; // 管道：等待数据的读进程，等待空闲空间的写进程（都是独占等待）
         unsigned long i_atime; // 文件数据被访问的时间
         unsigned long i_ctime; // i节点自身被修改时间
         unsigned short i_dev; // i节点所在的设备号
@@ -147,6 +184,10 @@ struct m_inode {
         unsigned char i_mount; // 挂载标志
         unsigned char i_seek; // 支持随机访问标志
         unsigned char i_update; // 更新标志
+        struct m_inode * i_next, * i_prev; // 相同 hash 值的下一个，上一个i节点（只有 i_dev 不为 0 的i节点在 hash 表中）
+        struct m_inode * i_free_next, * i_free_prev; // 空闲（引用计数为 0）i节点的 LRU 链表中的下一个，上一个i节点
+        unsigned short i_prealloc_block; // 预分配窗口的第一个逻辑块（已经在位图中占用，但还不属于文件）
+        unsigned short i_prealloc_count; // 预分配窗口中剩余的块数
 };
 
 /**
@@ -158,6 +199,9 @@ struct file {
         unsigned short f_count; // 文件引用计数器
         struct m_inode * f_inode; // 指向对应的“i节点”
         off_t f_pos; // 文件位置（读写偏移值）
+        unsigned long f_ra_next; // 顺序读时下一次读操作应该开始的文件内逻辑块号
+        unsigned long f_ra_end; // 已经发起预读的文件内逻辑块号上界（不含）
+        unsigned short f_ra_win; // 当前预读窗口大小（块数），0 表示不预读
 };
 
 /**
@@ -183,6 +227,10 @@ struct super_block {
         unsigned char s_lock; // 是否被锁定
         unsigned char s_rd_only; // 是否只读
         unsigned char s_dirt; // 是否被修改
+        unsigned short s_imap_free[8]; // 每块“i节点位图”中空闲位的个数（加载时统计），为 0 的位图块在分配时直接跳过
+        unsigned short s_zmap_free[8]; // 每块“逻辑块位图”中空闲位的个数
+        unsigned long s_ilast; // 上次分配的i节点在位图中的位偏移，下次从这里往后找
+        unsigned long s_zlast; // 上次分配的逻辑块在位图中的位偏移
 };
 
 /**
@@ -208,11 +256,13 @@ struct dir_entry {
 };
 
 // 一些全局变量
-extern struct m_inode inode_table[NR_INODE]; // 内存i节点数组（32项）
+extern struct m_inode * inode_table; // 内存i节点数组（NR_INODE项）
+extern int nr_inode; // 内存i节点数组项数
 extern struct file file_table[NR_FILE]; // 文件表数组（64项）
 extern struct super_block super_block[NR_SUPER]; // 超级块数组（8项）
 extern struct buffer_head * start_buffer; // 缓冲区起始位置
 extern int nr_buffers; // 缓冲块个数
+extern int nr_hash; // 缓冲区 hash 表项数
 
 // 软盘操作函数原型
 extern void check_disk_change(int dev);
@@ -226,6 +276,14 @@ extern void truncate(struct m_inode * inode);
 extern void sync_inodes(void);
 extern void wait_on(struct m_inode * inode);
 extern int bmap(struct m_inode * inode,int block);
+extern int dcache_lookup(struct m_inode * dir, const char * name, int len);
+extern unsigned long dcache_seq;
+extern void dcache_add(struct m_inode * dir, const char * name, int len, int ino, unsigned long seq);
+extern void dcache_remove(struct m_inode * dir, const char * name, int len);
+extern void dcache_invalidate(int dev, int dir);
+extern unsigned long get_file_page(struct m_inode * inode, unsigned long block);
+extern void invalidate_file_pages(struct m_inode * inode, long block);
+extern void invalidate_dev_pages(int dev);
 extern int create_block(struct m_inode * inode,int block);
 extern struct m_inode * namei(const char * pathname);
 extern int open_namei(const char * pathname, int flag, int mode,
@@ -233,7 +291,9 @@ extern int open_namei(const char * pathname, int flag, int mode,
 extern void iput(struct m_inode * inode);
 extern struct m_inode * iget(int dev,int nr);
 extern struct m_inode * get_empty_inode(void);
+extern void insert_inode_hash(struct m_inode * inode);
 extern struct m_inode * get_pipe_inode(void);
+extern int pipe_set_size(struct m_inode * inode, unsigned long size);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
@@ -241,7 +301,11 @@ extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
 extern void bread_page(unsigned long addr,int dev,int b[4]);
 extern struct buffer_head * breada(int dev,int block,...);
-extern int new_block(int dev);
+extern void breadahead(int dev,int * b,int n);
+extern int new_block(int dev, int goal);
+extern int new_file_block(struct m_inode * inode, int goal);
+extern void discard_prealloc(struct m_inode * inode);
+extern void count_free_bits(struct super_block * sb);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
 extern void free_inode(struct m_inode * inode);
@@ -46,6 +46,10 @@
 #define WIN_SEEK 		0x70 // 寻道
 #define WIN_DIAGNOSE    0x90 // 控制器诊断
 #define WIN_SPECIFY		0x91 // 建立驱动器参数
+#define WIN_MULTREAD		0xC4 // 多扇区模式读：每个中断传输一组扇区
+#define WIN_MULTWRITE		0xC5 // 多扇区模式写
+#define WIN_SETMULT		0xC6 // 设置多扇区模式每组的扇区数
+#define WIN_IDENTIFY		0xEC // 读取驱动器标识信息（512 字节）
 
 /* Bits for HD_ERROR */
 // 错误寄存器的各位的定义
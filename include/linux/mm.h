@@ -2,9 +2,36 @@
 #define _MM_H
 
 #define PAGE_SIZE 4096
+#define MAX_MEMORY (64*1024*1024) // 支持的最大物理内存：内核段和任务 0 共用的线性地址空间前 64MB
+
+#define PAGE_ACCESSED 0x20 // 页表项的“已访问”位
+#define PAGE_DIRTY 0x40 // 页表项的“已修改”位
+
+// 被换出页面的页表项：存在位为 0，第 1 位保存原来的读写位，高 20 位是交换页号 (mm/swap.c)
+#define SWP_ENTRY(nr,pte) (((nr) << 12) | ((pte) & 2))
+#define SWP_NR(entry) ((entry) >> 12)
+
+// 刷新页变换高速缓冲
+#define invalidate()                            \
+        __asm__("movl %%eax,%%cr3"::"a" (0))
+
+extern long paging_init(long start_mem, long end_mem);
 
 extern unsigned long get_free_page(void);
+extern unsigned long __get_free_pages(int order);
 extern unsigned long put_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
+extern void free_pages(unsigned long addr, int order);
+extern void unmap_pages(unsigned long from, unsigned long size);
+extern void get_page(unsigned long addr);
+extern int page_count(unsigned long addr);
+extern int shrink_page_cache(void);
+extern unsigned long put_dirty_page(unsigned long page,unsigned long address);
+extern int swap_out(void);
+
+extern void swap_free(int nr);
+extern void read_swap_page(int nr, unsigned long page);
+extern int swap_out_page(unsigned long * pte);
+extern int swap_in(unsigned long * pte);
 
 #endif
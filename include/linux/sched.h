@@ -3,11 +3,14 @@
 
 #define NR_TASKS 64 // 系统中最多同时的任务（进程）数
 #define HZ 100 // 定义系统时钟滴答频率（100Hz，每个滴答10ms）
+#define NR_RUNQ 32 // 就绪队列的级数：按 counter 值分级，counter >= NR_RUNQ-1 的任务都挂在最高一级
+#define NR_MMAP 8 // 每个进程最多的文件映射区个数
 
 #define FIRST_TASK task[0] // 任务0比较特殊，所以特意给他单独定义一个符号
 #define LAST_TASK task[NR_TASKS-1] // 任务数组中的最后一个
 
 #include <linux/head.h>
+#include <linux/wait.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <signal.h>
@@ -43,7 +46,7 @@ extern void trap_init(void);
 volatile void panic(const char * str);
 #endif
 // 往 tty 上写指定长度的字符串 (kernel/chr_drv/tty_io.c) 
-extern int tty_write(unsigned minor,char * buf,int count);
+extern int tty_write(unsigned minor,char * buf,int count,unsigned short flags);
 
 typedef int (*fn_ptr)(); // 定义函数指针类型：fn_ptr是指向一个无参数的，返回 int 的函数的指针
 
@@ -88,6 +91,23 @@ struct tss_struct {
 	struct i387_struct i387;
 };
 
+// 内核定时器：挂在 kernel/sched.c 的分级时间轮上，到期时在时钟中断中调用 fn(data)
+struct timer_list {
+        struct timer_list * next; // 同一个时间轮槽中的下一个定时器
+        struct timer_list ** pprev; // 指向前一个定时器的 next 字段（或者槽的头指针），NULL 表示定时器没有挂在时间轮上
+        unsigned long expires; // 到期时刻（滴答数 jiffies 的绝对值）
+        unsigned long data; // 传给定时处理函数的参数
+        void (*fn)(unsigned long); // 定时处理函数
+};
+
+// 文件映射区（mmap）：进程逻辑地址 [v_start, v_end) 映射文件中从 v_offset 开始的内容，缺页时由 do_no_page 从页缓存中取得页面
+struct vm_area {
+        unsigned long v_start, v_end; // 映射区的开始和结束逻辑地址（页面对齐），v_end 为 0 表示本项空闲
+        struct m_inode * v_inode; // 被映射文件的i节点指针（持有一个引用）
+        unsigned long v_offset; // v_start 对应的文件内偏移（页面对齐）
+        unsigned short v_prot; // 保护属性 PROT_xxx (include/sys/mman.h)
+};
+
 // 任务（进程）数据结构，也被称为进程描述符
 struct task_struct {
 /* these are hardcoded - don't touch */
@@ -109,7 +129,7 @@ struct task_struct {
         unsigned short uid,euid,suid;
         // 组标识号，有效组标识号，保存的组标识号
         unsigned short gid,egid,sgid;
-        // 报警定时值（滴答数）
+        // 报警定时值（滴答数），只能通过 set_alarm() 修改，这样才能同步更新时间轮上的 alarm_timer
         long alarm;
         // 用户态运行时间（滴答数），内核态运行时间（滴答数），子进程用户态运行时间（滴答数），子进程内核态运行时间（滴答数），进程开始时刻（unix 时间格式，秒）
         long utime,stime,cutime,cstime,start_time;
@@ -130,6 +150,16 @@ struct task_struct {
 /* tss for this task */
         // 进程的任务状态段结构
         struct tss_struct tss;
+/* run queue */
+        // 就绪队列中的后继和前驱任务（同一级别的任务组成双向循环链表），任务不在就绪队列中时 run_next 为 NULL
+        struct task_struct *run_next, *run_prev;
+        long run_level; // 任务所在的就绪队列级别
+        long run_epoch; // 上一次重新计算 counter 时的调度纪元，睡眠期间错过的重算在入队时补上
+        int task_nr; // 任务号（在任务数组 task[] 中的索引），switch_to 需要用到
+        struct timer_list alarm_timer; // 报警定时器，到期时向任务发送 SIGALRM 信号
+        struct vm_area mmap[NR_MMAP]; // 文件映射区，按开始地址无序存放
+        int vfork_mm; // 由 vfork 创建，还在借用父进程的地址空间（线性地址和页表）
+        struct task_struct * vfork_wait; // 在 vfork 中等待本进程放还地址空间的父进程
 };
 
 /*
@@ -198,10 +228,21 @@ extern long startup_time; // 开机时间，从 1970:0:0:0开始计时的秒数
 
 #define CURRENT_TIME (startup_time+jiffies/HZ) //当前时间（秒数）
 
-extern void add_timer(long jiffies, void (*fn)(void)); // 
+extern void add_timer(long jiffies, void (*fn)(void)); // 在 jiffies 个滴答后调用 fn，定时器从内部的定时器池中分配
+extern void init_timer(struct timer_list * timer); // 初始化定时器（不挂在时间轮上）
+extern void mod_timer(struct timer_list * timer, unsigned long expires); // 设置定时器的到期时刻，并挂到时间轮上
+extern int del_timer(struct timer_list * timer); // 从时间轮上取下定时器，返回定时器原来是否处于等待状态
+extern void set_alarm(struct task_struct * p, long expires); // 设置任务的报警定时值（0 表示取消）
 extern void sleep_on(struct task_struct ** p);
 extern void interruptible_sleep_on(struct task_struct ** p);
 extern void wake_up(struct task_struct ** p);
+extern void wake_up_process(struct task_struct * p); // 把任务置为就绪状态并放入就绪队列
+extern void signal_wake_up(struct task_struct * p); // 发送信号后调用：唤醒处于可中断睡眠并且有未屏蔽信号的任务
+extern struct vm_area * find_vma(struct task_struct * p, unsigned long addr); // 查找包含逻辑地址 addr 的文件映射区 (mm/mmap.c)
+extern unsigned long mmap_lowest(struct task_struct * p); // 最低的文件映射区的开始地址，没有映射区时返回 0
+extern void dup_mmap(struct task_struct * p); // fork 时子进程继承文件映射区：增加i节点的引用计数
+extern void exit_mmap(struct task_struct * p); // exit, execve 时放弃所有的文件映射区
+extern void vfork_release(void); // vfork 创建的进程 execve 或退出时放还父进程的地址空间 (kernel/fork.c)
 
 /*
  * Entry into gdt where to find first TSS. 0-nul, 1-cs, 2-ds, 3-syscall
@@ -23,7 +23,7 @@ struct tty_queue {
         unsigned long data; // 队列缓冲区含有的字符行数值（不是字符数），如果是串行端口，则保存串行端口的端口地址
         unsigned long head; // 缓冲区中数据头指针
         unsigned long tail; // 缓冲区中数据尾指针
-        struct task_struct * proc_list; // 等待本队列的进程列表
+        struct wait_queue * proc_list; // 等待本队列的进程（等待队列，共享等待），rs_io.s 通过 wake_up_queue 唤醒
         char buf[TTY_BUF_SIZE]; // 队列的数据缓冲区
 };
 
@@ -104,8 +104,8 @@ void rs_init(void);
 void con_init(void);
 void tty_init(void);
 
-int tty_read(unsigned c, char * buf, int n);
-int tty_write(unsigned c, char * buf, int n);
+int tty_read(unsigned c, char * buf, int n, unsigned short flags);
+int tty_write(unsigned c, char * buf, int n, unsigned short flags);
 
 void rs_write(struct tty_struct * tty);
 void con_write(struct tty_struct * tty);
@@ -0,0 +1,60 @@
+#ifndef _WAIT_H
+#define _WAIT_H
+
+/*
+ * 等待队列
+ *
+ * sleep_on 把等待者串在一个 struct task_struct * 和每个等待者栈上的 tmp 上，wake_up 唤醒的是整条链：
+ * 每个醒来的任务都会唤醒它前面的任务，所以一次释放唤醒全部等待者，它们再重新争夺同一个资源
+ *
+ * 等待队列的每一项在等待者的内核栈上（或者由 select 分配），队列头是一个 struct wait_queue * 指针
+ * 共享等待者每次都被唤醒；独占等待者每次只唤醒一个，用于每次只能满足一个等待者的资源：空闲缓冲块，空闲请求项，管道
+ * 被唤醒的独占等待者没有得到资源时，应当在同一个队列上重新睡眠，资源的释放者会再唤醒一个
+ */
+
+struct task_struct;
+
+struct wait_queue {
+        struct task_struct * task; // 等待的任务
+        struct wait_queue * next; // 队列中的下一项
+        int exclusive; // 独占等待：一次只唤醒一个独占等待者
+};
+
+// 等待队列的统计信息（kernel/sched.c），用来比较唤醒的次数和无效唤醒的次数
+struct wait_stats {
+        unsigned long sleeps; // 在等待队列上睡眠的次数
+        unsigned long wakeups; // 被唤醒的任务数
+        unsigned long spurious; // 被唤醒以后资源仍然不可用，只好重新睡眠的次数
+};
+
+extern struct wait_stats wait_stats;
+
+extern void add_wait_queue(struct wait_queue ** q, struct wait_queue * wait);
+extern void remove_wait_queue(struct wait_queue ** q, struct wait_queue * wait);
+extern void sleep_on_queue(struct wait_queue ** q); // 共享的不可中断等待
+extern void sleep_on_queue_exclusive(struct wait_queue ** q); // 独占的不可中断等待
+extern void interruptible_sleep_on_queue(struct wait_queue ** q); // 共享的可中断等待
+extern int wake_up_queue(struct wait_queue ** q); // 唤醒所有共享等待者和一个独占等待者，返回被唤醒的任务数
+extern void wake_up_queue_all(struct wait_queue ** q); // 唤醒所有等待者
+
+/*
+ * select：一个进程同时挂在多个等待队列上（都是共享等待），每个文件的就绪检查函数用 select_wait 登记一个队列
+ * 登记项放在 select 分配的一页内存中，select 返回时全部取下 (fs/select.c)
+ */
+#define SEL_IN		1 // 可读
+#define SEL_OUT		2 // 可写
+#define SEL_EX		4 // 有异常情况
+
+struct select_table_entry {
+        struct wait_queue wait; // 挂在队列上的等待项
+        struct wait_queue ** wait_address; // 所在的等待队列
+};
+
+typedef struct select_table_struct {
+        int nr; // 已经登记的项数
+        struct select_table_entry * entry; // 登记项数组
+} select_table;
+
+extern void select_wait(struct wait_queue ** q, select_table * p); // 把当前进程登记到等待队列 q 上，p 为 NULL 时什么也不做
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+// 映射区的保护属性
+#define PROT_READ	0x1 // 可读
+#define PROT_WRITE	0x2 // 可写（私有映射：写时复制，不会写回文件）
+#define PROT_EXEC	0x4 // 可执行
+
+// 映射类型
+#define MAP_SHARED	0x01 // 共享映射（只支持只读）
+#define MAP_PRIVATE	0x02 // 私有映射
+#define MAP_TYPE	0x0f // 映射类型屏蔽码
+#define MAP_FIXED	0x10 // 必须映射到指定的地址处
+
+#define MAP_FAILED	((void *) -1)
+
+extern void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t off);
+extern int munmap(void * addr, size_t len);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _SYS_TIME_H
+#define _SYS_TIME_H
+
+#include <sys/types.h>
+
+struct timeval {
+	long tv_sec; // 秒
+	long tv_usec; // 微秒
+};
+
+// select 使用的文件描述符集合：NR_OPEN 不超过 32，一个长字就够了
+typedef unsigned long fd_set;
+
+#define FD_SETSIZE		32
+#define FD_SET(fd,fdsetp)	(*(fdsetp) |= (1UL << (fd)))
+#define FD_CLR(fd,fdsetp)	(*(fdsetp) &= ~(1UL << (fd)))
+#define FD_ISSET(fd,fdsetp)	((*(fdsetp) >> (fd)) & 1)
+#define FD_ZERO(fdsetp)		(*(fdsetp) = 0)
+
+extern int select(int width, fd_set * readfds, fd_set * writefds,
+		  fd_set * exceptfds, struct timeval * timeout);
+
+#endif
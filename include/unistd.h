@@ -129,6 +129,13 @@
 #define __NR_ssetmask	69
 #define __NR_setreuid	70
 #define __NR_setregid	71
+#define __NR_bdflush	72
+#define __NR_mmap	73
+#define __NR_munmap	74
+#define __NR_vfork	75
+#define __NR_swapon	76
+#define __NR_splice	77
+#define __NR_select	78
 
 #define _syscall0(type,name) \
 type name(void) \
@@ -40,6 +40,7 @@ static inline _syscall0(int,fork) // int fork() ：创建子进程
         static inline _syscall0(int,pause) // int pause() : 暂停进程的执行，直到收到一个信号
         static inline _syscall1(int,setup,void *,BIOS) // int setup(void* BIOS) ：系统设置，仅在这个文件使用
         static inline _syscall0(int,sync) // int sync() ：同步文件系统
+        static inline _syscall0(int,bdflush) // int bdflush() ：成为高速缓冲写回任务，从不返回
 
 #include <linux/tty.h> // tty 头文件，定义了 tty_io，串行通信方面的参数，常数
 #include <linux/sched.h> // 调度程序头文件，定义了 task_struct，任务0的数据，描述符参数设置等
@@ -54,6 +55,7 @@ static inline _syscall0(int,fork) // int fork() ：创建子进程
 #include <sys/types.h> // 类型头文件，linux系统的基本数据类型
 
 #include <linux/fs.h> // 文件系统头文件，定义文件表结构 (file, buffer_head, m_inode) 和 extern int ROOT_DEV 等
+#include <linux/mm.h> // 内存管理头文件：MAX_MEMORY, paging_init
 
         static char printbuf[1024]; // 内核显示信息的缓存
 
@@ -150,15 +152,19 @@ void main(void)		/* This really IS void, no error here. */
 // 主内存开始地址 -> main_memory_start 
         memory_end = (1<<20) + (EXT_MEM_K<<10); // 内存大小 = 1M + (扩展内存K) * 1024 字节 
         memory_end &= 0xfffff000; // 忽略不到 4KB (1页) 的内存
-        if (memory_end > 16*1024*1024)
-                memory_end = 16*1024*1024; // 如果内存大于 16MB，则按照 16MB 计
-        if (memory_end > 12*1024*1024) 
+        if (memory_end > MAX_MEMORY)
+                memory_end = MAX_MEMORY; // 如果内存大于 64MB，则按照 64MB 计
+        if (memory_end > 32*1024*1024)
+                buffer_memory_end = 8*1024*1024; // 如果内存 大于 32 MB，高速缓存区的结束地址是在 8MB
+        else if (memory_end > 12*1024*1024) 
                 buffer_memory_end = 4*1024*1024; // 如果内存 大于 12 MB，高速缓存区的结束地址是在 4MB
         else if (memory_end > 6*1024*1024)
                 buffer_memory_end = 2*1024*1024; // 如果内存 大于 6MB，高速缓存区的末端 = 2MB 
         else
                 buffer_memory_end = 1*1024*1024; // 其他情况，高速缓存区的末端 = 1MB 
         main_memory_start = buffer_memory_end; // 主内存的开始 = 高速缓存区的末端 
+        main_memory_start = paging_init(main_memory_start,memory_end); // 映射 16MB 以上的内存，页表放在主内存的开始处
+        main_memory_start = inode_init(main_memory_start,memory_end); // 内存i节点表，大小根据内存容量确定
 #ifdef RAMDISK
         main_memory_start += rd_init(main_memory_start, RAMDISK*1024);
 #endif
@@ -241,6 +247,15 @@ void init(void)
                NR_BUFFERS*BLOCK_SIZE); // 打印高速缓存区大小
         printf("Free mem: %d bytes\n\r",memory_end-main_memory_start); // 打印主内存大小
 
+        // 创建高速缓冲写回任务：它在内核中循环，定期把“老的”脏缓冲块分批写盘，从不返回
+        if (!fork()) {
+                close(0);
+                close(1);
+                close(2);
+                bdflush();
+                _exit(0);
+        }
+
         // 下面 fork 调用用来创建子进程2, 子进程2的返回值是 0 ,而父进程则返回2，
         if (!(pid=fork())) { // 这里是子进程2在执行
                 close(0); // 立刻关闭复制得来的文件描述符0
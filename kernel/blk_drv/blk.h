@@ -19,9 +19,13 @@
  *
  * 32 看起来是一个比较合理的数字，足够从电梯算法获取利益，当缓冲区在请求队列中锁住时也不是很大的数字
  * 64 显得太大了，当大量的写/同步操作进行时容易引起长时间的暂停
+ *
+ * 现在 NR_REQUEST 是所有块设备请求项的总数：启动时按 blk_dev[] 中的 nr_pool 划分给各个主设备号，
+ * 每个设备只在自己的请求项池中分配，写请求仍然只使用池中低2/3的部分，
+ * 所以一个繁忙的慢设备（软盘）不会占满请求项而让硬盘也跟着等待
  * 
  */
-#define NR_REQUEST	32
+#define NR_REQUEST	48
 
 /*
  * Ok, this is an expanded form so that we can use the same
@@ -41,13 +45,24 @@ struct request {
         int cmd; // READ 或 WRITE命令 
         int errors; // 操作时产生的错误次数
         unsigned long sector; // 操作的起始扇区号（1块=2扇区）
-        unsigned long nr_sectors; // 读/写扇区数
-        char * buffer; // 数据缓冲区
+        unsigned long nr_sectors; // 读/写扇区数（整个请求项剩余的扇区数）
+        unsigned long current_nr_sectors; // 当前缓冲块(bh)剩余的扇区数
+        char * buffer; // 数据缓冲区：当前缓冲块中下一个要读写的位置
         struct task_struct * waiting; // 等待请求完成的进程队列
-        struct buffer_head * bh; // 高速缓冲区头指针
+        struct buffer_head * bh; // 高速缓冲区头指针：当前正在读写的缓冲块，后面的通过 b_reqnext 链接
+        struct buffer_head * bhtail; // 缓冲块链表的最后一块，用于向后合并
         struct request * next; // 指向下一个请求项，NULL表示当前是最后一项
+        unsigned long deadline; // deadline 调度器：请求项的到期时刻（滴答数）
+        unsigned long queue_time; // 请求项进入队列的时刻（滴答数）
+        unsigned long start_time; // 请求项交给驱动程序开始处理的时刻（滴答数）
+        struct request * fifo_next, * fifo_prev; // deadline 调度器：到达顺序队列上的前后项
 };
 
+/*
+ * 一个合并后的请求项最多包含的扇区数：硬盘控制器的扇区数寄存器只有 8 位
+ */
+#define MAX_SECTORS 254
+
 /*
  * This is used in the elevator algorithm: Note that
  * reads always go before writes. This is natural: reads
@@ -67,6 +82,22 @@ struct request {
         ((s1)->cmd<(s2)->cmd || ((s1)->cmd==(s2)->cmd &&                \
                                  ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
                                                             (s1)->sector < (s2)->sector))))
+struct blk_dev_struct;
+
+/**
+ * I/O 调度器操作表
+ *
+ * 请求链表的第一项(current_request)是驱动程序正在处理的请求项，调度器只决定后面各项的顺序
+ * 
+ */
+struct iosched_ops {
+        char * name; // 调度器名字
+        // 把请求项插入非空的请求链表（关中断时调用）
+        void (*add_request)(struct blk_dev_struct * dev, struct request * req);
+        // 链表第一项完成时调用：返回接下来要处理的请求项，并且整理好它后面的链表，NULL 表示没有请求项了
+        struct request * (*next_request)(struct blk_dev_struct * dev);
+};
+
 /**
  * 块设备项的结构
  * 
@@ -74,11 +105,21 @@ struct request {
 struct blk_dev_struct {
         void (*request_fn)(void); // 请求处理函数指针，硬盘是 do_hd_request，内存盘是 do_rd_request，软盘是 do_floppy_request 
         struct request * current_request; // 当前处理的请求项指针
+        struct iosched_ops * iosched; // 本设备使用的 I/O 调度器
+        int nr_pool; // 启动时从 request[] 中划给本设备的请求项个数
+        struct request * pool; // 本设备请求项池的第一项
+        int depth; // 允许同时使用的请求项个数（队列深度），可以通过 ioctl 在 1～nr_pool 之间调整
+        struct wait_queue * wait_for_request[2]; // 等待本设备空闲请求项的进程队列：读(READ)，写(WRITE)分开，都是独占等待
+        struct request * fifo[2]; // deadline 调度器：读(READ)、写(WRITE)请求项按到达顺序组成的循环双向链表
+        struct blk_stats stats; // 本设备的请求队列统计信息
 };
 
+extern struct iosched_ops elevator_iosched; // 原来的电梯算法
+extern struct iosched_ops deadline_iosched; // 读写分开计时的 deadline 调度器
+
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV]; // 全局块设备表，每种块设备各占用一项，共7项
-extern struct request request[NR_REQUEST]; // 全局请求队列数组，总共32项
-extern struct task_struct * wait_for_request; // 等待空闲请求项的进程队列头指针
+extern struct request request[NR_REQUEST]; // 全局请求项数组，启动时划分给各个设备
+extern struct request * end_queue_request(struct blk_dev_struct * dev);
 
 // 在块设备驱动程序(如hd.c)中包含此头文件，必须先定义驱动程序处理的主设备号
 // 下面的代码会根据主设备号给出正确的宏定义
@@ -152,27 +193,45 @@ static inline void unlock_buffer(struct buffer_head * bh)
 }
 
 /*
- * 结束当前块请求
+ * 结束当前请求项中的当前缓冲块
  *
  * uptodate: 更新标志，如果为 0， 则打印出错信息
+ *
+ * 合并后的请求项带有一串缓冲块：每次只结束第一块，还有剩余的缓冲块时请求项继续有效，
+ * 起始扇区和缓冲区指针移动到下一块，只有最后一块结束时才释放请求项
+ *
+ * 逐扇区读写的驱动程序（硬盘）自己递减 current_nr_sectors，整块读写的驱动程序（软盘，内存盘）不需要，
+ * 这里会跳过当前缓冲块还没有读写的扇区
  * 
  */
 static inline void end_request(int uptodate)
 {
-        DEVICE_OFF(CURRENT->dev); // 关闭当前请求对应的设备
-        if (CURRENT->bh) { // 当前请求的"高速缓冲块头指针"不为NULL
-                CURRENT->bh->b_uptodate = uptodate; // 置位“高速缓冲块头指针”的“更新”标志
-                unlock_buffer(CURRENT->bh); // 解锁高速缓冲块
+        struct buffer_head * bh;
+
+        if ((bh = CURRENT->bh)) { // 当前请求的"高速缓冲块头指针"不为NULL
+                bh->b_uptodate = uptodate; // 置位“高速缓冲块头指针”的“更新”标志
+                unlock_buffer(bh); // 解锁高速缓冲块
         }
         if (!uptodate) { // 打印错误信息
                 printk(DEVICE_NAME " I/O error\n\r");
                 printk("dev %04x, block %d\n\r",CURRENT->dev,
-                       CURRENT->bh->b_blocknr);
+                       bh ? bh->b_blocknr : -1);
         }
+        CURRENT->sector += CURRENT->current_nr_sectors;
+        CURRENT->nr_sectors -= CURRENT->current_nr_sectors;
+        if (bh) {
+                CURRENT->bh = bh->b_reqnext;
+                bh->b_reqnext = NULL;
+                if ((bh = CURRENT->bh)) { // 还有缓冲块：转到下一块继续
+                        CURRENT->current_nr_sectors = BLOCK_SIZE >> 9;
+                        CURRENT->buffer = bh->b_data;
+                        return;
+                }
+        }
+        DEVICE_OFF(CURRENT->dev); // 关闭当前请求对应的设备
         wake_up(&CURRENT->waiting); // 唤醒等待“该读写请求项”的进程
-        wake_up(&wait_for_request); // 唤醒等待“获取空闲请求项”的进程
-        CURRENT->dev = -1; // 释放该读写请求项：dev = -1 表示该请求项“空闲” 
-        CURRENT = CURRENT->next; // 当前请求项指向下一个
+        // 释放该读写请求项，唤醒等待本设备空闲请求项的进程，并由 I/O 调度器选出下一个请求项
+        CURRENT = end_queue_request(&blk_dev[MAJOR_NR]);
 }
 
 // 初始化请求项宏：用于对当前请求项进行一些有效性的判断
@@ -38,6 +38,7 @@
 /* Max read/write errors/sector */
 #define MAX_ERRORS	7 // 读写一个硬盘最多允许的出错次数
 #define MAX_HD		2 // 支持的最多硬盘数
+#define MAX_MULT	16 // 多扇区模式每个中断最多传输的扇区数
 
 // 重新校正处理函数
 // 复位操作时在硬盘中断处理程序中调用的重新校正函数
@@ -48,6 +49,22 @@ static int recalibrate = 1;
 // 复位标志，发生读写错误时会设置该标志，并调用相关的复位标志，以复位硬盘和控制器
 static int reset = 1;
 
+/*
+ * 多扇区模式(SET MULTIPLE)：驱动器每个中断传输一组扇区，而不是每个扇区一个中断
+ * 启动后第一次访问驱动器时用 IDENTIFY 查询它支持的组大小，然后用 SET MULTIPLE 设置，复位控制器后要重新设置
+ */
+static int max_mult[MAX_HD] = { -1, -1 }; // 驱动器支持的组大小（取不超过 MAX_MULT 的 2 的幂），-1 表示还没有查询
+static int mult_count[MAX_HD] = { 0, 0 }; // 驱动器当前的组大小，0 表示需要重新设置，1 表示不使用多扇区模式
+static int cur_mult = 1; // 正在执行的读写命令每个中断传输的扇区数
+static int cur_chunk = 0; // 写命令：已经送到数据端口，等待中断确认的扇区数
+static unsigned short id_buf[256]; // IDENTIFY 命令读出的驱动器标识信息
+
+// 统计信息
+static struct {
+        unsigned long irqs; // 读写命令的中断次数
+        unsigned long sectors; // 传输的扇区数
+} hd_stats;
+
 /*
  *  This struct defines the HD's and their types.
  */
@@ -402,35 +419,81 @@ static void bad_rw_intr(void)
                 reset = 1; // 设置复位标志：要求执行复位硬盘控制器的操作
 }
 
+/*
+ * 当前请求项完成了 n 个扇区的读写：移动起始扇区和缓冲区指针，读写完的缓冲块逐块结束
+ *
+ * 返回：请求项剩下的扇区数，为 0 时请求项已经结束（CURRENT 已经指向下一个请求项）
+ */
+static int hd_advance(int n)
+{
+        int left = CURRENT->nr_sectors - n;
+
+        CURRENT->errors = 0; // 清空“当前请求项”的错误计数
+        hd_stats.sectors += n;
+        while (n-- > 0) {
+                CURRENT->buffer += 512; // 当前请求项的“缓冲区”指针增加512
+                CURRENT->sector++;
+                CURRENT->nr_sectors--;
+                if (!--CURRENT->current_nr_sectors) // 当前缓冲块读写完：结束这一块，缓冲区指针转到下一块
+                        end_request(1);
+        }
+        return left;
+}
+
+/*
+ * 把当前请求项从当前位置开始的 n 个扇区写到数据端口
+ *
+ * 沿着请求项的缓冲块链表往后走，但并不结束缓冲块：要等中断确认这一组扇区写成功之后，才由 hd_advance 结束
+ */
+static void write_sectors(int n)
+{
+        struct buffer_head * bh = CURRENT->bh;
+        char * buf = CURRENT->buffer;
+        int left = CURRENT->current_nr_sectors;
+
+        while (n-- > 0) {
+                port_write(HD_DATA,buf,256); // 写入一个扇区（256字）
+                buf += 512;
+                if (!--left && bh && (bh = bh->b_reqnext)) {
+                        buf = bh->b_data;
+                        left = BLOCK_SIZE >> 9;
+                }
+        }
+}
+
 /*
  * 读操作中断调用
+ *
+ * 每个中断读入一组（多扇区模式）或者一个扇区，中间跨过的缓冲块逐块结束
  * 
  */
 static void read_intr(void)
 {
+        int n;
+
         if (win_result()) { // 读操作失败：控制器忙，读出错，或命令执行出错
                 bad_rw_intr(); // 执行读写失败处理
                 do_hd_request(); // 请求硬件做相应处理：复位或执行下一个请求项
                 return;
         }
-        // 读当前扇区操作成功
-        // 注意：port_read 读取的是256个字，相当于512字节
-        // request->buffer, request->bh->data 这两者是同一个指针，因此下面的读取操作，也会把数据写入到“高速缓冲块”的数据区
-        port_read(HD_DATA,CURRENT->buffer,256); // 从硬盘控制器的“数据端口”读取一个扇区（512字节）到“当前请求项”的“高速缓冲块”的“数据区”
-        CURRENT->errors = 0; // 清空“当前请求项”的错误计数
-        CURRENT->buffer += 512; // 当前请求项的“缓冲区”指针增加512
-        CURRENT->sector++; // “当前请求项”的已读扇区数 + 1 
-        if (--CURRENT->nr_sectors) { // 所需读取的总扇区数 > 0 : 说明还没全部读完
-                do_hd = &read_intr; // 再次设置硬盘中断调用的C函数指针为'read_intr'
-                return;
+        hd_stats.irqs++;
+        if ((n = CURRENT->nr_sectors) > cur_mult) // 这一组的扇区数：最后一组可能不满
+                n = cur_mult;
+        while (n-- > 0) {
+                // 从硬盘控制器的“数据端口”读取一个扇区（512字节）到“当前请求项”的“高速缓冲块”的“数据区”
+                port_read(HD_DATA,CURRENT->buffer,256);
+                if (!hd_advance(1)) { // 本次请求项的全部扇区已经读完
+                        do_hd_request(); // 处理的下一个“硬盘请求项”
+                        return;
+                }
         }
-        // 本次请求项的全部扇区已经读完：结束当前请求项的操作（解锁高速缓冲块，唤醒等待高速缓冲块的进程，唤醒等待空闲请求项的进程等）
-        end_request(1); // 置位“当前请求项”中的“高速缓冲块”中的“数据已更新”标志
-        do_hd_request(); // 处理的下一个“硬盘请求项”
+        do_hd = &read_intr; // 控制器会继续送来下一组扇区
 }
 
 /*
  * 写操作中断调用
+ *
+ * 中断表示上一组扇区已经写好：结束其中的缓冲块，再把下一组写到数据端口
  * 
  */
 static void write_intr(void)
@@ -440,17 +503,54 @@ static void write_intr(void)
                 do_hd_request(); // 请求硬盘做相应处理：重复执行，复位硬盘，或执行一个请求项
                 return;
         }
-        // 当前扇区写操作成功
-        if (--CURRENT->nr_sectors) { // 判断是否还有扇区需要写
-                CURRENT->sector++; // 写入扇区总数 + 1 
-                CURRENT->buffer += 512; // “当前请求项”的“缓冲区”指针向后移动512字节 
-                do_hd = &write_intr; // 再次设置硬盘中断调用的C函数指针为'write_intr'
-                port_write(HD_DATA,CURRENT->buffer,256); // 从“当前请求项”的“高速缓冲块”的“数据区”向“硬盘控制器”的“数据端口”写入512字节（256字） 
+        hd_stats.irqs++;
+        if (!hd_advance(cur_chunk)) { // 本次请求项的全部扇区已经写完
+                do_hd_request(); // 处理的下一个“硬盘请求项”
                 return;
         }
-        // 本次请求项的全部扇区已经写完：结束当前请求项的操作
-        end_request(1); // 置位“当前请求项”中的“高速缓冲块”中的“数据已更新”标志
-        do_hd_request(); // 处理的下一个“硬盘请求项”
+        if ((cur_chunk = CURRENT->nr_sectors) > cur_mult)
+                cur_chunk = cur_mult;
+        do_hd = &write_intr; // 再次设置硬盘中断调用的C函数指针为'write_intr'
+        write_sectors(cur_chunk);
+}
+
+/*
+ * IDENTIFY 命令的中断处理：从驱动器标识信息的第 47 字中取得多扇区模式支持的最大组大小
+ *
+ * 老的驱动器不支持 IDENTIFY：不使用多扇区模式
+ * 
+ */
+static void identify_intr(void)
+{
+        int n = 1;
+
+        if (!win_result()) {
+                port_read(HD_DATA,id_buf,256);
+                if ((n = id_buf[47] & 0xff) > MAX_MULT)
+                        n = MAX_MULT;
+                while (n & (n-1)) // 取不超过 n 的 2 的幂
+                        n &= n-1;
+                if (n < 1)
+                        n = 1;
+        }
+        max_mult[CURRENT_DEV] = n;
+        if (n > 1)
+                printk("hd%d: multiple mode, %d sectors per interrupt\n\r",CURRENT_DEV,n);
+        do_hd_request();
+}
+
+/*
+ * SET MULTIPLE 命令的中断处理
+ * 
+ */
+static void setmult_intr(void)
+{
+        if (win_result()) { // 驱动器不接受：以后不再使用多扇区模式
+                printk("hd%d: SET MULTIPLE failed\n\r",CURRENT_DEV);
+                max_mult[CURRENT_DEV] = 1;
+        }
+        mult_count[CURRENT_DEV] = max_mult[CURRENT_DEV];
+        do_hd_request();
 }
 
 /*
@@ -478,9 +578,9 @@ void do_hd_request(void)
         INIT_REQUEST; // 检查请求项的有效性，见 blk.h 
         dev = MINOR(CURRENT->dev); // 获取次设备号：对应于各硬盘的文件系统分区号
         block = CURRENT->sector; // 获取当前请求项的起始扇区号（对应于当前分区的相对值）
-        // 次设备号 >= 10 或 起始扇区号 + 2 > 当前分区的扇区数
-        // 注意：每次要求读写一块数据（1024字节），所以请求的扇区号不能大于最后倒数第二个扇区号！
-        if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) { // “次设备号”或“起始扇区号”无效
+        // 次设备号 >= 10 或 起始扇区号 + 请求的扇区数 > 当前分区的扇区数
+        // 注意：合并后的请求项一次读写若干块数据，所以整个扇区范围都必须在分区内！
+        if (dev >= 5*NR_HD || block+CURRENT->nr_sectors > hd[dev].nr_sects) { // “次设备号”或“起始扇区号”无效
                 end_request(0); // 结束当前请求项
                 goto repeat; // 跳转到标号repeat处（定义在 INIT_REQUEST 中）
         }
@@ -516,6 +616,8 @@ void do_hd_request(void)
         if (reset) { // ”复位磁盘控制器“标志被置位
                 reset = 0; // 清空”复位磁盘控制器“标志
                 recalibrate = 1; // ”重新校正“标志置位
+                for (i = 0 ; i < MAX_HD ; i++) // 复位后驱动器回到单扇区模式，需要重新设置
+                        mult_count[i] = 0;
                 reset_hd(CURRENT_DEV); // 向磁盘控制器发送”建立驱动器参数“命令
                 return;
         }
@@ -525,9 +627,22 @@ void do_hd_request(void)
                        WIN_RESTORE,&recal_intr); // 向磁盘控制器发送”重新校正“命令：执行寻道操作，让处于任何地方的磁头重新回到0柱面
                 return;
         }
+        if (max_mult[dev] < 0) { // 还没有查询驱动器支持的多扇区模式
+                hd_out(dev,0,0,0,0,WIN_IDENTIFY,&identify_intr);
+                return;
+        }
+        if (!mult_count[dev]) { // 设置多扇区模式的组大小
+                if (max_mult[dev] > 1) {
+                        hd_out(dev,max_mult[dev],0,0,0,WIN_SETMULT,&setmult_intr);
+                        return;
+                }
+                mult_count[dev] = 1;
+        }
+        cur_mult = mult_count[dev]; // 多扇区模式：一个中断传输 cur_mult 个扇区
         // 注意：写命令必须等待磁盘控制器状态值中的DRQ_STAT被置位方可开始数据真正的数据传输。这和读命令不同
         if (CURRENT->cmd == WRITE) { // 写操作命令
-                hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr); // 向控制器发送”写操作“指令
+                hd_out(dev,nsect,sec,head,cyl,cur_mult > 1 ? WIN_MULTWRITE : WIN_WRITE,
+                       &write_intr); // 向控制器发送”写操作“指令
                 // 循环读取状态端口，并判断DRQ_STAT是否置位（置位，表示磁盘控制器已经准备好在主机和数据端口之间传输数据） 
                 for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
                         /* nothing */ ;
@@ -535,13 +650,28 @@ void do_hd_request(void)
                         bad_rw_intr(); // 执行出错处理 
                         goto repeat; // 跳转到标号repeat处（定义在 INIT_REQUEST 中） 
                 }
-                port_write(HD_DATA,CURRENT->buffer,256); // 向磁盘控制器的数据端口写入一个扇区的数据
+                cur_chunk = (nsect > cur_mult) ? cur_mult : nsect;
+                write_sectors(cur_chunk); // 向磁盘控制器的数据端口写入第一组扇区的数据
         } else if (CURRENT->cmd == READ) { // 读操作指令
-                hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr); // 向磁盘控制器发送”读操作命令“
+                hd_out(dev,nsect,sec,head,cyl,cur_mult > 1 ? WIN_MULTREAD : WIN_READ,
+                       &read_intr); // 向磁盘控制器发送”读操作命令“
         } else
                 panic("unknown hd-command"); // 无效指令，打印错误信息，死机
 }
 
+/**
+ * 打印硬盘读写的统计信息：读写命令的中断次数和传输的扇区数
+ */
+void show_hd_stats(void)
+{
+        int i;
+
+        printk("hd: %d interrupts, %d sectors",hd_stats.irqs,hd_stats.sectors);
+        for (i = 0 ; i < NR_HD ; i++)
+                printk(", hd%d %d sectors/interrupt",i,mult_count[i] ? mult_count[i] : 1);
+        printk("\n\r");
+}
+
 /**
  * 硬盘初始化函数：init/main.c的main()中被调用
  */
@@ -11,6 +11,7 @@
 #include <linux/sched.h> // 进程调度头文件
 #include <linux/kernel.h> // 内核配置头文件
 #include <asm/system.h> // 定义了设置或修改“描述符”/“中断门”等的嵌入式汇编语句
+#include <asm/segment.h> // 段操作头文件：put_fs_byte
 
 #include "blk.h" // 块设备头文件
 
@@ -22,16 +23,7 @@
 /*
  * “块设备请求项”包含所有把nr个扇区加载到内存中的信息
  */
-struct request request[NR_REQUEST]; // “块设备请求项”数组，总共有NR_REQUEST=32个请求项
-
-/*
- * used to wait on when there are no free requests
- */
-
-/*
- * 用来保存等待空闲请求项的进程队列
- */
-struct task_struct * wait_for_request = NULL;
+struct request request[NR_REQUEST]; // “块设备请求项”数组，总共有NR_REQUEST=48个请求项，启动时划分给各个设备
 
 /* blk_dev_struct is:
  *	do_request-address
@@ -45,14 +37,15 @@ struct task_struct * wait_for_request = NULL;
  */
 // 块设备数组： 该数组使用主设备号作为下标，实际内容将在各块设备驱动程序初始化时填入
 // 例如：硬盘设备驱动程序初始化时（hd.c中的hd_init函数），用于设置blk_dev[3]的内容
+// 第三项是启动时每个主设备号选用的 I/O 调度器，第四项是划给它的请求项个数（总和不能超过 NR_REQUEST），在这里修改即可
 struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
-        { NULL, NULL },		/* no_dev */   // 0 - 无设备
-        { NULL, NULL },		/* dev mem */  // 1 - 内存
-        { NULL, NULL },		/* dev fd */   // 2 - 软驱 
-        { NULL, NULL },		/* dev hd */   // 3 - 硬盘
-        { NULL, NULL },		/* dev ttyx */ // 4 - ttyx设备
-        { NULL, NULL },		/* dev tty */  // 5 - tty设备
-        { NULL, NULL }		/* dev lp */   // 6 - 打印机
+        { NULL, NULL, &elevator_iosched, 0 },	/* no_dev */   // 0 - 无设备
+        { NULL, NULL, &elevator_iosched, 8 },	/* dev mem */  // 1 - 内存
+        { NULL, NULL, &elevator_iosched, 8 },	/* dev fd */   // 2 - 软驱 
+        { NULL, NULL, &deadline_iosched, 32 },	/* dev hd */   // 3 - 硬盘
+        { NULL, NULL, &elevator_iosched, 0 },	/* dev ttyx */ // 4 - ttyx设备
+        { NULL, NULL, &elevator_iosched, 0 },	/* dev tty */  // 5 - tty设备
+        { NULL, NULL, &elevator_iosched, 0 }	/* dev lp */   // 6 - 打印机
 };
 
 /*
@@ -101,6 +94,140 @@ static inline void unlock_buffer(struct buffer_head * bh)
  * 
  */
 
+/*
+ * 电梯算法：按照 IN_ORDER（读先于写，然后按设备号，扇区号）把请求项插入链表
+ */
+static void elevator_add_request(struct blk_dev_struct * dev, struct request * req)
+{
+        struct request * tmp = dev->current_request;
+
+        // 遍历对应设备的请求链表数组，根据电梯算法把req项插入到合适的位置
+        for ( ; tmp->next ; tmp=tmp->next)
+                // （tmp的优先级比req高 或者 tmp的优化级不高于tmp->next） 并且 （req的优先级比tmp->next来的高）
+                if ((IN_ORDER(tmp,req) || 
+                     !IN_ORDER(tmp,tmp->next)) &&
+                    IN_ORDER(req,tmp->next))
+                        break; // 找到对应的项
+        // 插入到tmp项的后面
+        req->next=tmp->next; // req的下一项请求指针指向tmp的下一项 
+        tmp->next=req; // tmp的下一项请求指针指向req
+}
+
+/*
+ * 电梯算法：按链表顺序处理
+ */
+static struct request * elevator_next_request(struct blk_dev_struct * dev)
+{
+        return dev->current_request->next;
+}
+
+struct iosched_ops elevator_iosched = {
+        "elevator",
+        elevator_add_request,
+        elevator_next_request
+};
+
+/*
+ * deadline 调度器
+ *
+ * 请求项仍然按扇区号排成一个单向扫描的链表，以减少寻道
+ * 另外读、写请求项各自按到达顺序排成一个队列，并记下到期时刻：读 DL_READ_EXPIRE，写 DL_WRITE_EXPIRE
+ * 选择下一个请求项时，如果读队列（然后是写队列）中最老的请求项已经到期，就从它那里继续扫描，
+ * 这样一长串写请求不会让读请求无限期地等下去
+ */
+#define DL_READ_EXPIRE (HZ/2) // 读请求项最多等待 0.5 秒
+#define DL_WRITE_EXPIRE (5*HZ) // 写请求项最多等待 5 秒
+
+// 按设备号，扇区号排序，不区分读写
+#define SECTOR_ORDER(s1,s2)                                             \
+        ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev &&            \
+                                   (s1)->sector < (s2)->sector))
+
+/*
+ * 把请求项加入到达顺序队列的尾部
+ */
+static inline void fifo_add(struct request ** fifo, struct request * req)
+{
+        if (!*fifo) {
+                req->fifo_next = req->fifo_prev = req;
+                *fifo = req;
+                return;
+        }
+        req->fifo_next = *fifo;
+        req->fifo_prev = (*fifo)->fifo_prev;
+        (*fifo)->fifo_prev->fifo_next = req;
+        (*fifo)->fifo_prev = req;
+}
+
+/*
+ * 把请求项从到达顺序队列中移除
+ */
+static inline void fifo_del(struct request ** fifo, struct request * req)
+{
+        if (req->fifo_next == req)
+                *fifo = NULL;
+        else {
+                req->fifo_prev->fifo_next = req->fifo_next;
+                req->fifo_next->fifo_prev = req->fifo_prev;
+                if (*fifo == req)
+                        *fifo = req->fifo_next;
+        }
+        req->fifo_next = req->fifo_prev = NULL;
+}
+
+static void deadline_add_request(struct blk_dev_struct * dev, struct request * req)
+{
+        struct request * tmp = dev->current_request;
+
+        // 和电梯算法一样的单向扫描插入，只是不再让读请求项排在所有写请求项前面
+        for ( ; tmp->next ; tmp=tmp->next)
+                if ((SECTOR_ORDER(tmp,req) ||
+                     !SECTOR_ORDER(tmp,tmp->next)) &&
+                    SECTOR_ORDER(req,tmp->next))
+                        break;
+        req->next=tmp->next;
+        tmp->next=req;
+        req->deadline = jiffies + (req->cmd == READ ? DL_READ_EXPIRE : DL_WRITE_EXPIRE);
+        fifo_add(&dev->fifo[req->cmd],req);
+}
+
+static struct request * deadline_next_request(struct blk_dev_struct * dev)
+{
+        struct request * req, * pick, * tmp;
+        unsigned long flags;
+
+        save_flags(flags);
+        cli();
+        if (!(req = dev->current_request->next)) {
+                restore_flags(flags);
+                return NULL;
+        }
+        // 先看读队列，再看写队列中最老的请求项是否已经到期
+        pick = req;
+        if ((tmp = dev->fifo[READ]) && (long) (jiffies - tmp->deadline) >= 0)
+                pick = tmp;
+        else if ((tmp = dev->fifo[WRITE]) && (long) (jiffies - tmp->deadline) >= 0)
+                pick = tmp;
+        fifo_del(&dev->fifo[pick->cmd],pick);
+        // 把链表旋转成以pick开头：pick后面的部分照旧扫描，pick前面的部分接到最后
+        if (pick != req) {
+                for (tmp = req ; tmp->next != pick ; tmp = tmp->next)
+                        /* nothing */ ;
+                tmp->next = NULL;
+                for (tmp = pick ; tmp->next ; tmp = tmp->next)
+                        /* nothing */ ;
+                tmp->next = req;
+        }
+        restore_flags(flags);
+        return pick;
+}
+
+struct iosched_ops deadline_iosched = {
+        "deadline",
+        deadline_add_request,
+        deadline_next_request
+};
+
 /*
  * 往“块设备项”的”请求链表“中加入一个“请求项”
  *
@@ -122,23 +249,67 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
         if (req->bh)
                 req->bh->b_dirt = 0; // 复位请求项中高速缓冲块的“脏”标志位
         // tmp被赋值为dev的current_request域
+        req->queue_time = jiffies;
         if (!(tmp = dev->current_request)) { // dev中的current_request指针为空
                 dev->current_request = req; // 设置current_request为req
+                req->start_time = jiffies;
                 sti(); // 打开中断
                 (dev->request_fn)(); // 立刻执行块设备请求函数（对应硬盘就是 do_hd_request）
                 return;
         }
-        // 遍历对应设备的请求链表数组，根据电梯算法把req项插入到合适的位置
-        for ( ; tmp->next ; tmp=tmp->next)
-                // （tmp的优先级比req高 或者 tmp的优化级不高于tmp->next） 并且 （req的优先级比tmp->next来的高）
-                if ((IN_ORDER(tmp,req) || 
-                     !IN_ORDER(tmp,tmp->next)) &&
-                    IN_ORDER(req,tmp->next))
-                        break; // 找到对应的项
-        // 插入到tmp项的后面
-        req->next=tmp->next; // req的下一项请求指针指向tmp的下一项 
-        tmp->next=req; // tmp的下一项请求指针指向req
+        // 由设备的 I/O 调度器决定req在请求链表中的位置
+        dev->iosched->add_request(dev,req);
+        sti();
+}
+
+/*
+ * 尝试把缓冲块合并到设备请求链表中已有的请求项
+ *
+ * dev: 块设备项
+ * rw: 读写命令（READ 或 WRITE）
+ * bh: 已经锁定的高速缓冲块
+ *
+ * 返回：1 表示已经合并，0 表示需要新的请求项
+ *
+ * 同一设备，同样命令，扇区号正好接在某个请求项后面（向后合并）或者前面（向前合并）的缓冲块
+ * 挂到该请求项的缓冲块链表上，而不是再占用一个请求项，驱动程序就可以用一条多扇区命令读写整串缓冲块
+ *
+ * 链表的第一项可能已经交给驱动程序正在处理，不能再修改，所以从第二项开始查找
+ * 
+ */
+static int merge_request(struct blk_dev_struct * dev, int rw, struct buffer_head * bh)
+{
+        struct request * req;
+        unsigned long sector = bh->b_blocknr << 1;
+
+        cli(); // 请求链表会在中断中被修改
+        if (!(req = dev->current_request)) {
+                sti();
+                return 0;
+        }
+        for (req = req->next ; req ; req = req->next) {
+                if (req->dev != bh->b_dev || req->cmd != rw || !req->bh ||
+                    req->nr_sectors + 2 > MAX_SECTORS)
+                        continue;
+                if (req->sector + req->nr_sectors == sector) { // 向后合并
+                        req->bhtail->b_reqnext = bh;
+                        req->bhtail = bh;
+                } else if (req->sector == sector + 2) { // 向前合并
+                        bh->b_reqnext = req->bh;
+                        req->bh = bh;
+                        req->buffer = bh->b_data;
+                        req->current_nr_sectors = 2;
+                        req->sector = sector;
+                } else
+                        continue;
+                req->nr_sectors += 2;
+                bh->b_dirt = 0; // 和 add_request 一样：进入请求队列的缓冲块不再是“脏”的
+                dev->stats.merges++;
+                sti();
+                return 1;
+        }
         sti();
+        return 0;
 }
 
 /*
@@ -153,8 +324,9 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
  */
 static void make_request(int major,int rw, struct buffer_head * bh)
 {
+        struct blk_dev_struct * dev = major + blk_dev;
         struct request * req;
-        int rw_ahead;
+        int rw_ahead, slept = 0;
 
 /* WRITEA/READA is special case - it is not really needed, so if the */
 /* buffer is locked, we just forget about it, else it's a normal read */
@@ -182,7 +354,11 @@ static void make_request(int major,int rw, struct buffer_head * bh)
                 unlock_buffer(bh); // 解锁高速缓冲块
                 return; // 退出
         }
-        // 接下来在请求项数组队列中找到一个空闲项
+        bh->b_reqnext = NULL;
+        // 首先尝试合并到已经在队列中的相邻请求项
+        if (merge_request(dev,rw,bh))
+                return;
+        // 接下来在本设备的请求项池中找到一个空闲项
 repeat:
 /* we don't allow the write-requests to fill up the queue completely:
  * we want some room for reads: they take precedence. The last third
@@ -190,25 +366,30 @@ repeat:
  */
         /*
          * 不能让所有的队列都是写请求项，因为读请求项优先级远高于写
-         * 所以为读请求项预留一些空间，最后1/3的部分只保留给读请求
+         * 所以为读请求项预留一些空间，队列深度中最后1/3的部分只保留给读请求
          */
         if (rw == READ)
-                req = request+NR_REQUEST; // 读请求项可以搜索整个队列
+                req = dev->pool+dev->depth; // 读请求项可以搜索整个队列深度
         else
-                req = request+((NR_REQUEST*2)/3); // 写请求项只能从最开始到2/3队列之间搜索
+                req = dev->pool+(dev->depth-dev->depth/3); // 写请求项只能从最开始到2/3队列深度之间搜索
 /* find an empty request */
-        while (--req >= request) // 从后往前遍历
+        while (--req >= dev->pool) // 从后往前遍历
                 if (req->dev<0) // 对应项的dev域 < 0 : 表示这项是空闲可用的
                         break; // 找到空闲项，终止遍历
 /* if none found, sleep on new requests: check for rw_ahead */
-        if (req < request) { // 遍历完毕，依旧无法找到空闲项 
+        if (req < dev->pool) { // 遍历完毕，依旧无法找到空闲项 
                 if (rw_ahead) { // 如果是“预”读/写请求
                         unlock_buffer(bh); // 释放高速缓冲块，直接返回
                         return;
                 }
-                sleep_on(&wait_for_request); // 当前进程加入等待空闲项的等待队列
+                dev->stats.waits++;
+                if (slept++) // 被唤醒以后空闲项又被别人用掉了
+                        wait_stats.spurious++;
+                sleep_on_queue_exclusive(&dev->wait_for_request[rw]); // 当前进程加入等待本设备空闲项的等待队列
                 goto repeat; // 被唤醒后重新开始搜索空闲请求项
         }
+        if (++dev->stats.in_flight > dev->stats.max_in_flight)
+                dev->stats.max_in_flight = dev->stats.in_flight;
 /* fill up the request-info, and add it to the queue */
 
         // 执行到这里表示已经在请求项队列中找到一项空闲的请求项
@@ -217,12 +398,14 @@ repeat:
         req->cmd = rw; // 读写命令
         req->errors=0; // 操作错误数初始化为0
         req->sector = bh->b_blocknr<<1; // 起始扇区，块号转换成扇区号（1块对应1024字节，1扇区对应512字节，因此1块=2扇区）
-        req->nr_sectors = 2; // 本请求项需要读写的扇区数 = 2 （1块）
+        req->nr_sectors = 2; // 本请求项需要读写的扇区数 = 2 （1块），之后可能因为合并而增加
+        req->current_nr_sectors = 2;
         req->buffer = bh->b_data; // “请求项”的“缓冲区”指针指向“高速缓冲块”头指针中的“数据区”
         req->waiting = NULL; // 等待本次操作执行完成的进程队列初始化为空
         req->bh = bh; // 本次操作的高速缓冲块头指针
+        req->bhtail = bh;
         req->next = NULL; // 下一项请求指针初始化为空
-        add_request(major+blk_dev,req); // 将“请求项”插入到对应“块设备项”的“请求项链表“中
+        add_request(dev,req); // 将“请求项”插入到对应“块设备项”的“请求项链表“中
 }
 
 /**
@@ -255,17 +438,118 @@ void ll_rw_block(int rw, struct buffer_head * bh)
         make_request(major,rw,bh); // 创建对应的块设备请求项
 }
 
+/*
+ * 结束设备请求链表的第一项：由驱动程序的 end_request 调用（通常在中断中）
+ *
+ * dev: 块设备项
+ *
+ * 返回：I/O 调度器选出的下一个请求项，NULL 表示没有请求项了
+ *
+ * 释放请求项，记录统计信息，唤醒等待本设备空闲请求项的进程
+ * 
+ */
+struct request * end_queue_request(struct blk_dev_struct * dev)
+{
+        struct request * req = dev->current_request, * next;
+        int n;
+
+        dev->stats.requests[req->cmd]++;
+        dev->stats.service_ticks += jiffies - req->start_time;
+        dev->stats.in_flight--;
+        next = dev->iosched->next_request(dev);
+        req->dev = -1; // 释放该读写请求项：dev = -1 表示该请求项“空闲” 
+        // 只唤醒一个能用这一项的等待者：后 1/3 只能给读请求，前 2/3 读写都可以用，读请求优先
+        n = req - dev->pool;
+        if (n < dev->depth && !wake_up_queue(&dev->wait_for_request[READ]) &&
+            n < dev->depth - dev->depth/3)
+                wake_up_queue(&dev->wait_for_request[WRITE]);
+        if (next) {
+                next->start_time = jiffies;
+                dev->stats.queue_ticks += jiffies - next->queue_time;
+        }
+        return next;
+}
+
+/*
+ * 块设备的 ioctl：读取请求队列的统计信息，调整队列深度
+ *
+ * dev: 设备号
+ * cmd: BLKGETSTATS 或 BLKSETDEPTH
+ * arg: BLKGETSTATS 时是用户空间 struct blk_stats 的指针，BLKSETDEPTH 时是新的队列深度
+ *
+ * 返回：成功返回 0，失败返回出错码
+ * 
+ */
+int blk_ioctl(int dev, int cmd, int arg)
+{
+        struct blk_dev_struct * bdev;
+        int i;
+
+        if (MAJOR(dev) >= NR_BLK_DEV || !(bdev = MAJOR(dev) + blk_dev)->nr_pool)
+                return -ENODEV;
+        switch (cmd) {
+		case BLKGETSTATS:
+                        bdev->stats.depth = bdev->depth;
+                        bdev->stats.nr_pool = bdev->nr_pool;
+                        verify_area((void *) arg, sizeof (struct blk_stats));
+                        for (i=0 ; i < sizeof (struct blk_stats) ; i++)
+                                put_fs_byte(((char *) &bdev->stats)[i], i + (char *) arg);
+                        return 0;
+		case BLKSETDEPTH:
+                        if (!suser())
+                                return -EPERM;
+                        if (arg < 1 || arg > bdev->nr_pool)
+                                return -EINVAL;
+                        // 深度变小时超出部分正在使用的请求项照常完成，只是不会再被分配出去
+                        bdev->depth = arg;
+                        wake_up_queue_all(&bdev->wait_for_request[READ]);
+                        wake_up_queue_all(&bdev->wait_for_request[WRITE]);
+                        return 0;
+		default:
+                        return -EINVAL;
+        }
+}
+
+/*
+ * 打印各个块设备请求队列的统计信息：由 show_stat 调用
+ */
+void show_blk_stats(void)
+{
+        int i;
+        struct blk_stats * s;
+
+        for (i=0 ; i<NR_BLK_DEV ; i++) {
+                if (!blk_dev[i].nr_pool || !blk_dev[i].request_fn)
+                        continue;
+                s = &blk_dev[i].stats;
+                printk("blkdev %d (%s): depth %d/%d, %d in flight (max %d), %d waits\n\r",
+                       i,blk_dev[i].iosched->name,blk_dev[i].depth,blk_dev[i].nr_pool,
+                       s->in_flight,s->max_in_flight,s->waits);
+                printk("  %d reads, %d writes, %d merges, %d ticks queued, %d ticks in service\n\r",
+                       s->requests[READ],s->requests[WRITE],s->merges,
+                       s->queue_ticks,s->service_ticks);
+        }
+}
+
 /**
  * 块设备系统初始化: 由初始化程序'init/main.c'调用
  * 
  */
 void blk_dev_init(void)
 {
-        int i;
+        int i, n = 0;
 
-        // 初始化“块设备请求项”数组的“请求项”，总共32项
+        // 初始化“块设备请求项”数组的“请求项”，总共48项
         for (i=0 ; i<NR_REQUEST ; i++) {
                 request[i].dev = -1; // -1 表示这个请求项空闲
                 request[i].next = NULL; // NULL 表示没有下一个请求
         }
+        // 按 nr_pool 把请求项数组划分给各个块设备，初始队列深度就是整个池
+        for (i=0 ; i<NR_BLK_DEV ; i++) {
+                if (n + blk_dev[i].nr_pool > NR_REQUEST)
+                        panic("blk_dev_init: request pools exceed NR_REQUEST");
+                blk_dev[i].pool = request + n;
+                blk_dev[i].depth = blk_dev[i].nr_pool;
+                n += blk_dev[i].nr_pool;
+        }
 }
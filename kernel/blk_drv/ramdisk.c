@@ -48,8 +48,8 @@ void do_rd_request(void)
         INIT_REQUEST; // 检测请求项的合法性，如果没有请求项则退出
         // 计算当前请求项在RAM盘中的起始地址
         addr = rd_start + (CURRENT->sector << 9); // 一个扇区对应512字节，因此CURRENT->sector << 9 实际上计算的就是“扇区数 * 512”
-        // 同样计算当前请求项要读写的数据长度（字节）
-        len = CURRENT->nr_sectors << 9;
+        // 同样计算当前缓冲块要读写的数据长度（字节）：合并后的请求项中各缓冲块并不连续，每次只处理一块
+        len = CURRENT->current_nr_sectors << 9;
         // 当前请求项的主设备号 != 1 或 当前请求项的结尾地址 > RAM盘的起始地址 + RAM盘的大小
         if ((MINOR(CURRENT->dev) != 1) || (addr+len > rd_start+rd_length)) {
                 end_request(0); // 结束该请求项，打印错误信息，并转向下一个请求项 
@@ -649,6 +649,33 @@ static void restore_cur(void)
         gotoxy(saved_x, saved_y);
 }
 
+/*
+ * 把写队列中接下来的一串普通可显示字符直接写到显存中，最多 nr 个
+ *
+ * 返回：写入的字符数
+ *
+ * 一串字符在本行末尾，队列缓冲区的末端或者第一个不可显示的字符处结束：
+ * 这段字符不需要换行，不会改变 state，也没有转义序列，不用再逐个字符经过 con_write 中的状态机
+ */
+static inline int con_write_run(struct tty_queue * q, int nr)
+{
+        unsigned short * p = (unsigned short *) pos;
+        unsigned short a = attr << 8;
+        char * s = q->buf + q->tail;
+        int i;
+
+        if (nr > TTY_BUF_SIZE - q->tail) // 不跨过队列缓冲区的末端
+                nr = TTY_BUF_SIZE - q->tail;
+        if (nr > video_num_columns - x) // 不跨过本行的末尾
+                nr = video_num_columns - x;
+        for (i = 0 ; i < nr && s[i] > 31 && s[i] < 127 ; i++)
+                *p++ = a | s[i];
+        q->tail = (q->tail + i) & (TTY_BUF_SIZE-1);
+        pos += i<<1;
+        x += i;
+        return i;
+}
+
 /**
  * 控制台终端写函数
  *
@@ -698,6 +725,8 @@ void con_write(struct tty_struct * tty)
                                         ); // 把获取的字符写入当前光标位置
                                 pos += 2; // 当前光标的内存位置增加2字节
                                 x++; // 列数增1：也就是光标向右移一列
+                                if (nr) // 后面紧跟着的普通字符一次写到本行中
+                                        nr -= con_write_run(&tty->write_q,nr);
                         } else if (c==27) // c是转义字符'Esc'
                                 state=1; // 转换状态state到1（处理转义序列）
                         else if (c==10 || c==11 || c==12) // c是换行符LF(10) 或 垂直制表符VT(11) 或 换页符FF(12)
@@ -1005,7 +1034,13 @@ void sysbeepstop(void)
         outb(inb_p(0x61)&0xFC, 0x61); // 禁止定时器2
 }
 
-int beepcount = 0; //蜂鸣时间滴答计数
+// 蜂鸣定时器：到期时停止蜂鸣
+static void beep_timer_expire(unsigned long data)
+{
+        sysbeepstop();
+}
+
+static struct timer_list beep_timer = { NULL, NULL, 0, 0, beep_timer_expire };
 
 
 /**
@@ -1028,5 +1063,5 @@ static void sysbeep(void)
         outb_p(0x37, 0x42); // 0x37：0x637的低字节，0x42：定时器2芯片的数据寄存器端口
         outb(0x06, 0x42); // 0x06：0x637的高字节，0x42：定时器2芯片的数据寄存器端口
         /* 1/8 second */
-        beepcount = HZ/8; // 蜂鸣时间为100/8个滴答，每个滴答是10ms，所以蜂鸣时间为1000/8ms，也就是1/8s
+        mod_timer(&beep_timer, jiffies + HZ/8); // 蜂鸣时间为100/8个滴答，每个滴答是10ms，所以蜂鸣时间为1000/8ms，也就是1/8s
 }
@@ -159,6 +159,23 @@ read_char:
 	addl $4,%esp # 丢弃入栈参数
 	ret # 返回到rep_int处
 
+	// 唤醒在写缓冲队列(ecx)上等待的进程（包括在 select 中等待的进程）
+	// proc_list 是等待队列，要调用 wake_up_queue 把任务放入就绪队列，不能直接修改任务状态
+	// C 函数会改变 eax, ecx, edx：保存写队列地址和端口地址
+.align 2
+wake_writers:
+	cmpl $0,proc_list(%ecx)		# is there any? # 没有等待的进程，直接返回
+	je 1f
+	pushl %ecx
+	pushl %edx
+	leal proc_list(%ecx),%eax
+	pushl %eax
+	call wake_up_queue
+	addl $4,%esp
+	popl %edx
+	popl %ecx
+1:	ret
+
 	// 从写缓冲队列中写字符到串口发送寄存器：
 	// 由于设置了发送保存寄存器允许此中断标志，说明对应的串行终端写缓存队列中有字符需要发送
 .align 2
@@ -170,11 +187,7 @@ write_char:
 	je write_buffer_empty # 写队列为空，跳转到write_buffer_empty处理
 	cmpl $startup,%ebx # 比较队列中字符是否超过256个
 	ja 1f # 超过256个字符，跳转到标号1执行
-	movl proc_list(%ecx),%ebx	# wake up sleeping process # 等待终端的进程结构指针地址 -> ebx：少于256个字符，唤醒写终端的进程！
-	testl %ebx,%ebx			# is there any? # 测试是否存在等待终端写的进程
-	je 1f # 没有等待终端写的进程，跳转到标号1处执行
-	movl $0,(%ebx) # 设置等待进程的状态为可执行状态(0)，注意：可执行状态是进程结构的第一个字段，因此可以用(%ebx)来表示
-	# 这段逻辑可以和GETCH宏做比较
+	call wake_writers	# wake up sleeping process # 少于256个字符，唤醒写终端的进程！
 1:	movl tail(%ecx),%ebx # 取尾指针 -> ebx 
 	movb buf(%ecx,%ebx),%al # 从写队列的数据缓冲区取一个字符 -> al 
 	outb %al,%dx # 发送要写的字符到发送保存寄存器（端口0x3f8或0x2f8）
@@ -190,11 +203,8 @@ write_char:
 	// 2. 暂时禁止发送保存寄存器THR空时发出中断
 .align 2
 write_buffer_empty:
-	movl proc_list(%ecx),%ebx	# wake up sleeping process
-	testl %ebx,%ebx			# is there any?
-	je 1f
-	movl $0,(%ebx) #这段逻辑和上面一样
-1:	incl %edx # 串行端口基地址 + 1 : 中断允许寄存器IER(0x3f9或0x2f9)
+	call wake_writers	# wake up sleeping process # 这段逻辑和上面一样
+	incl %edx # 串行端口基地址 + 1 : 中断允许寄存器IER(0x3f9或0x2f9)
 	inb %dx,%al #读取中断允许寄存器的状态字 -> al 
 	jmp 1f # 空指令
 1:	jmp 1f # 空指令
@@ -18,6 +18,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
+#include <fcntl.h> // 文件控制头文件：O_NONBLOCK
+#include <string.h> // 字符串头文件：memcpy
 
 #define ALRMMASK (1<<(SIGALRM-1)) // Alarm信号在信号位图中对应的位屏蔽位
 #define KILLMASK (1<<(SIGKILL-1)) // Kill信号在信号位图中对应的位屏蔽位
@@ -156,8 +158,10 @@ void tty_intr(struct tty_struct * tty, int mask)
         if (tty->pgrp <= 0) // 终端的进程组号非大于0（无进程组），直接返回
                 return;
         for (i=0;i<NR_TASKS;i++)
-                if (task[i] && task[i]->pgrp==tty->pgrp) // 找到进程组号等于该终端进程组号的所有进程
+                if (task[i] && task[i]->pgrp==tty->pgrp) { // 找到进程组号等于该终端进程组号的所有进程
                         task[i]->signal |= mask; // 置位“该进程”中“进程位图”的相应位（实际上就是发送某个信号给进程）
+                        signal_wake_up(task[i]); // 唤醒可中断睡眠中的进程
+                }
 }
 
 /*
@@ -172,7 +176,7 @@ static void sleep_if_empty(struct tty_queue * queue)
 {
         cli(); // 关闭中断
         while (!current->signal && EMPTY(*queue)) // 如果当前进程没有信号需要处理，并且指定的缓冲队列空 
-                interruptible_sleep_on(&queue->proc_list); // 让进程进入可中断的睡眠状态，并且让队列的进程等待指针设置为当前进程
+                interruptible_sleep_on_queue(&queue->proc_list); // 让进程进入可中断的睡眠状态，并且把当前进程加入队列的等待队列
         sti(); // 开启中断
 }
 
@@ -190,7 +194,7 @@ static void sleep_if_full(struct tty_queue * queue)
                 return; 
         cli(); // 关闭中断
         while (!current->signal && LEFT(*queue)<128) // 如果当前进程没有信号需要处理，比且剩余空间 < 128字节
-                interruptible_sleep_on(&queue->proc_list); // 让进程进入可中断的睡眠状态，并且让队列的进程等待指针设置为当前进程
+                interruptible_sleep_on_queue(&queue->proc_list); // 让进程进入可中断的睡眠状态，并且把当前进程加入队列的等待队列
         sti(); // 开启中断
 }
 
@@ -301,7 +305,7 @@ void copy_to_cooked(struct tty_struct * tty)
                 }
                 PUTCH(c,tty->secondary); // 把字符放入到辅助队列中，并且头指针 + 1 
         }
-        wake_up(&tty->secondary.proc_list); // 唤醒等待“该辅助队列为空”的其他进程（如果有的话）
+        wake_up_queue(&tty->secondary.proc_list); // 唤醒等待“该辅助队列为空”的其他进程（如果有的话），以及在 select 中等待的进程
 }
 
 
@@ -311,11 +315,12 @@ void copy_to_cooked(struct tty_struct * tty)
  * channel: 子设备号
  * buf: 用户缓冲区指针
  * nr: 欲读字节数
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时辅助队列中没有可读的数据不睡眠
  *
- * 成功：返回读取到的字符数，失败：返回错误号
+ * 成功：返回读取到的字符数，失败：返回错误号；非阻塞读时一个字符都没有读到返回 -EAGAIN
  * 
  */
-int tty_read(unsigned channel, char * buf, int nr)
+int tty_read(unsigned channel, char * buf, int nr, unsigned short flags)
 {
         struct tty_struct * tty;
         char c, *b=buf;
@@ -331,7 +336,7 @@ int tty_read(unsigned channel, char * buf, int nr)
                 minimum=1; // 设置至少要读一个字符
                 // 这里设置是否要超时的flag
                 if ((flag=(!oldalarm || time+jiffies<oldalarm))) // 当前报警定时值为空 或 读超时的时间比报警定时要早
-                        current->alarm = time+jiffies; // 设置当前进程的报警定时为读操作超时时刻
+                        set_alarm(current, time+jiffies); // 设置当前进程的报警定时为读操作超时时刻
         }
         if (minimum>nr) // 至少要读的字符数 > 想要读的字符数
                 minimum=nr; // 设置最小要读的字符为“想要读的字符数”
@@ -348,6 +353,8 @@ int tty_read(unsigned channel, char * buf, int nr)
                 // 2. 处于规范模式下 并且 辅助队列的数据不满一行 并且 辅助队列的空闲字节数 > 20 
                 if (EMPTY(tty->secondary) || (L_CANON(tty) &&
                                               !tty->secondary.data && LEFT(tty->secondary)>20)) {
+                        if (flags & O_NONBLOCK) // 非阻塞读：返回已经读到的字符
+                                break;
                         sleep_if_empty(&tty->secondary); // 当前进程进入可中断的睡眠状态
                         continue; // 从头开始执行循环
                 }
@@ -371,9 +378,9 @@ int tty_read(unsigned channel, char * buf, int nr)
                         // 这里再次设置是否超时的flag值
                         // 注意：实际上这里是为了处理辅助队列为空，让其他进程有时间写入辅助读列。但这里的逻辑比较混乱，后面版本重写过超时的逻辑
                         if ((flag=(!oldalarm || time+jiffies<oldalarm))) // 当前报警定时值为空 或 读超时的时间比报警定时要早
-                                current->alarm = time+jiffies; // 设置当前进程的报警定时为读操作超时时刻
+                                set_alarm(current, time+jiffies); // 设置当前进程的报警定时为读操作超时时刻
                         else
-                                current->alarm = oldalarm; // 当前进程的报警定时恢复为原来设置的报警定时
+                                set_alarm(current, oldalarm); // 当前进程的报警定时恢复为原来设置的报警定时
                 }
                 if (L_CANON(tty)) { // 规范模式
                         if (b-buf) // 已经读取了至少一个字符
@@ -381,36 +388,92 @@ int tty_read(unsigned channel, char * buf, int nr)
                 } else if (b-buf >= minimum) // 非规范模式下，读取的字符数超过了最少要读的字符数
                         break; // 中断最外层循环
         }
-        current->alarm = oldalarm; // 当前进程的报警定时恢复为原来设置的报警定时
+        set_alarm(current, oldalarm); // 当前进程的报警定时恢复为原来设置的报警定时
         if (current->signal && !(b-buf)) // 已经捕获到信号 并且 没有读取到任何的字符
                 return -EINTR; // 返回 EINTR（被信号中断）做为错误值
+        if ((flags & O_NONBLOCK) && !(b-buf)) // 非阻塞读并且没有读取到任何的字符
+                return -EAGAIN;
         return (b-buf); // 返回已经读取到的字符数
 }
 
+/**
+ * 检查终端是否可读，可写（由 select 调用）
+ *
+ * channel: 子设备号
+ * flag: SEL_IN, SEL_OUT 或 SEL_EX
+ * wait: 没有就绪时把当前进程挂到对应的等待队列上，NULL 表示只检查
+ *
+ * 返回：就绪返回 1，否则返回 0
+ *
+ * 就绪的条件和 tty_read, tty_write 睡眠的条件相反：可读时 tty_read 不会睡眠，可写时 tty_write 至少能写入一些字符
+ */
+int tty_select(unsigned channel, int flag, select_table * wait)
+{
+        struct tty_struct * tty;
+
+        if (channel>2) // 终端子设备号非法：让 read/write 去报告错误
+                return 1;
+        tty = &tty_table[channel];
+        switch (flag) {
+                case SEL_IN:
+                        if (!EMPTY(tty->secondary) && (!L_CANON(tty) ||
+                            tty->secondary.data || LEFT(tty->secondary)<=20))
+                                return 1;
+                        select_wait(&tty->secondary.proc_list,wait);
+                        return 0;
+                case SEL_OUT:
+                        if (!FULL(tty->write_q))
+                                return 1;
+                        select_wait(&tty->write_q.proc_list,wait);
+                        return 0;
+        }
+        return 0;
+}
+
 /**
  * 写终端函数：把用户缓冲区的字符写入到指定的终端去
  *
  * channel: 子设备号
  * buf: 用户缓冲区指针
  * nr: 欲写的字节数
+ * flags: 文件的打开标志，设置了 O_NONBLOCK 时写队列满了不睡眠
  *
- * 成功：返回写入的字符数，失败：返回错误号
+ * 成功：返回写入的字符数，失败：返回错误号；非阻塞写时一个字符都没有写入返回 -EAGAIN
  * 
  */
-int tty_write(unsigned channel, char * buf, int nr)
+int tty_write(unsigned channel, char * buf, int nr, unsigned short flags)
 {
         static int cr_flag = 0; // 回车处理标志
         struct tty_struct *tty;
         char c, *b=buf;
+        char bulk[64]; // 成块写入时的中转缓冲区
+        int chars;
 
         if (channel>2 || nr<0) // 终端子设备号 或 欲写字节数 非法，直接返回-1
                 return -1;
         tty = channel + tty_table; // 获得对应的终端结构指针
         // 开始从用户缓冲区中读取字符放入到终端写队列的循环
         while (nr>0) { // 要写的字节数 > 0 
+                if ((flags & O_NONBLOCK) && FULL(tty->write_q)) // 非阻塞写：写队列满了就返回已经写入的字符数
+                        break;
                 sleep_if_full(&tty->write_q); // 如果终端写队列满了，则当前进程进入可中断的睡眠状态 
                 if (current->signal) // 当前进程有信号要处理
                         break; // 直接退出最外层循环
+                // 不执行输出处理：字符原样成块放入写队列
+                // 先复制到栈上的 bulk 中：从用户空间复制可能因为缺页而睡眠，期间别的进程也可能在写这个终端，
+                // 所以复制完再取头指针和空闲空间，放入队列时不会再睡眠；放不下的部分下一次重新复制
+                while (nr>0 && !O_POST(tty) && !FULL(tty->write_q)) {
+                        chars = (nr < sizeof (bulk)) ? nr : sizeof (bulk);
+                        memcpy_fromfs(bulk,b,chars);
+                        if (chars > LEFT(tty->write_q))
+                                chars = LEFT(tty->write_q);
+                        if (chars > TTY_BUF_SIZE - tty->write_q.head)
+                                chars = TTY_BUF_SIZE - tty->write_q.head;
+                        memcpy(tty->write_q.buf + tty->write_q.head,bulk,chars);
+                        tty->write_q.head = (tty->write_q.head + chars) & (TTY_BUF_SIZE-1);
+                        b += chars; nr -= chars;
+                        cr_flag = 0;
+                }
                 while (nr>0 && !FULL(tty->write_q)) { // 还有要写的字节 并且 终端写队列不满
                         c = get_fs_byte(b); // 从用户缓冲区读取一个字符到变量c
                         if (O_POST(tty)) { // 执行输出处理
@@ -436,10 +499,12 @@ int tty_write(unsigned channel, char * buf, int nr)
                 
                 // 无论哪种情况，都先把终端写队列中当前的字符序列输出到真正的终端设备去
                 tty->write(tty); // 控制台：调用con_write()，串行口：调用rs_write()
-                if (nr>0) // 如果还有要写的字符：说明终端写队列已满
+                if (nr>0 && !(flags & O_NONBLOCK)) // 如果还有要写的字符：说明终端写队列已满
                         schedule(); // 调度其他任务，等待上面的输出操作使得写队列不满
         }
         
+        if ((flags & O_NONBLOCK) && nr>0 && !(b - buf)) // 非阻塞写并且一个字符都没有写入
+                return -EAGAIN;
         return (b - buf); // 返回写成功的字节数
 }
 
@@ -58,9 +58,10 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
         // 1. 带有强制发送标志
         // 2. 当前进程的有效用户ID == 进程 p 的有效用户ID
         // 3. 当前进程的有效用户是root（suser() 等级 current->euid == 0）
-        if (priv || (current->euid==p->euid) || suser())
+        if (priv || (current->euid==p->euid) || suser()) {
                 p->signal |= (1<<(sig-1)); // p 进程结构中的 signal域里 sig 对应位置 1 
-        else
+                signal_wake_up(p); // 如果 p 正在可中断地睡眠，则唤醒它
+        } else
                 return -EPERM; // 没有权限发送，返回错误号 -EPERM 
         return 0;
 }
@@ -73,8 +74,10 @@ static void kill_session(void)
         // 从末尾开始扫描整个任务结构数组
         while (--p > &FIRST_TASK) {
                 // 找到所有进程，其“会话号”就是当前进程的“会话号”
-                if (*p && (*p)->session == current->session)
+                if (*p && (*p)->session == current->session) {
                         (*p)->signal |= 1<<(SIGHUP-1); // 当前会话中的进程的信号位图里的 SIGHUP 位置 1，默认动作是终止该进程
+                        signal_wake_up(*p);
+                }
         }
 }
 
@@ -155,6 +158,7 @@ static void tell_father(int pid)
                         if (task[i]->pid != pid)
                                 continue;
                         task[i]->signal |= (1<<(SIGCHLD-1));
+                        signal_wake_up(task[i]);
                         return;
                 }
 /* if we don't find any fathers, we just release ourselves */
@@ -177,8 +181,13 @@ int do_exit(long code)
         int i;
         // 释放当前进程代码段和数据段所占的内存页面
         // get_limit 从段选择子指定的段描述符中获取对应的段限制长度
-        free_page_tables(get_base(current->ldt[1]),get_limit(0x0f)); // current->ldt[1] 进程的代码段基地址, 0x0f:  代码段选择子
-        free_page_tables(get_base(current->ldt[2]),get_limit(0x17)); // current->ldt[2] 进程的数据段基地址， 0x17: 数据段选择子
+        // vfork 创建的进程借用的是父进程的页表，不能释放，放还给父进程即可
+        if (current->vfork_mm)
+                vfork_release();
+        else {
+                free_page_tables(get_base(current->ldt[1]),get_limit(0x0f)); // current->ldt[1] 进程的代码段基地址, 0x0f:  代码段选择子
+                free_page_tables(get_base(current->ldt[2]),get_limit(0x17)); // current->ldt[2] 进程的数据段基地址， 0x17: 数据段选择子
+        }
 
 // 遍历进程结构指针数组
         for (i=0 ; i<NR_TASKS ; i++) {
@@ -204,6 +213,7 @@ int do_exit(long code)
         current->root=NULL;
         iput(current->executable);
         current->executable=NULL;
+        exit_mmap(current); // 放弃文件映射区，映射的页面前面已经随页表释放
 
         // 如果当前进程是会话的首进程，而且当前进程打开了终端
         if (current->leader && current->tty >= 0)
@@ -217,7 +227,10 @@ int do_exit(long code)
         if (current->leader)
                 kill_session();
 
-        // 当前进程状态设置为僵尸状态
+        // 取消报警定时器，否则进程结构被释放后时间轮上还会挂着它
+        set_alarm(current, 0);
+
+        // 当前进程状态设置为僵尸状态，随后的 schedule() 会把它从就绪队列中取下
         current->state = TASK_ZOMBIE; // 一个已经终止，但是其父进程尚未对其进行善后处理(获取终止子进程的有关信息)的进程被称为僵尸进程!!! 
         current->exit_code = code; // 设置当前进程返回码
         tell_father(current->father); // 发送 SIGCHLD 给父进程
@@ -102,10 +102,14 @@ int copy_mem(int nr,struct task_struct * p)
  * 2. 刚进入 system_call 函数时压入的段寄存器 ds, es, fs, 和通用寄存器 edx, ecx, ebx
  * 3. 调用 sys_call_table 中 sys_fork 时压入的返回地址：参数 none
  * 4. sys_fork 中调用 copy_process 前入栈的 gs, esi, edi, ebp, eax(参数nr)
+ * 5. sys_fork 压入 0，sys_vfork 压入 1：参数 share_vm
+ *
+ * share_vm 为 1 时（vfork）不复制页表：子进程直接借用父进程的线性地址空间，
+ * 父进程睡眠，直到子进程 execve 或者退出时放还地址空间。这样 vfork + execve 的开销与父进程的大小无关
  *
  * 返回值：成功返回“当前最新进程号”，失败返回错误号
  */
-int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
+int copy_process(int share_vm,int nr,long ebp,long edi,long esi,long gs,long none,
                  long ebx,long ecx,long edx,
                  long fs,long es,long ds,
                  long eip,long cs,long eflags,long esp,long ss)
@@ -113,6 +117,7 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
         struct task_struct *p;
         int i;
         struct file *f;
+        long pid = last_pid; // find_empty_process 刚取得的进程号：get_free_page 可能睡眠，期间 last_pid 可能被别的进程改变
 
         // 为新的任务结构分配一页新的物理内存
         // 注意，这里的 p 返回的是物理地址，而非线性地址！！
@@ -121,21 +126,32 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
         p = (struct task_struct *) get_free_page(); 
         if (!p)
                 return -EAGAIN; // 如果分配内存出错，返回 -EAGAIN 
+        if (task[nr]) { // 睡眠期间任务槽已经被别的进程占用
+                free_page((long) p);
+                return -EAGAIN;
+        }
         task[nr] = p; // 设置内核结构数组中对应的任务槽
         // 复制当前进程的结构到新进程结构中（会有字段拷贝）
         // 注意：这不会复制内核堆栈！！！
         *p = *current;	/* NOTE! this doesn't copy the supervisor stack */
         p->state = TASK_UNINTERRUPTIBLE; // 新进程状态为”信号不可中断睡眠“
-        p->pid = last_pid; // 设置新进程ID
+        p->pid = pid; // 设置新进程ID
         p->father = current->pid; // 设置新进程的父进程ID为当前进程ID  
         p->counter = p->priority; // 设置任务运行时间片（滴答数，一般为15）
         p->signal = 0; // 设置新进程信号位图
         p->alarm = 0; // 设置新进程的计时器（滴答数）
+        init_timer(&p->alarm_timer); // 报警定时器不能继承父进程在时间轮上的链接
+        p->vfork_mm = share_vm;
+        p->vfork_wait = NULL;
         // 设置进程的领头进程ID，注意：这个不能被继承
         p->leader = 0;		/* process leadership doesn't inherit */
         p->utime = p->stime = 0; // 设置新进程的用户运行时间，内核运行时间为0
         p->cutime = p->cstime = 0; // 设置新进程的子进程运行时间，子进程内核运行时间为0
         p->start_time = jiffies; // 设置新进程的开始运行时间为”当前滴答数“
+        // 父进程的就绪队列链接不能继承，子进程在最后被 wake_up_process() 放入就绪队列
+        // run_epoch 继承自正在运行的父进程，已经是当前的调度纪元
+        p->run_next = p->run_prev = NULL;
+        p->task_nr = nr;
         // 开始设置任务状态段数据
         p->tss.back_link = 0;
         // 由于 p 处于一个新分配的页面物理内存开始处，所以 PAGE_SIZE + p 正好处于下一个物理页面的开始处
@@ -174,7 +190,8 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
         // 复制进程页表：
         // 1. 在新进程任务结构的”局部描述符表“中设置对应”局部代码段“和”局部数据段“的描述符
         // 2. 复制当前进程的”页目录项“和”页表项“
-        if (copy_mem(nr,p)) {
+        // vfork: 子进程的 start_code 和局部描述符表都和父进程一样，共用父进程的页表
+        if (!share_vm && copy_mem(nr,p)) {
                 // 复制进程页表出错
                 task[nr] = NULL; 
                 free_page((long) p);
@@ -194,14 +211,27 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
                 current->root->i_count++;
         if (current->executable)
                 current->executable->i_count++;
+        dup_mmap(p); // 子进程继承文件映射区
         
         // 最后在 GDT 表中设置新任务对应的 TSS(nr) 和 LDT(nr) 的描述符
         // 其段基础地址用的是 p-> tss , p-> ldt 的指针值，而段限长均为 104字节
         // 对于内核而言，逻辑地址 = 线性地址 = 物理地址，还记得吗？ :-) 
         set_tss_desc(gdt+(nr<<1)+FIRST_TSS_ENTRY,&(p->tss));
         set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
-        p->state = TASK_RUNNING; // 子进程的状态设置”就绪“	/* do this last, just in case */
-        return last_pid; // 父进程返回”最新的进程ID“
+        wake_up_process(p); // 子进程的状态设置”就绪“，并放入就绪队列	/* do this last, just in case */
+        // vfork: 等待子进程放还地址空间。睡眠期间 last_pid 可能改变，子进程还没有被回收（只有父进程能回收它），p 仍然有效
+        while (share_vm && p->vfork_mm)
+                sleep_on(&p->vfork_wait);
+        return p->pid; // 父进程返回”最新的进程ID“
+}
+
+/**
+ * vfork 创建的子进程 execve 或者退出时调用：放还借用的父进程地址空间，唤醒在 vfork 中等待的父进程
+ */
+void vfork_release(void)
+{
+        current->vfork_mm = 0;
+        wake_up(&current->vfork_wait);
 }
 
 
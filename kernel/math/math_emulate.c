@@ -32,11 +32,14 @@ void math_emulate(long edi, long esi, long ebp, long sys_call_ret,
 	second = get_fs_byte((char *)((*&eip)++));
 	printk("%04x:%08x %02x %02x\n\r",cs,eip-2,first,second);
 	current->signal |= 1<<(SIGFPE-1);
+	signal_wake_up(current);
 }
 
 void math_error(void)
 {
 	__asm__("fnclex");
-	if (last_task_used_math)
+	if (last_task_used_math) {
 		last_task_used_math->signal |= 1<<(SIGFPE-1);
+		signal_wake_up(last_task_used_math); // 使用协处理器的任务可能正在睡眠
+	}
 }
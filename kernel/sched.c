@@ -53,8 +53,18 @@ void show_task(int nr,struct task_struct * p)
 }
 
 
+extern void show_buffer_stats(void); // 打印高速缓冲的统计信息 (fs/buffer.c)
+extern void show_blk_stats(void); // 打印块设备请求队列的统计信息 (kernel/blk_drv/ll_rw_blk.c)
+extern void show_mem_stats(void); // 打印伙伴系统的统计信息 (mm/memory.c)
+extern void show_dcache_stats(void); // 打印目录项缓存的统计信息 (fs/dcache.c)
+extern void show_inode_stats(void); // 打印i节点表的统计信息 (fs/inode.c)
+extern void show_page_cache_stats(void); // 打印页缓存的统计信息 (mm/filemap.c)
+extern void show_swap_stats(void); // 打印交换空间的统计信息 (mm/swap.c)
+extern void show_hd_stats(void); // 打印硬盘读写的统计信息 (kernel/blk_drv/hd.c)
+extern void show_wait_stats(void); // 打印等待队列的统计信息
+
 /**
- * 打印所有任务的任务号，进程号，进程状态，和内核堆栈空闲字节数
+ * 打印所有任务的任务号，进程号，进程状态，和内核堆栈空闲字节数，以及各子系统的统计信息
  */
 void show_stat(void)
 {
@@ -64,6 +74,15 @@ void show_stat(void)
         for (i=0;i<NR_TASKS;i++)
                 if (task[i])
                         show_task(i,task[i]);
+        show_buffer_stats();
+        show_blk_stats();
+        show_mem_stats();
+        show_dcache_stats();
+        show_inode_stats();
+        show_page_cache_stats();
+        show_swap_stats();
+        show_hd_stats();
+        show_wait_stats();
 }
 
 // PC8253 定时芯片的输入时钟频率约为 1.193180MHz，
@@ -143,6 +162,102 @@ void math_state_restore()
         }
 }
 
+/*
+ * 就绪队列：按 counter 值分成 NR_RUNQ 级，每一级是一个双向循环链表，runq[level] 指向链表头
+ * runq_bitmap 的第 level 位为 1 表示该级链表非空，这样选择下一个任务只需要找 runq_bitmap 的最高位，而与任务数组大小无关
+ *
+ * 注意：任务 0 永远不进入就绪队列，当就绪队列为空的时候才会切换到任务 0
+ */
+static struct task_struct * runq[NR_RUNQ];
+static unsigned long runq_bitmap = 0;
+// 调度纪元：每次所有就绪任务的时间片都用完而重新计算 counter 时递增
+static long sched_epoch = 0;
+
+// 返回 word 中最高的置 1 位的位置，调用前必须确保 word 不为 0
+static inline int find_last_bit(unsigned long word)
+{
+        int bit;
+
+        __asm__("bsrl %1,%0":"=r" (bit):"rm" (word));
+        return bit;
+}
+
+/**
+ * 把任务 p 放入对应级别就绪队列的末尾，调用时必须关中断
+ *
+ * 如果任务在睡眠期间错过了几次 counter 重算，则在这里补上：每次都是 counter = counter / 2 + priority
+ * counter 最多经过 32 次迭代就会收敛到 2 * priority 附近，因此补算次数最多 32 次
+ */
+static void enqueue_task(struct task_struct * p)
+{
+        long n;
+        int level;
+
+        if (p->run_next) // 已经在就绪队列中
+                return;
+        n = sched_epoch - p->run_epoch;
+        if (n > 32)
+                n = 32;
+        while (n-- > 0)
+                p->counter = (p->counter >> 1) + p->priority;
+        p->run_epoch = sched_epoch;
+
+        level = p->counter;
+        if (level < 0)
+                level = 0;
+        else if (level >= NR_RUNQ)
+                level = NR_RUNQ - 1;
+        p->run_level = level;
+        if (!runq[level]) {
+                p->run_next = p->run_prev = p;
+                runq[level] = p;
+                runq_bitmap |= 1 << level;
+        } else {
+                // 插入到链表头之前，也就是循环链表的末尾
+                p->run_next = runq[level];
+                p->run_prev = runq[level]->run_prev;
+                p->run_prev->run_next = p;
+                runq[level]->run_prev = p;
+        }
+}
+
+/**
+ * 把任务 p 从就绪队列中取下，调用时必须关中断
+ */
+static void dequeue_task(struct task_struct * p)
+{
+        int level = p->run_level;
+
+        if (!p->run_next) // 不在就绪队列中
+                return;
+        if (p->run_next == p) {
+                runq[level] = NULL;
+                runq_bitmap &= ~(1 << level);
+        } else {
+                p->run_prev->run_next = p->run_next;
+                p->run_next->run_prev = p->run_prev;
+                if (runq[level] == p)
+                        runq[level] = p->run_next;
+        }
+        p->run_next = p->run_prev = NULL;
+}
+
+/**
+ * 所有就绪任务的时间片都已经用完（都在第 0 级）：进入新的调度纪元，并重新计算它们的 counter
+ * 睡眠中的任务不在就绪队列中，它们的 counter 在被唤醒入队的时候再补算
+ */
+static void recalc_counters(void)
+{
+        struct task_struct * p;
+
+        sched_epoch++;
+        // priority 总是大于 0，所以重算后的任务不会再回到第 0 级，循环一定会结束
+        while ((p = runq[0]) != NULL) {
+                dequeue_task(p);
+                enqueue_task(p);
+        }
+}
+
 /*
  *  'schedule()' is the scheduler function. This is GOOD CODE! There
  * probably won't be any reason to change this, as it should work well
@@ -163,59 +278,46 @@ void math_state_restore()
  */
 void schedule(void)
 {
-        int i,next,c;
-        struct task_struct ** p; // 任务结构指针的指针
-
-/* check alarm, wake up any interruptible tasks that have got a signal */
-// 检查 alarm (进程的报警定时值)，唤醒任何已经“得到信号”的“可中断任务”
-        // 从任务数组的最后一个任务开始循环
-        for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-                // 任务结构指针不为空
-                if (*p) {
-                        // 任务设置过定时值，并且已经超时
-                        if ((*p)->alarm && (*p)->alarm < jiffies) {
-                                // 信号位图对应的 SIGALRM 位设置为 1，等价于向任务发送 SIGALRM 信号，这个信号默认的操作是终止进程
-                                (*p)->signal |= (1<<(SIGALRM-1));
-                                // 进程定时器归零
-                                (*p)->alarm = 0; 
-                        }
-                        // (*p)->signal : 信号位图中有信号
-                        // ~(_BLOCKABLE & (*p)->blocked) : 信号位图中的信号不在信号屏蔽位图中。注意：SIGKILL 和 SIGSTOP 信号无法被屏蔽
-                        if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) &&
-                            (*p)->state==TASK_INTERRUPTIBLE) // 任务状态是“可中断的休眠”状态
-                                (*p)->state=TASK_RUNNING; // 状态设置为“就绪”，等价于”唤醒“进程
-                }
+        int next;
+        unsigned long flags;
 
 /* this is the scheduler proper: */
+// 注意：进程的报警定时 alarm 由时间轮上的 alarm_timer 负责，这里不再需要扫描任务数组
+
+        save_flags(flags);
+        cli();
+        // 把当前任务按照新的状态和 counter 值重新放入就绪队列（或者从就绪队列中取下）
+        // sleep_on(), sys_pause(), do_exit() 等都是先修改 current->state 再调用本函数，因此离开就绪队列统一在这里完成
+        if (current != &(init_task.task)) {
+                // 当前任务要进入“可中断的休眠”，但已经有未屏蔽的信号：不能休眠，保持就绪
+                // 其他任务的信号在发送时由 signal_wake_up() 唤醒，所以这里只需要检查当前任务
+                if (current->state == TASK_INTERRUPTIBLE &&
+                    (current->signal & ~(_BLOCKABLE & current->blocked)))
+                        current->state = TASK_RUNNING;
+                dequeue_task(current);
+                if (current->state == TASK_RUNNING)
+                        enqueue_task(current);
+        }
 
-        // 调度主程序
+        // 调度主程序：选择 counter 值最大的就绪任务，也就是就绪位图中最高级别链表的第一个任务
         while (1) {
-                c = -1; // 临时 counter 值
-                next = 0; // 下一个运行任务的数组索引
-                i = NR_TASKS; // 64 
-                p = &task[NR_TASKS]; // 指向任务结构指针数组的最后一项
-                // 从任务数组最后开始循环
-                while (--i) {
-                        // 跳过任务结构指针为空的元素
-                        if (!*--p) 
-                                continue;
-                        // 查找处于就绪状态下 counter 值最大的任务
-                        if ((*p)->state == TASK_RUNNING && (*p)->counter > c)
-                                c = (*p)->counter, next = i;
+                // 没有任何就绪任务，只能选择执行任务0
+                // 任务0 会执行 'pause()' 系统调用，这个系统调用又会调用本函数 'schedule()'
+                if (!runq_bitmap) {
+                        next = 0;
+                        break;
+                }
+                next = find_last_bit(runq_bitmap);
+                if (next) {
+                        next = runq[next]->task_nr;
+                        break;
                 }
-                if (c) break; // 如果有可执行的任务，则跳出当前循环，进行任务切换操作 -> switch_to(next)
-
-                //系统中每个可运行的任务时间片都用完，那么更新每个任务的 counter 值，然后从 while(1) 从新开始循环
-                for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-                        if (*p)
-                                // 新 counter 值 = 老 counter 值 / 2 + priority 注意：这里无视进程状态 
-                                (*p)->counter = ((*p)->counter >> 1) +
-                                        (*p)->priority;
+                // 系统中每个可运行的任务时间片都用完，那么更新就绪任务的 counter 值，然后从 while(1) 从新开始循环
+                recalc_counters();
         }
+        restore_flags(flags);
         // 切换任务到 next 处的任务
-        // 由于 next 被初始化为 0，所以当没有任何其他任务时，next始终为0，调度函数只能选择执行任务0
-        // 任务0 会执行 'pause()' 系统调用，这个系统调用又会调用本函数 'schedule()'
-        switch_to(next); 
+        switch_to(next);
 }
 
 /**
@@ -263,13 +365,13 @@ repeat: current->state = TASK_UNINTERRUPTIBLE; // 注意：下面这条语句可
         // 检查”等待队列的头指针“是否还指向”当前任务“的结构指针
         // 如果不是，那说明后面还有等待进程被加入进来！！！
         if(*p && *p != current) {
-                (**p).state=0; // 最后一个”等待这个资源的进程“状态被设置为”就绪“
+                wake_up_process(*p); // 最后一个”等待这个资源的进程“状态被设置为”就绪“
                 goto repeat; // 再次把当前任务的状态设置为”可中断阻塞“
         }
         // 执行到这里说明，说明当前任务已经被真正的唤醒，当前任务状态已经是 "TASK_RUNNING" 
         // ”等待队列的头指针“ 指向前一个等待任务，并检查前面一个等待任务的结构指针是否为NULL
         if (*p = tmp) // 实际上这里在判断tmp指向的是不是第一个等待任务的结构指针，如果是的话，也就没有前一个等待任务，所以也无须唤醒
-                tmp->state=0; // ”前面一个等待任务“的状态设置为”就绪“
+                wake_up_process(tmp); // ”前面一个等待任务“的状态设置为”就绪“
 }
 
 /**
@@ -296,11 +398,11 @@ void interruptible_sleep_on(struct task_struct **p)
 repeat:	current->state = TASK_INTERRUPTIBLE; 
         schedule();
         if (*p && *p != current) {
-                (**p).state=0; 
+                wake_up_process(*p);
                 goto repeat; 
         }
         if (*p = tmp) 
-                tmp->state=0;
+                wake_up_process(tmp);
 }
 
 /**
@@ -315,10 +417,178 @@ void wake_up(struct task_struct **p)
 {
         // 检查 ”等待队列的头指针“ -> "进程结构指针" 是否为空
         if (p && *p) {
-                (**p).state=0; // 最后一个进入等待队列的任务 状态置为 ”就绪“
+                wake_up_process(*p); // 最后一个进入等待队列的任务 状态置为 ”就绪“
         }
 }
 
+struct wait_stats wait_stats;
+
+/**
+ * 把 wait 加入等待队列 q：共享等待者放在队列头，独占等待者放在队列尾
+ * 可能和中断处理程序中的唤醒同时发生，所以关中断操作队列
+ */
+void add_wait_queue(struct wait_queue ** q, struct wait_queue * wait)
+{
+        unsigned long flags;
+
+        save_flags(flags);
+        cli();
+        if (wait->exclusive)
+                while (*q)
+                        q = &(*q)->next;
+        wait->next = *q;
+        *q = wait;
+        restore_flags(flags);
+}
+
+/**
+ * 把 wait 从等待队列 q 中取下
+ */
+void remove_wait_queue(struct wait_queue ** q, struct wait_queue * wait)
+{
+        unsigned long flags;
+
+        save_flags(flags);
+        cli();
+        for ( ; *q ; q = &(*q)->next)
+                if (*q == wait) {
+                        *q = wait->next;
+                        break;
+                }
+        restore_flags(flags);
+}
+
+/*
+ * 在等待队列 q 上睡眠，直到被唤醒（可中断的等待也可以被信号唤醒）
+ *
+ * 先设置状态再入队，然后才调度：__wake_up_queue 跳过不在睡眠状态的任务，
+ * 如果先入队，入队以后到设置状态之间中断处理程序中的唤醒会被跳过而丢失；
+ * 先设置状态，入队以后到 schedule 之间的唤醒只是把状态改回 TASK_RUNNING，schedule 会直接返回
+ */
+static void __sleep_on_queue(struct wait_queue ** q, int state, int exclusive)
+{
+        struct wait_queue wait;
+
+        if (current == &(init_task.task))
+                panic("task[0] trying to sleep");
+        wait.task = current;
+        wait.exclusive = exclusive;
+        current->state = state;
+        add_wait_queue(q,&wait);
+        wait_stats.sleeps++;
+        schedule();
+        remove_wait_queue(q,&wait);
+}
+
+void sleep_on_queue(struct wait_queue ** q)
+{
+        __sleep_on_queue(q,TASK_UNINTERRUPTIBLE,0);
+}
+
+void sleep_on_queue_exclusive(struct wait_queue ** q)
+{
+        __sleep_on_queue(q,TASK_UNINTERRUPTIBLE,1);
+}
+
+void interruptible_sleep_on_queue(struct wait_queue ** q)
+{
+        __sleep_on_queue(q,TASK_INTERRUPTIBLE,0);
+}
+
+/*
+ * 唤醒等待队列 q 上所有的共享等待者，以及 nr_exclusive 个独占等待者
+ *
+ * 已经被唤醒但还没有运行（还没有离开队列）的独占等待者不计数，否则这一次唤醒就丢失了
+ */
+static int __wake_up_queue(struct wait_queue ** q, int nr_exclusive)
+{
+        struct wait_queue * wait;
+        unsigned long flags;
+        int woken = 0;
+
+        save_flags(flags);
+        cli();
+        for (wait = *q ; wait ; wait = wait->next) {
+                if (wait->task->state != TASK_INTERRUPTIBLE &&
+                    wait->task->state != TASK_UNINTERRUPTIBLE)
+                        continue;
+                wake_up_process(wait->task);
+                wait_stats.wakeups++;
+                woken++;
+                if (wait->exclusive && !--nr_exclusive)
+                        break;
+        }
+        restore_flags(flags);
+        return woken;
+}
+
+/**
+ * 唤醒等待队列 q 上所有的共享等待者和一个独占等待者（可以在中断处理程序中调用）
+ *
+ * 返回：被唤醒的任务数
+ */
+int wake_up_queue(struct wait_queue ** q)
+{
+        if (q && *q)
+                return __wake_up_queue(q,1);
+        return 0;
+}
+
+/**
+ * 唤醒等待队列 q 上所有的等待者：资源不会再出现（比如管道的另一端已经关闭）时调用
+ */
+void wake_up_queue_all(struct wait_queue ** q)
+{
+        if (q && *q)
+                __wake_up_queue(q,0);
+}
+
+/**
+ * 打印等待队列的统计信息
+ */
+void show_wait_stats(void)
+{
+        printk("wait queues: %d sleeps, %d wakeups, %d spurious\n\r",
+               wait_stats.sleeps, wait_stats.wakeups, wait_stats.spurious);
+}
+
+/**
+ * 把任务 p 的状态置为”就绪“，并放入就绪队列
+ * 可能在中断处理程序中调用，所以这里保存并恢复原来的中断状态
+ *
+ * p: 任务结构指针
+ *
+ * 无返回值
+ */
+void wake_up_process(struct task_struct * p)
+{
+        unsigned long flags;
+
+        if (!p)
+                return;
+        save_flags(flags);
+        cli();
+        p->state = TASK_RUNNING;
+        if (p != &(init_task.task)) // 任务0 从不进入就绪队列
+                enqueue_task(p);
+        restore_flags(flags);
+}
+
+/**
+ * 向任务发送信号以后调用：如果任务 p 处于”可中断的休眠“状态，并且有未被屏蔽的信号，则唤醒它
+ * 注意：SIGKILL 和 SIGSTOP 信号无法被屏蔽
+ *
+ * p: 任务结构指针
+ *
+ * 无返回值
+ */
+void signal_wake_up(struct task_struct * p)
+{
+        if (p && (p->signal & ~(_BLOCKABLE & p->blocked)) &&
+            p->state == TASK_INTERRUPTIBLE)
+                wake_up_process(p);
+}
+
 /*
  * OK, here are some floppy things that shouldn't be in the kernel
  * proper. They are here because the floppy needs a timer, and this
@@ -387,15 +657,174 @@ void do_floppy_timer(void)
         }
 }
 
-// 下面是关于定时器的代码
-#define TIME_REQUESTS 64 // 最多可以有64个定时器
+/*
+ * 下面是关于定时器的代码：分级时间轮
+ *
+ * 第 1 级 tv1 有 256 个槽，每个槽对应一个滴答；第 2～5 级 tv2～tv5 各有 64 个槽，每个槽分别对应 2^8, 2^14, 2^20, 2^26 个滴答
+ * 定时器按照距离到期的时间挂到对应级别的槽中。每个滴答只需要处理 tv1 中当前的槽，
+ * 每当 tv1 转完一圈，才把上一级当前槽中的定时器重新分配到下一级中（级联）。
+ * 因此添加，删除定时器都是 O(1)，每个滴答的到期处理也和定时器数量无关（均摊 O(1)）
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+static struct timer_list * tv1[TVR_SIZE];
+static struct timer_list * tv2[TVN_SIZE], * tv3[TVN_SIZE], * tv4[TVN_SIZE], * tv5[TVN_SIZE];
+// 下一个还没有处理的滴答，只有它和 jiffies 之间的滴答对应的槽才需要处理
+static unsigned long timer_jiffies = 0;
+
+// 第 n 级（从 tv2 开始算 0）时间轮的当前槽号
+#define INDEX(n) ((timer_jiffies >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+/**
+ * 根据到期时刻把定时器挂到对应时间轮的槽中，调用时必须关中断
+ */
+static void internal_add_timer(struct timer_list * timer)
+{
+        unsigned long expires = timer->expires;
+        unsigned long idx = expires - timer_jiffies;
+        struct timer_list ** slot;
+
+        if ((long) idx < 0) // 已经过期：放到当前槽，下一个滴答就会处理
+                slot = tv1 + (timer_jiffies & TVR_MASK);
+        else if (idx < TVR_SIZE)
+                slot = tv1 + (expires & TVR_MASK);
+        else if (idx < 1 << (TVR_BITS + TVN_BITS))
+                slot = tv2 + ((expires >> TVR_BITS) & TVN_MASK);
+        else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS))
+                slot = tv3 + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+        else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS))
+                slot = tv4 + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+        else
+                slot = tv5 + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+        // 插入到槽链表的头部
+        if ((timer->next = *slot))
+                timer->next->pprev = &timer->next;
+        *slot = timer;
+        timer->pprev = slot;
+}
+
+/**
+ * 把定时器从所在的槽中取下，调用时必须关中断
+ */
+static inline void detach_timer(struct timer_list * timer)
+{
+        if ((*timer->pprev = timer->next))
+                timer->next->pprev = timer->pprev;
+        timer->next = NULL;
+        timer->pprev = NULL;
+}
 
-// 定时器结构，这里只用于给软驱关闭和启动马达
-static struct timer_list {
-        long jiffies; // 定时滴答数
-        void (*fn)(); // 定时处理程序
-        struct timer_list * next; // 指向下一个定时器的指针
-} timer_list[TIME_REQUESTS], * next_timer = NULL; // timer_list[TIME_REQUESTS]] 是定时器结构数组，next_timer 是队列头指针
+/**
+ * 把上一级时间轮槽 tv[index] 中的所有定时器重新分配到下一级时间轮
+ *
+ * 返回 index，为 0 说明这一级也转完了一圈，还需要继续级联更上一级
+ */
+static int cascade(struct timer_list ** tv, int index)
+{
+        struct timer_list * timer, * next;
+
+        timer = tv[index];
+        tv[index] = NULL;
+        while (timer) {
+                next = timer->next;
+                internal_add_timer(timer);
+                timer = next;
+        }
+        return index;
+}
+
+/**
+ * 处理所有到期的定时器，在时钟中断中调用（此时已经关中断）
+ */
+static void run_timer_list(void)
+{
+        struct timer_list * timer;
+        int index;
+
+        while ((long) (jiffies - timer_jiffies) >= 0) {
+                index = timer_jiffies & TVR_MASK;
+                if (!index &&
+                    !cascade(tv2, INDEX(0)) &&
+                    !cascade(tv3, INDEX(1)) &&
+                    !cascade(tv4, INDEX(2)))
+                        cascade(tv5, INDEX(3));
+                timer_jiffies++;
+                // 定时处理函数可能会重新添加定时器，所以先取下再调用
+                while ((timer = tv1[index]) != NULL) {
+                        detach_timer(timer);
+                        (timer->fn)(timer->data);
+                }
+        }
+}
+
+/**
+ * 初始化定时器：定时器不挂在时间轮上
+ */
+void init_timer(struct timer_list * timer)
+{
+        timer->next = NULL;
+        timer->pprev = NULL;
+}
+
+/**
+ * 设置定时器的到期时刻并挂到时间轮上，如果定时器已经在时间轮上，则先取下
+ * 调用前必须设置好 timer->fn 和 timer->data
+ *
+ * timer: 定时器
+ * expires: 到期时刻（滴答数的绝对值）
+ */
+void mod_timer(struct timer_list * timer, unsigned long expires)
+{
+        unsigned long flags;
+
+        save_flags(flags);
+        cli();
+        if (timer->pprev)
+                detach_timer(timer);
+        timer->expires = expires;
+        internal_add_timer(timer);
+        restore_flags(flags);
+}
+
+/**
+ * 从时间轮上取下定时器
+ *
+ * 返回值：定时器原来挂在时间轮上返回 1，否则返回 0
+ */
+int del_timer(struct timer_list * timer)
+{
+        unsigned long flags;
+        int ret = 0;
+
+        save_flags(flags);
+        cli();
+        if (timer->pprev) {
+                detach_timer(timer);
+                ret = 1;
+        }
+        restore_flags(flags);
+        return ret;
+}
+
+// 给 add_timer() 使用的定时器池，最多可以有64个定时器
+#define TIME_REQUESTS 64
+
+static struct timer_list timer_pool[TIME_REQUESTS];
+static void (*timer_pool_fn[TIME_REQUESTS])(void); // 定时器池中每个定时器对应的处理程序，为 NULL 表示空闲
+
+// 定时器池中的定时器到期：释放这个定时器，并调用对应的处理程序
+static void timer_pool_expire(unsigned long nr)
+{
+        void (*fn)(void) = timer_pool_fn[nr];
+
+        timer_pool_fn[nr] = NULL;
+        (fn)();
+}
 
 /**
  * 添加定时器：主要提供给 'floppy.c' 来执行启动和关闭马达的延时操作
@@ -408,47 +837,62 @@ static struct timer_list {
  */
 void add_timer(long jiffies, void (*fn)(void))
 {
-        struct timer_list * p;
+        unsigned long flags;
+        int nr;
 
         // 如果定时处理程序指针为空，则退出
         if (!fn)
                 return;
+        save_flags(flags);
         cli(); // 关闭中断
-        // 如果定时值小于0，则立刻调用定时处理程序，并且该定时器不加入到链表中
+        // 如果定时值小于0，则立刻调用定时处理程序，并且该定时器不加入到时间轮中
         if (jiffies <= 0)
                 (fn)();
         else {
-                // 遍历定时器数组，从中找到一个“空闲项定时器”
-                for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++)
-                        if (!p->fn) // 定时器的处理程序指针为空
+                // 从定时器池中找到一个“空闲项定时器”
+                for (nr = 0 ; nr < TIME_REQUESTS ; nr++)
+                        if (!timer_pool_fn[nr])
                                 break;
                 // 用完了所有的定时器，则系统崩溃
-                if (p >= timer_list + TIME_REQUESTS)
+                if (nr >= TIME_REQUESTS)
                         panic("No more time requests free");
-                // 设置“空闲项定时器”的“定时滴答数”和“定时器处理程序指针”
-                p->fn = fn;
-                p->jiffies = jiffies;
-                p->next = next_timer; // “空闲项定时器”的下一个定时器指针指向当前链表的头指针
-                next_timer = p; // “当前链表头指针”指向找到的“空闲项定时器”
-                // 链表项按定时大小值从小到大排序，在排序时候减去排在前面所需的滴答数
-                // 这里其实没有考虑周全，如果新插入的定时器的值小于原来头一个定时器的值，还是需要把第二个的定时器的滴答数减去第一个的滴答数！！！
-                while (p->next && p->next->jiffies < p->jiffies) { // 下一个定时器不为空 并且 下一个定时器的滴答值 < 当前定时器的滴答值
-                        p->jiffies -= p->next->jiffies; // 当前计时器的滴器值 = 下一个定时器的滴答值 - 当前计时器的滴答值
-                        // 下面三条语句，交换了 p 和 p->next 的处理程序指针值
-                        fn = p->fn; // 暂存“当前计时器“的”处理程序指针”
-                        p->fn = p->next->fn; // “当前计时器”的“处理程序指针”赋值为“下一个计时器“的”处理程序指针”
-                        p->next->fn = fn; // 下一个定时器的“处理程序指针”恢复为暂存的“当前计时器”的“处理程序指针”
-                        // 下面三条语句，交换了 p 和 p->next 的滴答数
-                        jiffies = p->jiffies; // 暂存“当前计时器的滴答数”，实际上这是一个差值
-                        p->jiffies = p->next->jiffies; // 交换计时滴答数
-                        p->next->jiffies = jiffies;
-                        // 指针移到下一个定时器上，进行下一次循环
-                        p = p->next; 
-                }
+                timer_pool_fn[nr] = fn;
+                timer_pool[nr].fn = timer_pool_expire;
+                timer_pool[nr].data = nr;
+                // 参数 jiffies 屏蔽了全局变量，timer_jiffies - 1 就是最近一次处理过的滴答，也就是当前的滴答数
+                timer_pool[nr].expires = (timer_jiffies - 1) + jiffies;
+                internal_add_timer(timer_pool + nr);
         }
-        sti(); // 打开中断
+        restore_flags(flags); // 恢复中断状态
+}
+
+// 报警定时器到期：向任务发送 SIGALRM 信号，这个信号默认的操作是终止进程
+static void alarm_expire(unsigned long data)
+{
+        struct task_struct * p = (struct task_struct *) data;
+
+        p->alarm = 0; // 进程定时器归零
+        p->signal |= (1<<(SIGALRM-1));
+        signal_wake_up(p);
 }
 
+/**
+ * 设置任务 p 的报警定时值，并同步更新它在时间轮上的报警定时器
+ *
+ * p: 任务结构指针
+ * expires: 报警时刻（滴答数），0 表示取消报警
+ */
+void set_alarm(struct task_struct * p, long expires)
+{
+        p->alarm = expires;
+        if (!expires) {
+                del_timer(&p->alarm_timer);
+                return;
+        }
+        p->alarm_timer.fn = alarm_expire;
+        p->alarm_timer.data = (unsigned long) p;
+        mod_timer(&p->alarm_timer, expires);
+}
 
 /**
  * 时钟中断 C 函数处理程序，在 system_call.s 中的 _timer_interrupt() 中被调用
@@ -460,30 +904,13 @@ void add_timer(long jiffies, void (*fn)(void))
  */
 void do_timer(long cpl)
 {
-        extern int beepcount; // 扬声器发声时间滴答器 
-        extern void sysbeepstop(void); // 关闭扬声器发声
-
-        if (beepcount) // 扬声器发声时间滴答数大于0
-                if (!--beepcount) // “扬声器发声时间滴答数 - 1” 等于 0, 发声时间即将用完 
-                        sysbeepstop(); // 关闭扬声器发声功能
-
         if (cpl) // cpl = 3 ：用户级
                 current->utime++; // 用户时间递增
         else // cpl = 0 ：内核级
                 current->stime++; //系统时间递增
 
-        // 如果有定时器存在
-        if (next_timer) { 
-                next_timer->jiffies--; // 定时器链表头指针指向的定时器的滴答数减 1 
-                while (next_timer && next_timer->jiffies <= 0) { // 头指针指向的定时器的滴答数已经用完
-                        void (*fn)(void); // 定义一个局部函数指针变量 fn 
-			
-                        fn = next_timer->fn; // “头指针”指向的定时器的定时处理程序指针暂存为 fn 
-                        next_timer->fn = NULL; // 头指针的定时器的定时处理程序指针置为 NULL，以防“野指针” 
-                        next_timer = next_timer->next; // 头指针指向下一个定时器
-                        (fn)(); // 调用 fn 中暂存的处理程序指针
-                }
-        }
+        // 处理时间轮上所有到期的定时器（软驱马达，扬声器，进程的报警定时等）
+        run_timer_list();
         // 检查软盘控制器 FDC 的数字输出寄存器中马达启动位是否被置位
         if (current_DOR & 0xf0)
                 do_floppy_timer(); // 启动软盘定时程序
@@ -514,7 +941,7 @@ int sys_alarm(long seconds)
                 old = (old - jiffies) / HZ; // 当前进程距离报警时刻的间隔时间（秒）
         
         // 如果 second > 0，更新当前进程的报警字段值（滴答数）， 否则当前进程的 alarm 字段重置为 0
-        current->alarm = (seconds>0)?(jiffies+HZ*seconds):0;
+        set_alarm(current, (seconds>0)?(jiffies+HZ*seconds):0);
         return (old);
 }
 
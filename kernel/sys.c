@@ -293,9 +293,13 @@ int sys_times(struct tms * tbuf)
  */
 int sys_brk(unsigned long end_data_seg)
 {
+        unsigned long low = mmap_lowest(current);
+
         // 想要设置的偏移 >= 代码段长度 并且 想要设置的偏移值 < (栈段起始处 - 16KB) : 说明end_data_seg值是合理的
+        // 堆也不能长进文件映射区中
         if (end_data_seg >= current->end_code &&
-            end_data_seg < current->start_stack - 16384)
+            end_data_seg < current->start_stack - 16384 &&
+            (!low || end_data_seg <= low))
                 current->brk = end_data_seg; // 设置进程数据段末尾处的偏移
         return current->brk; // 返回进程数据段末尾处的偏移
 }
@@ -71,7 +71,7 @@ sa_mask = 4 # 信号屏蔽码
 sa_flags = 8 # 信号集
 sa_restorer = 12 # 恢复函数指针
 
-nr_system_calls = 72 # 系统函数调用总数
+nr_system_calls = 79 # 系统函数调用总数
 
 /*
  * Ok, I get parallel printer interrupts while using the floppy for some
@@ -81,7 +81,7 @@ nr_system_calls = 72 # 系统函数调用总数
 	/*
 	 * 在使用软驱时，我受到了并行打印机中断，很奇怪。呵，现在不去管它
 	 */
-.globl system_call,sys_fork,timer_interrupt,sys_execve
+.globl system_call,sys_fork,sys_vfork,timer_interrupt,sys_execve
 .globl hd_interrupt,floppy_interrupt,parallel_interrupt
 .globl device_not_available, coprocessor_error
 
@@ -273,8 +273,25 @@ sys_fork:
 	pushl %edi # 参数 long edi 
 	pushl %ebp # 参数 long ebp
 	pushl %eax # 参数 long nr 
+	pushl $0 # 参数 share_vm：复制页表
 	call copy_process # 调用 copy_process(...) (kernel/fork.c)
-	addl $20,%esp # 丢弃上面压栈的5个参数
+	addl $24,%esp # 丢弃上面压栈的6个参数
+1:	ret
+
+	#### sys_vfork 系统调用：和 sys_fork 一样，只是子进程借用父进程的地址空间，父进程等到子进程 execve 或者退出时才返回
+.align 2
+sys_vfork:
+	call find_empty_process
+	testl %eax,%eax
+	js 1f
+	push %gs
+	pushl %esi
+	pushl %edi
+	pushl %ebp
+	pushl %eax
+	pushl $1 # 参数 share_vm：不复制页表
+	call copy_process
+	addl $24,%esp
 1:	ret
 
 	#### int 46 -- (int 0x2E) 硬盘中断处理程序，响应硬盘中断请求 IRQ 14
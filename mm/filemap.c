@@ -0,0 +1,292 @@
+/*
+ *  linux/mm/filemap.c
+ */
+
+/*
+ * 页缓存(page cache)：以 (设备号, i节点号, 文件内逻辑块号) 为关键字缓存普通文件的整页数据
+ *
+ * 一个页面缓存文件中从 block 开始的连续 4 个逻辑块，block 不一定是 4 的倍数：
+ * 按需加载可执行文件时第 0 块是 a.out 头，代码页从第 1 块开始（block = 1 + 4n），file_read 则按页对齐（block = 4n）
+ *
+ * 页缓存自己持有页面的一个引用（mem_map 计数）：
+ * do_no_page 把缓存页面写保护后直接映射到进程中，以后再执行同一个程序（不必是同一个进程树）时直接命中，不用再读设备；
+ * 进程写这个页面时由写时复制得到自己的副本
+ * file_read 直接从缓存页面复制到用户空间
+ *
+ * 文件被写入（file_write），截断（truncate），设备被卸载或更换时，让对应的缓存页面失效
+ * 内存不够时 __get_free_pages 调用 shrink_page_cache 释放最久没有使用，并且只被页缓存引用的页面
+ */
+
+#include <linux/sched.h> // 调度程序头文件：sleep_on, wake_up
+#include <linux/kernel.h> // 内核常用函数头文件
+#include <linux/mm.h> // 内存管理头文件
+
+#define NR_CACHED_PAGES 512 // 页缓存的最多项数
+#define NR_PHASH 128 // hash 表的大小，必须是 2 的幂
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE)
+
+struct cached_page {
+        struct cached_page * next, * prev; // hash 链表上的后一项，前一项
+        struct cached_page * lru_next, * lru_prev; // LRU 链表（循环双向链表）上的后一项，前一项
+        unsigned long page; // 物理页面地址，0 表示本项空闲
+        unsigned long block; // 页面中第一个逻辑块的文件内块号
+        unsigned short dev; // 文件所在的设备号
+        unsigned short ino; // 文件的i节点号
+        unsigned char lock; // 正在从设备读入页面
+        struct task_struct * wait; // 等待读入完成的进程
+};
+
+static struct cached_page page_table[NR_CACHED_PAGES];
+static struct cached_page * page_hash[NR_PHASH];
+static struct cached_page * page_lru = NULL; // LRU 链表头：最久没有使用的项
+static int nr_cached = 0; // 已经放入 LRU 链表的项数
+
+// 统计信息
+static struct {
+        unsigned long hits; // 命中次数
+        unsigned long misses; // 需要读设备的次数
+        unsigned long shrinks; // 内存不够时被释放的页面数
+        unsigned long invalidates; // 失效的页面数
+} page_stats;
+
+#define _phashfn(dev,ino,block) (((unsigned)((dev)^((ino)<<4)^(block)))&(NR_PHASH-1))
+#define phash(dev,ino,block) page_hash[_phashfn(dev,ino,block)]
+
+static struct cached_page * find_cached(int dev, int ino, unsigned long block)
+{
+        struct cached_page * p;
+
+        for (p = phash(dev,ino,block) ; p ; p = p->next)
+                if (p->dev == dev && p->ino == ino && p->block == block)
+                        return p;
+        return NULL;
+}
+
+/*
+ * 把 p 移到 LRU 链表的尾部（最近使用）
+ */
+static inline void touch_cached(struct cached_page * p)
+{
+        if (p == page_lru) {
+                page_lru = p->lru_next;
+                return;
+        }
+        p->lru_prev->lru_next = p->lru_next;
+        p->lru_next->lru_prev = p->lru_prev;
+        p->lru_next = page_lru;
+        p->lru_prev = page_lru->lru_prev;
+        page_lru->lru_prev->lru_next = p;
+        page_lru->lru_prev = p;
+}
+
+/*
+ * 释放一项：从 hash 链表中移除，放回页缓存的引用，并把它放到 LRU 链表头，最先被重新使用
+ */
+static void drop_cached(struct cached_page * p)
+{
+        if (p->next)
+                p->next->prev = p->prev;
+        if (p->prev)
+                p->prev->next = p->next;
+        else
+                phash(p->dev,p->ino,p->block) = p->next;
+        p->next = p->prev = NULL;
+        free_page(p->page);
+        p->page = 0;
+        touch_cached(p);
+        page_lru = p;
+}
+
+/*
+ * 取得一个空闲项：先用还没有用过的，否则从 LRU 链表头开始找一个空闲项，或者页面只被页缓存引用的项
+ *
+ * 返回：空闲项，所有页面都在使用中时返回 NULL
+ */
+static struct cached_page * alloc_cached(void)
+{
+        struct cached_page * p;
+
+        if (nr_cached < NR_CACHED_PAGES) {
+                p = page_table + nr_cached++;
+                if (!page_lru) {
+                        p->lru_next = p->lru_prev = p;
+                        page_lru = p;
+                } else {
+                        p->lru_next = page_lru;
+                        p->lru_prev = page_lru->lru_prev;
+                        page_lru->lru_prev->lru_next = p;
+                        page_lru->lru_prev = p;
+                }
+                return p;
+        }
+        p = page_lru;
+        do {
+                if (!p->page)
+                        return p;
+                if (!p->lock && page_count(p->page) == 1) {
+                        drop_cached(p);
+                        return p;
+                }
+        } while ((p = p->lru_next) != page_lru);
+        return NULL;
+}
+
+/**
+ * 取得文件中从 block 开始的 4 个逻辑块所在的页面
+ *
+ * inode: 文件的i节点指针（普通文件）
+ * block: 页面中第一个逻辑块的文件内块号
+ *
+ * 返回：页面的物理地址，调用者持有该页面的一个引用，用完后要调用 free_page 放回；内存不够时返回 0
+ *
+ * 页缓存的项都在使用中时，返回一个不放入缓存的私有页面
+ */
+unsigned long get_file_page(struct m_inode * inode, unsigned long block)
+{
+        struct cached_page * p;
+        unsigned long page;
+        int nr[BLOCKS_PER_PAGE];
+        int i;
+
+repeat:
+        if ((p = find_cached(inode->i_dev,inode->i_num,block))) {
+                if (p->lock) {
+                        sleep_on(&p->wait);
+                        goto repeat; // 睡眠期间这一项可能已经失效
+                }
+                page_stats.hits++;
+                touch_cached(p);
+                get_page(p->page);
+                return p->page;
+        }
+        if (!(page = get_free_page()))
+                return 0;
+        // get_free_page 可能因为换出页面而睡眠：期间别的进程可能已经把这一页放入了缓存
+        if (find_cached(inode->i_dev,inode->i_num,block)) {
+                free_page(page);
+                goto repeat;
+        }
+        page_stats.misses++;
+        if ((p = alloc_cached())) {
+                p->page = page;
+                p->dev = inode->i_dev;
+                p->ino = inode->i_num;
+                p->block = block;
+                p->lock = 1; // 读入完成之前，其他进程在这一项上等待
+                p->prev = NULL;
+                if ((p->next = phash(p->dev,p->ino,block)))
+                        p->next->prev = p;
+                phash(p->dev,p->ino,block) = p;
+                touch_cached(p);
+                get_page(page); // 页缓存的引用
+        }
+        for (i = 0 ; i < BLOCKS_PER_PAGE ; i++)
+                nr[i] = bmap(inode,block+i);
+        bread_page(page,inode->i_dev,nr); // 一次提交 4 个块的读请求，空洞和文件末尾之后的部分保持为 0
+        if (p) {
+                p->lock = 0;
+                wake_up(&p->wait);
+        }
+        return page;
+}
+
+/*
+ * 让设备 dev 上 i节点 ino 的所有缓存页面失效，ino 为 0 时让整个设备的页面失效
+ */
+static void drop_pages(int dev, int ino)
+{
+        struct cached_page * p;
+        int i;
+
+repeat:
+        for (i = 0, p = page_table ; i < nr_cached ; i++, p++) {
+                if (!p->page || p->dev != dev)
+                        continue;
+                if (ino && p->ino != ino)
+                        continue;
+                if (p->lock) { // 正在读入：等读完再让它失效，读到的可能是旧数据
+                        sleep_on(&p->wait);
+                        goto repeat;
+                }
+                drop_cached(p);
+                page_stats.invalidates++;
+        }
+}
+
+/**
+ * 文件的内容被修改：让包含逻辑块 block 的缓存页面失效，block 为 -1 时让整个文件的页面失效
+ *
+ * inode: 文件的i节点指针
+ * block: 文件内逻辑块号
+ *
+ * 无返回值
+ *
+ * 已经映射到进程中的页面不受影响：它们仍然保持原来的内容
+ */
+void invalidate_file_pages(struct m_inode * inode, long block)
+{
+        struct cached_page * p;
+        int i;
+
+        if (block < 0) {
+                drop_pages(inode->i_dev,inode->i_num);
+                return;
+        }
+        // 包含 block 的页面，第一个逻辑块只可能是 block-3 ~ block：直接查 hash 表
+        for (i = 0 ; i < BLOCKS_PER_PAGE && i <= block ; i++) {
+                while ((p = find_cached(inode->i_dev,inode->i_num,block - i))) {
+                        if (!p->lock) {
+                                drop_cached(p);
+                                page_stats.invalidates++;
+                                break;
+                        }
+                        sleep_on(&p->wait); // 正在读入：等读完再让它失效
+                }
+        }
+}
+
+/**
+ * 让设备 dev 上所有文件的缓存页面失效（设备被卸载或者更换了软盘）
+ */
+void invalidate_dev_pages(int dev)
+{
+        drop_pages(dev,0);
+}
+
+/**
+ * 释放一个最久没有使用，并且只被页缓存引用的页面
+ *
+ * 返回：释放了页面返回 1，否则返回 0
+ *
+ * 由 __get_free_pages 在没有空闲页面时调用，不会睡眠
+ */
+int shrink_page_cache(void)
+{
+        struct cached_page * p;
+
+        if (!(p = page_lru))
+                return 0;
+        do {
+                if (p->page && !p->lock && page_count(p->page) == 1) {
+                        drop_cached(p);
+                        page_stats.shrinks++;
+                        return 1;
+                }
+        } while ((p = p->lru_next) != page_lru);
+        return 0;
+}
+
+/**
+ * 打印页缓存的统计信息
+ */
+void show_page_cache_stats(void)
+{
+        struct cached_page * p;
+        int i, n = 0;
+
+        for (i = 0, p = page_table ; i < nr_cached ; i++, p++)
+                if (p->page)
+                        n++;
+        printk("page cache: %d pages, %d hits, %d misses, %d shrunk, %d invalidated\n\r",
+               n, page_stats.hits, page_stats.misses, page_stats.shrinks, page_stats.invalidates);
+}
@@ -21,6 +21,7 @@
  */
 
 #include <signal.h> // 信号头文件
+#include <sys/mman.h> // 文件映射头文件：PROT_WRITE
 
 #include <asm/system.h> // 系统汇编头文件
 
@@ -36,14 +37,9 @@ static inline volatile void oom(void)
         do_exit(SIGSEGV);
 }
 
-// 刷新页变换寄存器
-#define invalidate()                            \
-        __asm__("movl %%eax,%%cr3"::"a" (0))
-
 /* these are not to be changed without changing head.s etc */
 #define LOW_MEM 0x100000 // 主内存开始地址 1MB 
-#define PAGING_MEMORY (15*1024*1024) // 主内存大小 15MB 
-#define PAGING_PAGES (PAGING_MEMORY>>12) // 每页内存是4KB, 实际是2^12B，所以实际上主内存的页数：主内存右移12位
+#define HEAD_MAPPED (16*1024*1024) // head.s 中 4 个页表已经恒等映射的物理内存：16MB
 #define MAP_NR(addr) (((addr)-LOW_MEM)>>12) // 物理地址对应的页面号码
 #define USED 100 // 被占用
 
@@ -53,6 +49,7 @@ static inline volatile void oom(void)
                           current->start_code + current->end_code)
 
 static long HIGH_MEMORY = 0; // 全局变量，用于存放主内存的最高地址
+static unsigned long PAGING_PAGES = 0; // 1MB 以上的物理内存页数，mem_init 中根据实际内存大小设置
 
 // 从from 处 复制 1页内存到 to 处
 #define copy_page(from,to)                                              \
@@ -60,34 +57,167 @@ static long HIGH_MEMORY = 0; // 全局变量，用于存放主内存的最高地
 
 // 物理内存映射字节图：1字节代表1页内存
 // 每个页面对应的值用于标记这个页面被引用（占用）的次数
-// 它最大可被映射 15MB 内存
+// 它的大小由实际物理内存决定，mem_init 把它放在主内存的开始处
 // 在初始化内存 mem_init 函数中，对于主内存不能被用的（高速缓存区以及可能的虚拟内存盘）都会被设置成 USED(100)
-static unsigned char mem_map [ PAGING_PAGES ] = {0,};
+static unsigned char * mem_map = NULL;
+
+/*
+ * 伙伴(buddy)分配器
+ *
+ * 空闲页面按 2^order 页大小、按 2^order 对齐的块组织，每个 order 一个空闲块链表（链表指针就保存在空闲块的第一页中）
+ * 每个 order 还有一张位图：每一位对应一对伙伴块，两块中恰好有一块空闲时为 1
+ * 分配时从够大的最小块开始，把多余的一半一半放回低一级的链表；释放时根据位图判断伙伴是否空闲，空闲则合并后继续向上
+ * 分配和释放都只需要 O(MAX_ORDER) 步，不再需要扫描整个 mem_map
+ *
+ * mem_map 仍然是每页的引用计数：已分配块中的每一页都是 1，引用计数减到 0 的页面以 order 0 放回，再和伙伴逐级合并
+ */
+#define MAX_ORDER 8 // 一次最多分配 2^(MAX_ORDER-1) = 128 页（512KB）
+
+struct free_block {
+        struct free_block * next, * prev; // 同一 order 空闲块链表上的后一块、前一块
+};
+
+struct free_area {
+        struct free_block * list; // 空闲块链表
+        unsigned long * map; // 伙伴位图
+        unsigned long nr_free; // 空闲块个数
+        unsigned long allocs; // 从这一级分配的次数
+};
+
+static struct free_area free_area[MAX_ORDER];
+
+// 分配器的统计信息
+static struct {
+        unsigned long splits; // 拆分大块的次数
+        unsigned long merges; // 伙伴合并的次数
+        unsigned long failed; // 分配失败的次数
+} buddy_stats;
+
+static unsigned long dropped_pages = 0; // swap_out 丢弃的干净页面数
+
+#define PAGE_BLOCK(nr) ((struct free_block *) (LOW_MEM + ((nr) << 12))) // 页面号对应的空闲块
+#define BLOCK_NR(b) MAP_NR((unsigned long) (b)) // 空闲块对应的页面号
+
+/*
+ * 翻转位图中的第 nr 位，返回翻转前的值（非 0 表示原来是 1）
+ */
+static inline int toggle_bit(unsigned long nr, unsigned long * addr)
+{
+        int oldbit;
+
+        __asm__ __volatile__("btcl %2,%1\n\tsbbl %0,%0"
+                             :"=r" (oldbit),"=m" (*addr)
+                             :"r" (nr)
+                             :"memory");
+        return oldbit;
+}
+
+static inline void add_free_block(int order, unsigned long nr)
+{
+        struct free_block * b = PAGE_BLOCK(nr);
+
+        b->prev = NULL;
+        if ((b->next = free_area[order].list))
+                b->next->prev = b;
+        free_area[order].list = b;
+        free_area[order].nr_free++;
+}
+
+static inline void del_free_block(int order, struct free_block * b)
+{
+        if (b->prev)
+                b->prev->next = b->next;
+        else
+                free_area[order].list = b->next;
+        if (b->next)
+                b->next->prev = b->prev;
+        free_area[order].nr_free--;
+}
+
+/*
+ * 把从页面号 nr 开始的 2^order 页放回伙伴系统，能合并就逐级合并
+ */
+static void free_pages_ok(unsigned long nr, int order)
+{
+        while (order < MAX_ORDER-1) {
+                // 原来是 1：伙伴是空闲的，现在两块都空闲了，合并
+                if (!toggle_bit(nr >> (order+1), free_area[order].map))
+                        break;
+                del_free_block(order, PAGE_BLOCK(nr ^ (1 << order)));
+                buddy_stats.merges++;
+                nr &= ~(1UL << order);
+                order++;
+        }
+        add_free_block(order, nr);
+}
+
+/*
+ * 分配 2^order 个物理上连续的页面，不清零
+ *
+ * order: 块大小的对数，0 ～ MAX_ORDER-1
+ *
+ * 返回：第一页的物理地址，没有足够大的空闲块时返回 0
+ *
+ * 可以用于 DMA 缓冲区等需要物理连续内存的地方，用 free_pages 释放
+ */
+unsigned long __get_free_pages(int order)
+{
+        struct free_block * b;
+        unsigned long nr, i;
+        int o;
+
+        if (order < 0 || order >= MAX_ORDER)
+                return 0;
+repeat:
+        for (o = order ; o < MAX_ORDER ; o++)
+                if (free_area[o].list)
+                        break;
+        if (o >= MAX_ORDER) {
+                if (shrink_page_cache()) // 从页缓存中释放一页再试
+                        goto repeat;
+                buddy_stats.failed++;
+                return 0;
+        }
+        b = free_area[o].list;
+        del_free_block(o, b);
+        nr = BLOCK_NR(b);
+        if (o < MAX_ORDER-1)
+                toggle_bit(nr >> (o+1), free_area[o].map);
+        free_area[order].allocs++;
+        // 拆分：低的一半留着继续拆，高的一半放回低一级的链表
+        while (o > order) {
+                o--;
+                add_free_block(o, nr + (1 << o));
+                toggle_bit(nr >> (o+1), free_area[o].map);
+                buddy_stats.splits++;
+        }
+        for (i = 0 ; i < (1 << order) ; i++)
+                mem_map[nr+i] = 1;
+        return LOW_MEM + (nr << 12);
+}
 
 /*
  * Get physical address of first (actually last :-) free page, and mark it
  * used. If no free pages left, return 0.
  */
+/**
+ * 申请一页清零的物理页面
+ *
+ * 返回：页面的物理地址，如果没有空闲页面则返回 0
+ *
+ * 没有空闲页面时调用 swap_out 换出（或者丢弃）一个用户页面再试，所以可能睡眠
+ */
 unsigned long get_free_page(void)
 {
-        register unsigned long __res asm("ax");
-
-        __asm__("std ; repne ; scasb\n\t"
-                "jne 1f\n\t"
-                "movb $1,1(%%edi)\n\t"
-                "sall $12,%%ecx\n\t"
-                "addl %2,%%ecx\n\t"
-                "movl %%ecx,%%edx\n\t"
-                "movl $1024,%%ecx\n\t"
-                "leal 4092(%%edx),%%edi\n\t"
-                "rep ; stosl\n\t"
-                "movl %%edx,%%eax\n"
-                "1:"
-                :"=a" (__res)
-                :"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-                 "D" (mem_map+PAGING_PAGES-1)
+        unsigned long page;
+
+        while (!(page = __get_free_pages(0)))
+                if (!swap_out())
+                        return 0;
+        __asm__("cld ; rep ; stosl"
+                ::"a" (0),"c" (1024),"D" (page)
                 );
-        return __res;
+        return page;
 }
 
 /*
@@ -107,11 +237,67 @@ void free_page(unsigned long addr)
 // 换算出页面号
         addr -= LOW_MEM;
         addr >>= 12;
-        // 如果对应页面的字节映射值大于0，则递减1，结束
-        if (mem_map[addr]--) return;
-        // 如果此时的页面的字节映射值已经等于或小于0,意味着原本就是空闲的，说明内核出错，则显示出错信息，并停止内核
-        mem_map[addr]=0;
-        panic("trying to free free page");
+        // 如果此时的页面的字节映射值已经等于0,意味着原本就是空闲的，说明内核出错，则显示出错信息，并停止内核
+        if (!mem_map[addr])
+                panic("trying to free free page");
+        // 如果对应页面的字节映射值大于0，则递减1，还有引用则结束
+        if (--mem_map[addr])
+                return;
+        // 最后一个引用也没有了：放回伙伴系统
+        free_pages_ok(addr, 0);
+}
+
+/**
+ * 增加物理页面 addr 的引用计数（页缓存把同一个页面交给多个使用者时调用）
+ */
+void get_page(unsigned long addr)
+{
+        mem_map[MAP_NR(addr)]++;
+}
+
+/**
+ * 取得物理页面 addr 的引用计数
+ */
+int page_count(unsigned long addr)
+{
+        return mem_map[MAP_NR(addr)];
+}
+
+/**
+ * 释放 __get_free_pages 分配的 2^order 个连续页面
+ *
+ * addr: 第一页的物理地址
+ * order: 分配时的 order
+ */
+void free_pages(unsigned long addr, int order)
+{
+        int i;
+
+        for (i = 0 ; i < (1 << order) ; i++, addr += 4096)
+                free_page(addr);
+}
+
+/**
+ * 打印伙伴系统的统计信息：每一级的空闲块数，以及分配，拆分，合并的次数
+ */
+void show_mem_stats(void)
+{
+        int order, free = 0, largest = -1;
+
+        printk("free pages per order:");
+        for (order = 0 ; order < MAX_ORDER ; order++) {
+                printk(" %d", free_area[order].nr_free);
+                free += free_area[order].nr_free << order;
+                if (free_area[order].nr_free)
+                        largest = order;
+        }
+        printk("\n\r  %d pages free (of %d), largest free block order %d\n\r",
+               free, PAGING_PAGES, largest);
+        printk("  allocations per order:");
+        for (order = 0 ; order < MAX_ORDER ; order++)
+                printk(" %d", free_area[order].allocs);
+        printk("\n\r  %d splits, %d merges, %d failed, %d clean pages dropped\n\r",
+               buddy_stats.splits, buddy_stats.merges, buddy_stats.failed, dropped_pages);
 }
 
 /*
@@ -155,6 +341,8 @@ int free_page_tables(unsigned long from,unsigned long size)
                 for (nr=0 ; nr<1024 ; nr++) {
                         if (1 & *pg_table) // 当前页表被使用
                                 free_page(0xfffff000 & *pg_table); // 释放页表对应的内存页
+                        else if (*pg_table) // 页面已经被换出：释放交换页
+                                swap_free(SWP_NR(*pg_table));
                         *pg_table = 0; // 当前页表的值设置为0，没使用
                         pg_table++; // 遍历下一项页表
                 }
@@ -165,6 +353,35 @@ int free_page_tables(unsigned long from,unsigned long size)
         return 0;
 }
 
+/**
+ * 取消线性地址 [from, from + size) 中所有页面的映射，并放回这些页面，页表本身保留
+ * from: 起始线性地址（页面对齐）
+ * size: 字节长度（页面对齐）
+ *
+ * 无返回值
+ *
+ * free_page_tables 只能以 4MB 为单位释放，munmap 需要按页面取消映射
+ */
+void unmap_pages(unsigned long from, unsigned long size)
+{
+        unsigned long * dir, * pte, end = from + size;
+
+        for ( ; from < end ; from += PAGE_SIZE) {
+                dir = (unsigned long *) ((from>>20) & 0xffc); /* _pg_dir = 0 */
+                if (!(1 & *dir)) { // 页表不存在：跳到下一个 4MB
+                        from = (from & 0xffc00000) + 0x400000 - PAGE_SIZE;
+                        continue;
+                }
+                pte = (unsigned long *) ((0xfffff000 & *dir) + ((from>>10) & 0xffc));
+                if (1 & *pte)
+                        free_page(0xfffff000 & *pte);
+                else if (*pte)
+                        swap_free(SWP_NR(*pte));
+                *pte = 0;
+        }
+        invalidate();
+}
+
 /*
  *  Well, here is one of the most complicated functions in mm. It
  * copies a range of linerar addresses by copying only the pages.
@@ -201,7 +418,7 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 {
         unsigned long * from_page_table;
         unsigned long * to_page_table;
-        unsigned long this_page;
+        unsigned long this_page, new_page;
         unsigned long * from_dir, * to_dir;
         unsigned long nr;
 
@@ -233,8 +450,17 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
                 // 遍历页表项
                 for ( ; nr-- > 0 ; from_page_table++,to_page_table++) {
                         this_page = *from_page_table;
-                        if (!(1 & this_page)) // 判断当前”源页表“是否被用
+                        if (!this_page) // 判断当前”源页表“是否被用
                                 continue; // 没有使用，无需复制
+                        // 页面已经被换出：为父进程读回一个新页面，交换页交给子进程，每个交换页只属于一个页表项
+                        if (!(1 & this_page)) {
+                                if (!(new_page = get_free_page()))
+                                        return -1;
+                                read_swap_page(SWP_NR(this_page),new_page);
+                                *to_page_table = this_page;
+                                *from_page_table = new_page | PAGE_DIRTY | 5 | (this_page & 2);
+                                continue;
+                        }
                         this_page &= ~2; // 重置页表项的 R/W 位为 0，表明对应的内存为只读 (xxxxx & 11111111111111111111111111111101)
                         *to_page_table = this_page; // 设置“目的地址”的”页表项“
                         // 如果该页面在 1MB 上，则需要设置 mem_map[] 中对应的值
@@ -251,6 +477,36 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
         return 0;
 }
 
+/*
+ * 在页表中把线性地址 address 映射到物理页面 page，页表项的属性位为 prot
+ * 页表不存在时申请一页新的页表，失败返回 0，成功返回 page
+ */
+static unsigned long map_page(unsigned long page, unsigned long address, int prot)
+{
+        unsigned long tmp, *page_table;
+
+/* NOTE !!! This uses the fact that _pg_dir=0 */
+        /* 注意!!!  这里使用了页目录表基地址 _pg_dir = 0 的条件 */
+        page_table = (unsigned long *) ((address>>20) & 0xffc); // 计算线性地址 address 在“页目录表”中的“页目录项”的指针
+        if ((*page_table)&1) // 页表在内存中
+                page_table = (unsigned long *) (0xfffff000 & *page_table); // 取得页表地址，放入 page_table 变量
+        else {
+                if (!(tmp=get_free_page())) // 申请一页新的页表
+                        return 0;
+                // 最后三位置位 '111' (xxxx | 7)
+                // 表示对应的内存页面是用户级，并且可读写，存在 (Usr, R/W, Present)
+                *page_table = tmp|7;
+                page_table = (unsigned long *) tmp; // page_table 为新申请的 内存页
+        }
+        
+        // 找到页表中对应的页表项，把 page 地址和属性位填入
+        page_table[(address>>12) & 0x3ff] = page | prot;
+/* no need for invalidate */
+        
+        // 无须刷新页面缓冲
+        return page;
+}
+
 /*
  * This function puts a page in memory at the wanted address.
  * It returns the physical address of the page gotten, 0 if
@@ -276,35 +532,25 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
  */
 unsigned long put_page(unsigned long page,unsigned long address)
 {
-        unsigned long tmp, *page_table;
-
-/* NOTE !!! This uses the fact that _pg_dir=0 */
-        /* 注意!!!  这里使用了页目录表基地址 _pg_dir = 0 的条件 */
-
         // 检查给定物理内存页面 page 的有效性
         if (page < LOW_MEM || page >= HIGH_MEMORY) // 是否低于主内存或高于最大地址
                 printk("Trying to put page %p at %p\n",page,address); // page地址无效，打印错误报警
         if (mem_map[(page-LOW_MEM)>>12] != 1) // 检查对应的内存字节映射值是否为 1，其实是检查页面是否被申请
                 printk("mem_map disagrees with %p at %p\n",page,address); // 没有被申请，则打印错误报警
-        page_table = (unsigned long *) ((address>>20) & 0xffc); // 计算线性地址 address 在“页目录表”中的“页目录项”的指针
-        if ((*page_table)&1) // 页表在内存中
-                page_table = (unsigned long *) (0xfffff000 & *page_table); // 取得页表地址，放入 page_table 变量
-        else {
-                if (!(tmp=get_free_page())) // 申请一页新的页表
-                        return 0;
-                // 最后三位置位 '111' (xxxx | 7)
-                // 表示对应的内存页面是用户级，并且可读写，存在 (Usr, R/W, Present)
-                *page_table = tmp|7;
-                page_table = (unsigned long *) tmp; // page_table 为新申请的 内存页
-        }
-        
-        // 找到页表中对应的页表项，把 page 地址填入
-        // 同样最后三位置位 '111' (xxxx | 7) 
-        page_table[(address>>12) & 0x3ff] = page | 7;
-/* no need for invalidate */
-        
-        // 无须刷新页面缓冲
-        return page;
+        return map_page(page,address,7);
+}
+
+/*
+ * 和 put_page 一样，但是设置页表项的“已修改”位：内核直接写好内容的页面（execve 的参数页面）
+ * 没有经过页表写入，如果不设置，swap_out 会把它当作干净的页面直接丢弃
+ */
+unsigned long put_dirty_page(unsigned long page,unsigned long address)
+{
+        if (page < LOW_MEM || page >= HIGH_MEMORY)
+                printk("Trying to put page %p at %p\n",page,address);
+        if (mem_map[(page-LOW_MEM)>>12] != 1)
+                printk("mem_map disagrees with %p at %p\n",page,address);
+        return map_page(page,address,PAGE_DIRTY | 7);
 }
 
 /**
@@ -321,9 +567,11 @@ unsigned long put_page(unsigned long page,unsigned long address)
  */
 void un_wp_page(unsigned long * table_entry)
 {
-        unsigned long old_page,new_page;
+        unsigned long old_page,new_page,entry;
 
-        old_page = 0xfffff000 & *table_entry; // 获得页面的物理地址
+repeat:
+        entry = *table_entry;
+        old_page = 0xfffff000 & entry; // 获得页面的物理地址
         // 页面位于主内存，并且内存映射字节图的值为 1 (只有1个进程使用，没有被共享)
         if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)]==1) {
                 *table_entry |= 2; // 修改 R/W 位 为可写
@@ -332,9 +580,19 @@ void un_wp_page(unsigned long * table_entry)
         }
         if (!(new_page=get_free_page())) // 尝试申请一页新的内存
                 oom(); // 内存不够，打印信息，死机
+        // get_free_page 可能因为换出页面而睡眠：期间页面可能被换出，或者不再被共享，重新检查
+        if (*table_entry != entry ||
+            (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)]==1)) {
+                free_page(new_page);
+                if (!(*table_entry & 1)) // 已经被换出：返回后再次访问时产生缺页异常
+                        return;
+                goto repeat;
+        }
         if (old_page >= LOW_MEM) 
                 mem_map[MAP_NR(old_page)]--; // 取消页面共享
-        *table_entry = new_page | 7; // 页表项指向新分配的页面，设置最后三位是 "111"
+        // 页表项指向新分配的页面，设置最后三位是 "111"
+        // 新页面的内容是复制来的，设置“已修改”位，swap_out 不能把它当作干净的页面丢弃
+        *table_entry = new_page | PAGE_DIRTY | 7;
         copy_page(old_page,new_page); // 复制老的页面的内容到新的页面
         invalidate(); // 刷新页面变换缓冲
 }	
@@ -354,6 +612,12 @@ void un_wp_page(unsigned long * table_entry)
  */
 void do_wp_page(unsigned long error_code,unsigned long address)
 {
+        struct vm_area * vma;
+
+        // 写只读的文件映射区：终止进程。可写的私有映射区和其他页面一样写时复制
+        if ((vma = find_vma(current,address - current->start_code)) &&
+            !(vma->v_prot & PROT_WRITE))
+                do_exit(SIGSEGV);
 #if 0
 /* we cannot do this yet: the estdio library writes to code space */
 /* stupid, stupid. I really want the libc.a from GNU */
@@ -455,6 +719,15 @@ static int try_to_share(unsigned long address, struct task_struct * p)
         // (p->start_code>>20) & 0xffc : 进程 p 在 4G 线性地址空间中起始地址对应的页目录项
         from_page += ((p->start_code>>20) & 0xffc); // p进程的”页目录项“
         to_page += ((current->start_code>>20) & 0xffc); // 当前进程的”页目录项“
+        // 先准备好当前进程的页表：get_free_page 可能因为换出页面而睡眠，期间 p 的页面甚至页表都可能被释放，
+        // 所以睡眠之后才检查 p 的页表项
+        to = *(unsigned long *) to_page; // 获得当前进程 ”页目录项“的内容，也就是”页表项“
+        if (!(to & 1)) { // P == 0，不存在，则分配一页新的内存
+                if ((to = get_free_page()))
+                        *(unsigned long *) to_page = to | 7; // 设置”页目录项“的内容为新分配的地址，最后三位设为 "111"
+                else
+                        oom();//无法分配新的内存，出错，死机
+        }
 /* is there a page-directory at from? */
         from = *(unsigned long *) from_page; // 获得 p 进程中对应的”页目录项“内容
         if (!(from & 1)) // P == 0， 页表不存在，直接返回
@@ -468,13 +741,6 @@ static int try_to_share(unsigned long address, struct task_struct * p)
         phys_addr &= 0xfffff000; 
         if (phys_addr >= HIGH_MEMORY || phys_addr < LOW_MEM) // 检查对应的内存物理地址是否有效
                 return 0; // 无效直接返回
-        to = *(unsigned long *) to_page; // 获得当前进程 ”页目录项“的内容，也就是”页表项“
-        if (!(to & 1)) { // P == 0，不存在，则分配一页新的内存
-                if ((to = get_free_page()))
-                        *(unsigned long *) to_page = to | 7; // 设置”页目录项“的内容为新分配的地址，最后三位设为 "111"
-                else
-                        oom();//无法分配新的内存，出错，死机
-        }
         to &= 0xfffff000; 
         to_page = to + ((address>>10) & 0xffc); // 计算对应的页表项的指针
         if (1 & *(unsigned long *) to_page) // 检查对应的页表项的是否已经存在，原来是想共享父进程的页面，但子进程要共享的地方已经占有了物理页面，程序错误
@@ -540,6 +806,57 @@ static int share_page(unsigned long address)
         return 0;
 }
 
+/*
+ * 文件映射区中的缺页处理：从页缓存中取得文件页面
+ *
+ * 读操作，并且整页都在文件中时直接以只读方式映射页缓存中的页面，
+ * 运行同一个程序或者映射同一个文件的进程就共享同一个物理页面，以后写的时候再写时复制
+ * 否则（写操作，或者文件的最后一页）复制到一个私有页面中，并清除文件末尾之后的部分
+ */
+static void do_mmap_page(struct vm_area * vma, unsigned long error_code,
+                         unsigned long address, unsigned long tmp)
+{
+        struct m_inode * inode = vma->v_inode;
+        unsigned long page, from, off;
+        int i;
+
+        if ((error_code & 2) && !(vma->v_prot & PROT_WRITE)) // 写只读的映射区
+                do_exit(SIGSEGV);
+        off = vma->v_offset + tmp - vma->v_start; // 页面在文件中的偏移
+        // 页面整个在文件末尾之后：不用读文件（也不调用 bmap），映射一个清零的页面
+        if (off >= inode->i_size) {
+                if (!(page = get_free_page()))
+                        oom();
+                if (map_page(page,address,(vma->v_prot & PROT_WRITE) ? 7 : 5))
+                        return;
+                free_page(page);
+                oom();
+        }
+        if (!(from = get_file_page(inode,off / BLOCK_SIZE)))
+                oom();
+        if (!(error_code & 2) && off + PAGE_SIZE <= inode->i_size) {
+                if (map_page(from,address,5))
+                        return;
+                free_page(from);
+                oom();
+        }
+        if (!(page = get_free_page())) {
+                free_page(from);
+                oom();
+        }
+        copy_page(from,page);
+        free_page(from); // 放回页缓存页面的引用
+        if (off + PAGE_SIZE > inode->i_size) {
+                i = (off < inode->i_size) ? inode->i_size - off : 0;
+                for ( ; i < PAGE_SIZE ; i++)
+                        *(char *) (page + i) = 0;
+        }
+        if (map_page(page,address,(vma->v_prot & PROT_WRITE) ? 7 : 5))
+                return;
+        free_page(page);
+        oom();
+}
+
 /**
  * 执行缺页处理
  *
@@ -549,13 +866,27 @@ static int share_page(unsigned long address)
  */
 void do_no_page(unsigned long error_code,unsigned long address)
 {
-        int nr[4];
         unsigned long tmp;
-        unsigned long page;
-        int block,i;
+        unsigned long page, from, * pte;
+        struct vm_area * vma;
+        int i;
 
         address &= 0xfffff000; // address 处缺页页面的地址
+        // 页表项不为 0：页面被换出到了交换设备上，换入
+        if (1 & *(pte = (unsigned long *) ((address>>20) & 0xffc))) {
+                pte = (unsigned long *) ((0xfffff000 & *pte) + ((address>>10) & 0xffc));
+                if (*pte) {
+                        if (!(*pte & 1) && !swap_in(pte))
+                                oom();
+                        return;
+                }
+        }
         tmp = address - current->start_code; // address 处的逻辑地址
+        // 文件映射区中的页面
+        if ((vma = find_vma(current,tmp))) {
+                do_mmap_page(vma,error_code,address,tmp);
+                return;
+        }
         // 当前进程没有可执行段 或者 逻辑地址大于可执行段：这意味着逻辑地址处于数据段
         if (!current->executable || tmp >= current->end_data) {
                 get_empty_page(address); // 动态申请一页内存页面，返回
@@ -563,15 +894,26 @@ void do_no_page(unsigned long error_code,unsigned long address)
         }
         if (share_page(tmp)) // 对于可执行段执行共享操作，
                 return; // 成功则直接返回
-        if (!(page = get_free_page())) // 尝试申请一页新的物理页面
-                oom(); // 申请失败，则内存不够，死机
 /* remember that 1 block is used for header */
         /* 记住“程序头”要使用一个“数据块” */
-        block = 1 + tmp/BLOCK_SIZE; // 计算块的数量，每个块是 1024 字节
-        for (i=0 ; i<4 ; block++,i++) // 读一个页面，实际上等于 4个逻辑块
-                // 根据“执行文件的i节点”和”块数“，就可以从对应的“块设备”中找到对应的设备”逻辑块号“，保存在 nr[]数组 中
-                nr[i] = bmap(current->executable,block); 
-        bread_page(page,current->executable->i_dev,nr); // 利用 bread_page 把这四个逻辑块从设备读入到物理页面
+        // 从页缓存中取得执行文件从第 (1 + tmp/BLOCK_SIZE) 块开始的一页（4个逻辑块），不在缓存中时从设备读入
+        if (!(from = get_file_page(current->executable,1 + tmp/BLOCK_SIZE)))
+                oom(); // 申请失败，则内存不够，死机
+        // 整页都是文件中的内容：直接映射页缓存中的页面，设置为只读（用户级，存在），进程写的时候再写时复制
+        // 以后其他进程（即使不是运行同一个执行文件的进程的子孙）执行这个程序时，这一页仍然在页缓存中
+        if (tmp + 4096 <= current->end_data) {
+                if (map_page(from,address,5))
+                        return;
+                free_page(from);
+                oom();
+        }
+        // 最后一页：把页缓存中的内容复制到一个新的页面中，再清除文件末尾之后的部分
+        if (!(page = get_free_page())) { // 尝试申请一页新的物理页面
+                free_page(from);
+                oom(); // 申请失败，则内存不够，死机
+        }
+        copy_page(from,page);
+        free_page(from); // 放回页缓存页面的引用
 
         // 在读设备逻辑块的时候可能出现一种情况：可执行文件的读取位置到文件末尾小于 1个页面
         // 此时要清空最后那些无效的数据
@@ -589,25 +931,140 @@ void do_no_page(unsigned long error_code,unsigned long address)
         oom();
 }
 
+/*
+ * 换出页面的时钟(clock)算法：按线性地址顺序循环扫描所有进程的页表项（跳过任务 0 所在的前 64MB），
+ * 扫描指针停在上次换出的位置
+ * mem_map 只有引用计数，没有从物理页面找到页表项的反向映射，所以扫描的是页表而不是 mem_map
+ *
+ * 只被一个页表项引用的页面才能换出：
+ * 最近访问过的页面（“已访问”位为 1）清除访问位，给它第二次机会
+ * 干净的页面（没有修改过）直接丢弃，以后缺页时重新从执行文件，文件映射中读入，或者重新清零
+ * 修改过的页面由 swap_out_page 写到交换设备上
+ */
+#define TASK_SIZE 0x4000000 // 每个任务的线性地址空间大小：64MB
+#define FIRST_VM_DIR (TASK_SIZE >> 22) // 第一个参与扫描的页目录项：任务 1 的线性地址空间
+#define VM_PAGES ((1024 - FIRST_VM_DIR) * 1024) // 参与扫描的页表项总数
+
+static int try_to_swap_out(unsigned long * pte)
+{
+        unsigned long page = *pte;
+
+        if (!(page & 1))
+                return 0;
+        if (page & PAGE_ACCESSED) {
+                *pte &= ~PAGE_ACCESSED;
+                return 0;
+        }
+        page &= 0xfffff000;
+        if (page < LOW_MEM || page >= HIGH_MEMORY || mem_map[MAP_NR(page)] != 1)
+                return 0;
+        if (*pte & PAGE_DIRTY)
+                return swap_out_page(pte);
+        *pte = 0;
+        invalidate();
+        free_page(page);
+        dropped_pages++;
+        return 1;
+}
+
+/**
+ * 换出或者丢弃一个用户页面
+ *
+ * 返回：释放了一个页面返回 1，否则返回 0
+ *
+ * 由 get_free_page 在没有空闲页面时调用，写交换设备时会睡眠
+ */
+int swap_out(void)
+{
+        static int dir_entry = FIRST_VM_DIR, page_entry = -1;
+        unsigned long * pg_table;
+        int counter;
+
+        // 最多扫描两遍：第一遍可能只是清除了所有页面的访问位
+        for (counter = 2 * VM_PAGES ; counter > 0 ; counter--) {
+                if (++page_entry >= 1024) {
+                        page_entry = 0;
+                        if (++dir_entry >= 1024)
+                                dir_entry = FIRST_VM_DIR;
+                }
+                if (!(1 & pg_dir[dir_entry])) { // 没有页表：跳过整个页表
+                        counter -= 1023 - page_entry;
+                        page_entry = 1023;
+                        continue;
+                }
+                pg_table = (unsigned long *) (0xfffff000 & pg_dir[dir_entry]);
+                if (try_to_swap_out(pg_table + page_entry)) {
+                        invalidate(); // 让清除的访问位生效
+                        return 1;
+                }
+        }
+        invalidate();
+        printk("Out of swap-memory\n\r");
+        return 0;
+}
+
+/**
+ * 恒等映射 16MB 以上的物理内存
+ * start_mem: 主内存开始地址（在 16MB 以下）
+ * end_mem: 实际物理内存的最大地址
+ *
+ * 返回：新的主内存开始地址
+ *
+ * head.s 只建立了映射前 16MB 的 4 个页表，更多的内存在这里从 start_mem 开始取页面作为页表，
+ * 依次填入页目录的第 4 项以后，这样内核就可以像以前一样直接用物理地址访问全部内存
+ * 注意：内核段和任务 0 都只占用线性地址空间的前 64MB（页目录的前 16 项），所以最多映射 64MB
+ */
+long paging_init(long start_mem, long end_mem)
+{
+        unsigned long * pg_table, addr = HEAD_MAPPED;
+        int i, dir = HEAD_MAPPED >> 22;
+
+        while (addr < end_mem) {
+                pg_table = (unsigned long *) start_mem;
+                start_mem += 4096;
+                for (i = 0 ; i < 1024 ; i++, addr += 4096)
+                        pg_table[i] = (addr < end_mem) ? (addr | 7) : 0; // 存在，用户可读写
+                pg_dir[dir++] = 7 + (unsigned long) pg_table;
+        }
+        invalidate();
+        return start_mem;
+}
+
 /**
  * 内存初始化函数：物理内存管理初始化
  * start_mem: 可用作页面分配的开始地址（已去除RAMDISK）
  * end_mem: 实际物理内存的最大地址
+ *
+ * mem_map 和各级伙伴位图的大小取决于实际内存大小，放在 start_mem 开始处，它们占用的页面不参与分配
  */
 void mem_init(long start_mem, long end_mem)
 {
-        int i;
+        int i, order;
+        unsigned long * map;
 
         HIGH_MEMORY = end_mem; // 设置物理内存最大地址
+        PAGING_PAGES = (end_mem - LOW_MEM) >> 12; // 1MB 以上的内存页数
+        mem_map = (unsigned char *) start_mem;
+        map = (unsigned long *) ((start_mem + PAGING_PAGES + 3) & ~3);
+        // 各级伙伴位图依次放在 mem_map 后面，一开始全为 0（所有页面都被占用）
+        for (order = 0 ; order < MAX_ORDER ; order++) {
+                free_area[order].list = NULL;
+                free_area[order].map = map;
+                for (i = (PAGING_PAGES >> (order+1)) / 32 + 1 ; i > 0 ; i--)
+                        *(map++) = 0;
+        }
+        start_mem = ((unsigned long) map + 4095) & ~4095;
         // 先把所有可分配的页面标志位设置为占用
         for (i=0 ; i<PAGING_PAGES ; i++)  
                 mem_map[i] = USED; 
         i = MAP_NR(start_mem); // 计算可分配页面最开始的地址的页面号码
         end_mem -= start_mem; // 可用内存大小
         end_mem >>= 12; // 可用内存的页面数
-        // 从可用内存的第一块页面开始到最后一块可用内存，设置 mem_map 中对应的值为0（可用）
-        while (end_mem-->0) 
-                mem_map[i++]=0;
+        // 从可用内存的第一块页面开始到最后一块可用内存，设置 mem_map 中对应的值为0（可用），并逐页放入伙伴系统
+        while (end_mem-->0) {
+                mem_map[i]=0;
+                free_pages_ok(i++, 0);
+        }
 }
 
 /**
@@ -615,13 +1072,11 @@ void mem_init(long start_mem, long end_mem)
  */
 void calc_mem(void)
 {
-        int i,j,k,free=0;
+        int i,j,k;
         long * pg_tbl;
 
-        // 显示主内存有多少可用的页面数
-        for(i=0 ; i<PAGING_PAGES ; i++)
-                if (!mem_map[i]) free++;
-        printk("%d pages free (of %d)\n\r",free,PAGING_PAGES);
+        // 显示主内存有多少可用的页面数，以及每一级的空闲块数
+        show_mem_stats();
         //　打印每个页目录表中对应的目表项占用的页面数 
         for(i=2 ; i<1024 ; i++) { // 从２开始遍历，因为１给了进程０使用
                 // pg_dir[i] = 1, 代表这个页目录项被使用
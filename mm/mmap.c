@@ -0,0 +1,236 @@
+/*
+ *  linux/mm/mmap.c
+ */
+
+/*
+ * 文件映射：mmap, munmap 系统调用
+ *
+ * 映射区记录在进程的 mmap[] 数组中（逻辑地址，页面对齐），建立映射时并不读文件，也不修改页表：
+ * 进程访问映射区时产生缺页异常，由 do_no_page 从页缓存中取得文件页面并映射进来，
+ * 所以扫描大文件时数据只从设备读入页缓存一次，不用再经过 file_read 复制到用户缓冲区
+ *
+ * 只支持只读的共享映射和私有映射，私有映射可以写，写时复制，修改不会写回文件
+ * 映射区放在进程 64MB 逻辑地址空间中堆和栈之间的 [MMAP_BASE, MMAP_END) 内
+ */
+
+#include <errno.h> // 错误号头文件
+#include <fcntl.h> // 文件控制头文件：O_ACCMODE
+#include <sys/stat.h> // 文件状态头文件：S_ISREG
+#include <sys/mman.h> // 文件映射头文件
+
+#include <linux/sched.h> // 调度程序头文件
+#include <linux/kernel.h> // 内核常用函数头文件
+#include <linux/mm.h> // 内存管理头文件
+#include <asm/segment.h> // 段操作头文件：get_fs_long
+
+#define MMAP_BASE 0x2000000 // 映射区的最低逻辑地址：32MB
+#define MMAP_END 0x3800000 // 映射区的最高逻辑地址：56MB，上面留给栈
+
+/**
+ * 查找进程 p 中包含逻辑地址 addr 的文件映射区
+ *
+ * 返回：映射区指针，addr 不在任何映射区中时返回 NULL
+ */
+struct vm_area * find_vma(struct task_struct * p, unsigned long addr)
+{
+        struct vm_area * vma;
+
+        for (vma = p->mmap ; vma < p->mmap + NR_MMAP ; vma++)
+                if (vma->v_end && addr >= vma->v_start && addr < vma->v_end)
+                        return vma;
+        return NULL;
+}
+
+/**
+ * 返回：进程 p 最低的文件映射区的开始地址，没有映射区时返回 0
+ *
+ * sys_brk 用它防止堆长进映射区中
+ */
+unsigned long mmap_lowest(struct task_struct * p)
+{
+        struct vm_area * vma;
+        unsigned long low = 0;
+
+        for (vma = p->mmap ; vma < p->mmap + NR_MMAP ; vma++)
+                if (vma->v_end && (!low || vma->v_start < low))
+                        low = vma->v_start;
+        return low;
+}
+
+/*
+ * 在当前进程中找一段长度为 len 的空闲逻辑地址（第一个合适的）
+ *
+ * 返回：开始地址，找不到时返回 0
+ */
+static unsigned long get_unmapped_area(unsigned long len)
+{
+        struct vm_area * vma;
+        unsigned long addr = PAGE_ALIGN(current->brk);
+
+        if (addr < MMAP_BASE)
+                addr = MMAP_BASE;
+repeat:
+        if (addr + len > MMAP_END)
+                return 0;
+        for (vma = current->mmap ; vma < current->mmap + NR_MMAP ; vma++)
+                if (vma->v_end && vma->v_start < addr + len && vma->v_end > addr) {
+                        addr = vma->v_end;
+                        goto repeat;
+                }
+        return addr;
+}
+
+static struct vm_area * get_empty_vma(void)
+{
+        struct vm_area * vma;
+
+        for (vma = current->mmap ; vma < current->mmap + NR_MMAP ; vma++)
+                if (!vma->v_end)
+                        return vma;
+        return NULL;
+}
+
+/*
+ * 取消当前进程中 [addr, addr + len) 内的文件映射（逻辑地址，页面对齐）
+ * 映射区可能被整个删除，截去头部或尾部，或者从中间分成两个
+ *
+ * 返回：成功返回 0，需要分开映射区但没有空闲项时返回 -ENOMEM
+ */
+static int do_munmap(unsigned long addr, unsigned long len)
+{
+        struct vm_area * vma, * tail;
+        struct m_inode * inode;
+        unsigned long end = addr + len, start, stop;
+
+        for (vma = current->mmap ; vma < current->mmap + NR_MMAP ; vma++) {
+                if (!vma->v_end || vma->v_start >= end || vma->v_end <= addr)
+                        continue;
+                start = (addr > vma->v_start) ? addr : vma->v_start;
+                stop = (end < vma->v_end) ? end : vma->v_end;
+                if (start > vma->v_start && stop < vma->v_end) { // 从中间分开，后一半放到一个新的项中
+                        if (!(tail = get_empty_vma()))
+                                return -ENOMEM;
+                        *tail = *vma;
+                        tail->v_start = stop;
+                        tail->v_offset += stop - vma->v_start;
+                        tail->v_inode->i_count++;
+                        vma->v_end = start;
+                } else if (start > vma->v_start) // 截去尾部
+                        vma->v_end = start;
+                else if (stop < vma->v_end) { // 截去头部
+                        vma->v_offset += stop - vma->v_start;
+                        vma->v_start = stop;
+                } else { // 整个删除
+                        inode = vma->v_inode;
+                        vma->v_end = 0;
+                        vma->v_inode = NULL;
+                        iput(inode);
+                }
+                unmap_pages(current->start_code + start,stop - start);
+        }
+        return 0;
+}
+
+/**
+ * 把文件映射到当前进程的地址空间中
+ *
+ * buffer: 用户空间中 6 个长字参数的数组：addr, len, prot, flags, fd, off
+ * （系统调用最多只能通过寄存器传递 3 个参数）
+ *
+ * 返回：成功返回映射区的开始地址（逻辑地址），失败返回错误号
+ */
+int sys_mmap(unsigned long * buffer)
+{
+        unsigned long addr, len, off;
+        int prot, flags, fd;
+        struct file * file;
+        struct m_inode * inode;
+        struct vm_area * vma;
+
+        addr = get_fs_long(buffer);
+        len = get_fs_long(buffer+1);
+        prot = get_fs_long(buffer+2);
+        flags = get_fs_long(buffer+3);
+        fd = get_fs_long(buffer+4);
+        off = get_fs_long(buffer+5);
+        if (!len || len > MMAP_END - MMAP_BASE || (off & 0xfff))
+                return -EINVAL;
+        len = PAGE_ALIGN(len);
+        // 映射区不能超出文件系统能表示的最大文件（否则缺页时 bmap 会停机），off + len 也不能溢出
+        if (off + len < off || (off + len) / BLOCK_SIZE > 7+512+512*512)
+                return -EINVAL;
+        if (fd < 0 || fd >= NR_OPEN || !(file = current->filp[fd]))
+                return -EBADF;
+        if (!(inode = file->f_inode) || !S_ISREG(inode->i_mode))
+                return -ENODEV;
+        if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+                return -EACCES;
+        switch (flags & MAP_TYPE) {
+                case MAP_SHARED: // 修改不能写回文件：共享映射只能只读
+                        if (prot & PROT_WRITE)
+                                return -EINVAL;
+                        break;
+                case MAP_PRIVATE:
+                        break;
+                default:
+                        return -EINVAL;
+        }
+        if (flags & MAP_FIXED) {
+                if ((addr & 0xfff) || addr < PAGE_ALIGN(current->brk) ||
+                    addr + len > MMAP_END)
+                        return -EINVAL;
+                if (do_munmap(addr,len))
+                        return -ENOMEM;
+        } else if (!(addr = get_unmapped_area(len)))
+                return -ENOMEM;
+        if (!(vma = get_empty_vma()))
+                return -ENOMEM;
+        vma->v_start = addr;
+        vma->v_end = addr + len;
+        vma->v_inode = inode;
+        vma->v_offset = off;
+        vma->v_prot = prot;
+        inode->i_count++;
+        return addr;
+}
+
+/**
+ * 取消当前进程中 [addr, addr + len) 内的文件映射
+ *
+ * 返回：成功返回 0，失败返回错误号
+ */
+int sys_munmap(unsigned long addr, unsigned long len)
+{
+        if ((addr & 0xfff) || !len || addr + len < addr)
+                return -EINVAL;
+        return do_munmap(addr,PAGE_ALIGN(len));
+}
+
+/**
+ * fork 时调用：子进程 p 复制了父进程的映射区（以及页表），增加被映射文件的i节点引用计数
+ */
+void dup_mmap(struct task_struct * p)
+{
+        struct vm_area * vma;
+
+        for (vma = p->mmap ; vma < p->mmap + NR_MMAP ; vma++)
+                if (vma->v_end)
+                        vma->v_inode->i_count++;
+}
+
+/**
+ * exit, execve 时调用：放弃进程 p 所有的文件映射区，映射的页面随页表一起释放
+ */
+void exit_mmap(struct task_struct * p)
+{
+        struct vm_area * vma;
+        struct m_inode * inode;
+
+        for (vma = p->mmap ; vma < p->mmap + NR_MMAP ; vma++)
+                if (vma->v_end) {
+                        inode = vma->v_inode;
+                        vma->v_end = 0;
+                        vma->v_inode = NULL;
+                        iput(inode);
+                }
+}
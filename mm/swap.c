@@ -0,0 +1,244 @@
+/*
+ *  linux/mm/swap.c
+ */
+
+/*
+ * 交换空间：内存不够时把用户进程的页面写到交换设备（硬盘分区）上
+ *
+ * 交换设备用 swapon 系统调用启用，设备的第一页是交换空间的位图（mkswap 的格式）：
+ * 每一位对应设备上的一页，为 1 表示该页可以使用，页面最后 10 个字节是签名 "SWAP-SPACE"
+ *
+ * 页面换出后，页表项中保存交换页号 (SWP_ENTRY)：存在位为 0，第 1 位保存原来的读写位，高 20 位是交换页号
+ * 进程再访问这个页面时产生缺页异常，由 do_no_page 调用 swap_in 读回来
+ * 每个交换页只属于一个页表项：fork 时 copy_page_tables 为父进程读回页面，把交换页交给子进程
+ *
+ * 选择换出哪个页面由 mm/memory.c 中的 swap_out 决定（时钟算法），这里只负责交换页的分配和读写
+ * 读写都经过高速缓冲区 (ll_rw_block)：一个页面对应设备上连续的 4 个逻辑块，请求会被合并成一个多扇区请求
+ */
+
+#include <errno.h> // 错误号头文件
+#include <string.h> // 字符串头文件：memcpy, strncmp
+#include <sys/stat.h> // 文件状态头文件：S_ISBLK
+
+#include <linux/sched.h> // 调度程序头文件
+#include <linux/kernel.h> // 内核常用函数头文件：suser
+#include <linux/mm.h> // 内存管理头文件
+
+#define SWAP_BITS (4086 << 3) // 位图描述的最多页数：一页减去 10 字节的签名
+
+// 测试，置位，复位位图 addr 中的第 nr 位，返回原来的值
+#define bitop(name,op)                                                  \
+static inline int name(char * addr,unsigned int nr)                     \
+{                                                                       \
+        int __res;                                                      \
+        __asm__ __volatile__("bt" op " %1,%2; adcl $0,%0"               \
+                             :"=g" (__res)                              \
+                             :"r" (nr),"m" (*(addr)),"0" (0));          \
+        return __res;                                                   \
+}
+
+bitop(bit,"")
+bitop(setbit,"s")
+bitop(clrbit,"r")
+
+static char * swap_bitmap = NULL; // 交换空间的位图，NULL 表示没有启用交换设备
+static int swap_dev = 0; // 交换设备号
+static int swap_hint = 0; // 上一次分配的交换页：从它后面开始找，连续换出的页面在设备上也是连续的
+
+// 统计信息
+static struct {
+        unsigned long total; // 交换页总数
+        unsigned long free; // 空闲的交换页数
+        unsigned long outs; // 换出的页面数
+        unsigned long ins; // 换入的页面数
+} swap_stats;
+
+/*
+ * 分配一个交换页
+ *
+ * 返回：交换页号，没有启用交换设备或者交换空间已满时返回 0（第 0 页是位图，不会被分配）
+ */
+static int get_swap_page(void)
+{
+        int i;
+
+        if (!swap_bitmap || !swap_stats.free)
+                return 0;
+        for (i = 0 ; i < SWAP_BITS ; i++) {
+                if (++swap_hint >= SWAP_BITS)
+                        swap_hint = 1;
+                if (clrbit(swap_bitmap,swap_hint)) {
+                        swap_stats.free--;
+                        return swap_hint;
+                }
+        }
+        return 0;
+}
+
+/**
+ * 释放交换页 nr（页表项被释放，或者页面已经换入）
+ */
+void swap_free(int nr)
+{
+        if (!swap_bitmap || nr <= 0 || nr >= SWAP_BITS) {
+                printk("swap_free: bad swap page %d\n\r",nr);
+                return;
+        }
+        if (setbit(swap_bitmap,nr))
+                printk("swap_free: swap page %d already free\n\r",nr);
+        else
+                swap_stats.free++;
+}
+
+/**
+ * 把交换页 nr 的内容读到物理页面 page 中
+ */
+void read_swap_page(int nr, unsigned long page)
+{
+        int b[4], i;
+
+        for (i = 0 ; i < 4 ; i++)
+                b[i] = (nr << 2) + i;
+        bread_page(page,swap_dev,b);
+}
+
+/**
+ * 把页表项 pte 对应的页面（只被这一个页表项引用，已经修改过）写到交换设备上，并释放该页面
+ *
+ * 返回：换出了页面返回 1，没有交换空间或者页表项在睡眠期间发生了变化返回 0
+ *
+ * 先取得 4 个缓冲块（可能睡眠），然后不再睡眠地检查页表项没有变化，复制页面内容，改写页表项，
+ * 这样换出过程中进程不会访问到正在写出的页面，也不会读到还没有写出的交换页
+ */
+int swap_out_page(unsigned long * pte)
+{
+        struct buffer_head * bh[4];
+        unsigned long entry = *pte, page = entry & 0xfffff000;
+        int nr, i;
+
+        if (!(nr = get_swap_page()))
+                return 0;
+        for (i = 0 ; i < 4 ; i++)
+                bh[i] = getblk(swap_dev,(nr << 2) + i);
+        if (*pte != entry || page_count(page) != 1) { // 睡眠期间页面被访问，共享，或者已经被释放
+                for (i = 0 ; i < 4 ; i++)
+                        brelse(bh[i]);
+                swap_free(nr);
+                return 0;
+        }
+        for (i = 0 ; i < 4 ; i++) {
+                memcpy(bh[i]->b_data,(char *) page + i * BLOCK_SIZE,BLOCK_SIZE);
+                bh[i]->b_uptodate = 1;
+                bh[i]->b_dirt = 1;
+        }
+        *pte = SWP_ENTRY(nr,entry);
+        invalidate();
+        free_page(page);
+        for (i = 0 ; i < 4 ; i++)
+                ll_rw_block(WRITE,bh[i]);
+        for (i = 0 ; i < 4 ; i++)
+                brelse(bh[i]); // 等待写完成
+        swap_stats.outs++;
+        return 1;
+}
+
+/**
+ * 换入页表项 pte 对应的页面（由 do_no_page 调用）
+ *
+ * 返回：成功返回 1，内存不够返回 0
+ *
+ * 页面以原来的读写权限映射，并设置“已修改”标志：交换页随即被释放，页面以后只能再换出到新的交换页中
+ */
+int swap_in(unsigned long * pte)
+{
+        unsigned long entry = *pte, page;
+
+        if (!swap_bitmap) {
+                printk("swap_in: no swap device\n\r");
+                *pte = 0;
+                return 1;
+        }
+        if (!(page = get_free_page()))
+                return 0;
+        read_swap_page(SWP_NR(entry),page);
+        if (*pte != entry) { // 睡眠期间已经被换入
+                free_page(page);
+                return 1;
+        }
+        *pte = page | PAGE_DIRTY | 5 | (entry & 2);
+        swap_free(SWP_NR(entry));
+        swap_stats.ins++;
+        return 1;
+}
+
+/**
+ * 启用交换设备
+ *
+ * specialfile: 交换设备的设备文件名（用户空间），设备上必须已经建立了交换空间位图
+ *
+ * 返回：成功返回 0，失败返回错误号
+ *
+ * 只支持一个交换设备，启用后不能停用
+ */
+int sys_swapon(const char * specialfile)
+{
+        struct m_inode * inode;
+        struct buffer_head * bh;
+        unsigned long page;
+        int dev, i, j;
+
+        if (!suser())
+                return -EPERM;
+        if (swap_bitmap)
+                return -EBUSY;
+        if (!(inode = namei(specialfile)))
+                return -ENOENT;
+        dev = inode->i_zone[0];
+        i = S_ISBLK(inode->i_mode);
+        iput(inode);
+        if (!i)
+                return -ENOTBLK;
+        if (!(page = get_free_page()))
+                return -ENOMEM;
+        for (i = 0 ; i < 4 ; i++) {
+                if (!(bh = bread(dev,i))) {
+                        free_page(page);
+                        return -EIO;
+                }
+                memcpy((char *) page + i * BLOCK_SIZE,bh->b_data,BLOCK_SIZE);
+                brelse(bh);
+        }
+        if (strncmp("SWAP-SPACE",(char *) page + 4086,10)) {
+                printk("Unable to find swap-space signature\n\r");
+                free_page(page);
+                return -EINVAL;
+        }
+        memset((char *) page + 4086,0,10);
+        for (i = 1, j = 0 ; i < SWAP_BITS ; i++)
+                if (bit((char *) page,i))
+                        j++;
+        if (bit((char *) page,0) || !j) {
+                printk("Bad swap-space bit-map\n\r");
+                free_page(page);
+                return -EINVAL;
+        }
+        swap_dev = dev;
+        swap_stats.total = swap_stats.free = j;
+        swap_bitmap = (char *) page;
+        printk("Swap device %04x: %d pages (%dkB) swap-space\n\r",dev,j,j*4);
+        return 0;
+}
+
+/**
+ * 打印交换空间的统计信息
+ */
+void show_swap_stats(void)
+{
+        if (!swap_bitmap) {
+                printk("swap: no swap device\n\r");
+                return;
+        }
+        printk("swap: %d/%d pages used, %d paged out, %d paged in\n\r",
+               swap_stats.total - swap_stats.free, swap_stats.total,
+               swap_stats.outs, swap_stats.ins);
+}